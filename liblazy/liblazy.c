@@ -24,8 +24,12 @@
  ***************************************************************************/
 
 #include "liblazy.h"
+#include "liblazy_local.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 void liblazy_free_string(char *string)
 {
@@ -35,11 +39,27 @@ void liblazy_free_string(char *string)
 	string = NULL;
 }
 
+/* its address marks string lists allocated by liblazy_strlist_alloc */
+static const char strlist_block_tag;
+
 void liblazy_free_strlist(char **strlist)
 {
 	int i = 0;
 	if (strlist == NULL)
 		return;
+
+	for (i = 0; strlist[i] != NULL; i++)
+		;
+	/* string lists of the library are a single block, tagged behind the
+	 * terminator. The tag is only looked at if the strings start right
+	 * behind it, so it can't be read past the end of other lists, which
+	 * are still freed one by one */
+	if (strlist[0] == (char *)(strlist + i + 2) &&
+	    strlist[i + 1] == &strlist_block_tag) {
+		free(strlist);
+		return;
+	}
+
 	for (i = 0; strlist[i] != NULL; i++) {
 		free(strlist[i]);
 		strlist[i] = NULL;
@@ -48,6 +68,179 @@ void liblazy_free_strlist(char **strlist)
 	strlist = NULL;
 }
 
+char **liblazy_strlist_alloc(int count, size_t size, char **strings)
+{
+	char **strlist;
+
+	/* the pointers, the terminator, the tag and the strings */
+	strlist = malloc((count + 2) * sizeof(char *) + size);
+	if (strlist == NULL) {
+		ERROR("Could not allocate string list: OOM");
+		return NULL;
+	}
+	strlist[count] = NULL;
+	strlist[count + 1] = (char *)&strlist_block_tag;
+	*strings = (char *)(strlist + count + 2);
+	return strlist;
+}
+
+char **liblazy_strlist_copy(const char **strlist)
+{
+	char	**copy;
+	char	*pos;
+	size_t	size	= 0;
+	size_t	len;
+	int	count;
+	int	i;
+
+	for (count = 0; strlist[count] != NULL; count++)
+		size += strlen(strlist[count]) + 1;
+
+	copy = liblazy_strlist_alloc(count, size, &pos);
+	if (copy == NULL)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		len = strlen(strlist[i]) + 1;
+		memcpy(pos, strlist[i], len);
+		copy[i] = pos;
+		pos += len;
+	}
+	return copy;
+}
+
+void liblazy_deadline_set(struct timespec *deadline, int msec)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += msec / 1000;
+	deadline->tv_nsec += (msec % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+int liblazy_deadline_passed(const struct timespec *deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline->tv_sec ||
+		(now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+long liblazy_deadline_remaining(const struct timespec *deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (deadline->tv_sec - now.tv_sec) * 1000L +
+		(deadline->tv_nsec - now.tv_nsec) / 1000000L;
+}
+
+LiblazyReply *liblazy_reply_new(void)
+{
+	LiblazyReply *reply;
+
+	reply = calloc(1, sizeof(LiblazyReply));
+	if (reply == NULL)
+		ERROR("Could not allocate reply: OOM");
+	return reply;
+}
+
+void liblazy_reply_free(LiblazyReply *reply)
+{
+	if (reply == NULL)
+		return;
+	liblazy_reply_release(reply);
+	free(reply);
+}
+
+void liblazy_reply_clear(LiblazyReply *reply)
+{
+	if (reply->message != NULL) {
+		dbus_message_unref(reply->message);
+		reply->message = NULL;
+	}
+	if (reply->properties != NULL) {
+		liblazy_hal_free_properties(reply->properties);
+		reply->properties = NULL;
+	}
+	if (reply->snapshot != NULL) {
+		liblazy_hal_snapshot_unref(reply->snapshot);
+		reply->snapshot = NULL;
+	}
+}
+
+void liblazy_reply_release(LiblazyReply *reply)
+{
+	liblazy_reply_clear(reply);
+	free(reply->strlist);
+	reply->strlist = NULL;
+	reply->strlist_size = 0;
+}
+
+void liblazy_reply_set_message(LiblazyReply *reply, DBusMessage *message)
+{
+	liblazy_reply_clear(reply);
+	reply->message = message;
+}
+
+void liblazy_reply_set_properties(LiblazyReply *reply,
+				  LiblazyHalProperties *properties)
+{
+	liblazy_reply_clear(reply);
+	reply->properties = properties;
+}
+
+int liblazy_reply_reserve_strlist(LiblazyReply *reply, int size)
+{
+	const char	**pointers;
+	int		new_size;
+
+	if (size <= reply->strlist_size)
+		return 0;
+
+	new_size = reply->strlist_size ? reply->strlist_size : 16;
+	while (new_size < size)
+		new_size *= 2;
+	pointers = realloc(reply->strlist, new_size * sizeof(char *));
+	if (pointers == NULL) {
+		ERROR("Could not allocate string list: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	reply->strlist = pointers;
+	reply->strlist_size = new_size;
+	return 0;
+}
+
+int liblazy_reply_get_strlist(LiblazyReply *reply, DBusMessageIter *iter,
+			      const char ***strlist)
+{
+	DBusMessageIter	iter_array;
+	int		count	= 0;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY) {
+		ERROR("Iterator doesn't contain an array at current position");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	dbus_message_iter_recurse(iter, &iter_array);
+	for (;;) {
+		if (liblazy_reply_reserve_strlist(reply, count + 1))
+			return LIBLAZY_ERROR_GENERAL;
+		if (dbus_message_iter_get_arg_type(&iter_array) != DBUS_TYPE_STRING)
+			break;
+		dbus_message_iter_get_basic(&iter_array, &reply->strlist[count++]);
+		dbus_message_iter_next(&iter_array);
+	}
+	reply->strlist[count] = NULL;
+	*strlist = reply->strlist;
+	if (TRACE_ENABLED)
+		liblazy_trace_decoded(reply->message, 0);
+	return 0;
+}
+
 /** @mainpage liblazy
  *
  * \section sec_intro Introduction
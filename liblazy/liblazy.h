@@ -40,10 +40,22 @@ extern "C" {
 #define LIBLAZY_ERROR_INVALID_ARGUMENT		-2
 #define LIBLAZY_ERROR_HAL_NOT_READY		-10
 #define LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY	-11
+#define LIBLAZY_ERROR_HAL_TYPE_MISMATCH		-12
+#define LIBLAZY_ERROR_HAL_SNAPSHOT_INVALID	-13
+#define LIBLAZY_ERROR_HAL_SNAPSHOT_STALE	-14
 
 #define LIBLAZY_ERROR_DBUS_NOT_READY		-20
 #define LIBLAZY_ERROR_DBUS_NO_REPLY		-21
 #define LIBLAZY_ERROR_DBUS_ERROR_IS_SET		-22
+#define LIBLAZY_ERROR_DBUS_TIMEOUT		-23
+#define LIBLAZY_ERROR_DBUS_CANCELLED		-24
+
+/** all threads share one connection per bus, see @ref
+ * liblazy_dbus_set_connection_shards */
+#define LIBLAZY_CONNECTION_SHARED		0
+/** every thread uses its own private connections, see @ref
+ * liblazy_dbus_set_connection_shards */
+#define LIBLAZY_CONNECTION_PER_THREAD		-1
 
 /** @brief free a string
  *
@@ -52,15 +64,47 @@ extern "C" {
 void liblazy_free_string(char *string);
 
 /** @brief free a null terminated array of strings
+ *
+ * String lists returned by the library are a single allocation, so their
+ * strings must not be freed or replaced one by one; copy a list to change
+ * it. Lists whose strings were allocated one by one, like those built by
+ * older versions of the library, are freed string by string.
  *
  * @param strlist the string list to free
  */
 void liblazy_free_strlist(char **strlist);
 
+/** @brief a reply holding borrowed values
+ *
+ * The *_borrowed functions return strings that point directly into the
+ * reply they were received with instead of copying them. The reply is
+ * kept in a LiblazyReply, and the strings stay valid until it is passed
+ * to the next *_borrowed call or freed with @ref liblazy_reply_free. A
+ * reply can be reused for any number of calls without further
+ * allocations in the library.
+ */
+typedef struct _LiblazyReply LiblazyReply;
+
+/** @brief create a reply for borrowed values
+ *
+ * @return the new reply or NULL on failure. Has to be freed with
+ *	   @ref liblazy_reply_free
+ */
+LiblazyReply *liblazy_reply_new(void);
+
+/** @brief free a reply and all values borrowed from it
+ *
+ * @param reply the reply to free
+ */
+void liblazy_reply_free(LiblazyReply *reply);
+
 /** @brief send a method call to the system bus
  *
  * sends a method call to the system bus. The call blocks if a reply is
- * given. If the call shouldn't block, give NULL for the reply
+ * given. If the call shouldn't block, give NULL for the reply. The call
+ * is then marked as not expecting a reply and written out before this
+ * function returns, unless batching is enabled with
+ * @ref liblazy_dbus_set_outbound_batching
  *
  * @param destination the destination to send to
  * @param path the object path to send to
@@ -81,7 +125,10 @@ int liblazy_dbus_system_send_method_call(const char *destination, const char *pa
 /** @brief send a method call to the session bus
  *
  * sends a method call to the session bus. The call blocks if a reply is
- * given. If the call shouldn't block, give NULL for the reply
+ * given. If the call shouldn't block, give NULL for the reply. The call
+ * is then marked as not expecting a reply and written out before this
+ * function returns, unless batching is enabled with
+ * @ref liblazy_dbus_set_outbound_batching
  *
  * @param destination the destination to send to
  * @param path the object path to send to
@@ -100,10 +147,128 @@ int liblazy_dbus_session_send_method_call(const char *destination, const char *p
 					  DBusMessage **reply,
 					  int first_arg_type, ...);
 
+/** @brief a handle to cancel blocking calls from another thread
+ *
+ * Pass a cancellable to one of the *_with_timeout calls and call @ref
+ * liblazy_cancellable_cancel from another thread to make the blocking
+ * call return LIBLAZY_ERROR_DBUS_CANCELLED immediately. While waiting for
+ * the reply, the call dispatches incoming messages of the connection.
+ * That is always a connection of the library: without private or sharded
+ * connections, cancellable calls get one of their own instead of the
+ * shared connection, so no filter or object handler of the application
+ * runs inside them.
+ */
+typedef struct _LiblazyCancellable LiblazyCancellable;
+
+/** @brief create a new cancellable
+ *
+ * @return the new cancellable or NULL on failure. Has to be freed with
+ *	   @ref liblazy_cancellable_free
+ */
+LiblazyCancellable *liblazy_cancellable_new(void);
+
+/** @brief cancel all calls using the cancellable
+ *
+ * Calls using the cancellable fail with LIBLAZY_ERROR_DBUS_CANCELLED until
+ * it is reset with @ref liblazy_cancellable_reset. May be called from any
+ * thread.
+ *
+ * @param cancellable the cancellable to cancel
+ */
+void liblazy_cancellable_cancel(LiblazyCancellable *cancellable);
+
+/** @brief check if a cancellable was cancelled
+ *
+ * @param cancellable the cancellable to check
+ *
+ * @return 1 if it was cancelled, 0 otherwise
+ */
+int liblazy_cancellable_is_cancelled(LiblazyCancellable *cancellable);
+
+/** @brief make a cancelled cancellable usable again
+ *
+ * @param cancellable the cancellable to reset
+ */
+void liblazy_cancellable_reset(LiblazyCancellable *cancellable);
+
+/** @brief free a cancellable
+ *
+ * @param cancellable the cancellable to free
+ */
+void liblazy_cancellable_free(LiblazyCancellable *cancellable);
+
+/** @brief set the default timeout for blocking calls
+ *
+ * Sets the time blocking calls wait for a reply unless a different
+ * timeout is given. Calls that don't get a reply in time fail with
+ * LIBLAZY_ERROR_DBUS_TIMEOUT. Defaults to the timeout of libdbus, which is
+ * 25 seconds.
+ *
+ * @param timeout timeout in milliseconds or -1 for the libdbus default
+ */
+void liblazy_dbus_set_default_timeout(int timeout);
+
+/** @brief send a method call to the system bus with a timeout
+ *
+ * like @ref liblazy_dbus_system_send_method_call, but waits at most
+ * timeout milliseconds for the reply and can be cancelled.
+ *
+ * @param destination the destination to send to
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param method the method to send
+ * @param reply a DBusMessage to store the reply or NULL if the call
+ *              shouldn't block
+ * @param timeout timeout in milliseconds or -1 for the default set with
+ *		  @ref liblazy_dbus_set_default_timeout
+ * @param cancellable a cancellable to cancel the call with or NULL
+ * @param first_arg_type a DBUS_TYPE_* of the fist argument
+ * @param ... variable argument list finished with DBUS_TYPE_INVALID
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_system_send_method_call_with_timeout(const char *destination,
+						      const char *path,
+						      const char *interface,
+						      const char *method,
+						      DBusMessage **reply,
+						      int timeout,
+						      LiblazyCancellable *cancellable,
+						      int first_arg_type, ...);
+
+/** @brief send a method call to the session bus with a timeout
+ *
+ * like @ref liblazy_dbus_session_send_method_call, but waits at most
+ * timeout milliseconds for the reply and can be cancelled.
+ *
+ * @param destination the destination to send to
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param method the method to send
+ * @param reply a DBusMessage to store the reply or NULL if the call
+ *              shouldn't block
+ * @param timeout timeout in milliseconds or -1 for the default set with
+ *		  @ref liblazy_dbus_set_default_timeout
+ * @param cancellable a cancellable to cancel the call with or NULL
+ * @param first_arg_type a DBUS_TYPE_* of the fist argument
+ * @param ... variable argument list finished with DBUS_TYPE_INVALID
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_session_send_method_call_with_timeout(const char *destination,
+						       const char *path,
+						       const char *interface,
+						       const char *method,
+						       DBusMessage **reply,
+						       int timeout,
+						       LiblazyCancellable *cancellable,
+						       int first_arg_type, ...);
+
 /** @brief send a signal over the system bus
  *
- * sends a signal over the system bus. The call blocks if a reply is
- * given. If the call shouldn't block, give NULL for the reply
+ * sends a signal over the system bus. The signal is written out before
+ * this function returns, unless batching is enabled with
+ * @ref liblazy_dbus_set_outbound_batching
  *
  * @param path the object path to send to
  * @param interface the interface to send to
@@ -118,8 +283,9 @@ int liblazy_dbus_system_send_signal(const char *path, const char *interface,
 
 /** @brief send a signal over the session bus
  *
- * sends a signal over the session bus. The call blocks if a reply is
- * given. If the call shouldn't block, give NULL for the reply
+ * sends a signal over the session bus. The signal is written out before
+ * this function returns, unless batching is enabled with
+ * @ref liblazy_dbus_set_outbound_batching
  *
  * @param path the object path to send to
  * @param interface the interface to send to
@@ -132,135 +298,1406 @@ int liblazy_dbus_system_send_signal(const char *path, const char *interface,
 int liblazy_dbus_session_send_signal(const char *path, const char *interface,
 				     const char *name, int first_arg_type, ...);
 
-/** @brief get an argument from a DBusMessage
+/** @brief send a prepared message over the system bus
  *
- * @param message the DBusMessage to get the argument from
- * @param type the type of the argument
- * @param arg a location to store the argument
- * @param no a number specifying the n'th argument of the given type
+ * sends a message built by the caller, for arguments the variable
+ * argument list of @ref liblazy_dbus_system_send_method_call cannot
+ * express. Messages sent without waiting for a reply are subject to
+ * @ref liblazy_dbus_set_outbound_batching
+ *
+ * @param message the method call or signal to send, still owned by the
+ *		  caller
+ * @param reply the reply to the method call, which must be freed with
+ *		dbus_message_unref. NULL to not wait for a reply
+ * @param timeout the time to wait for the reply in milliseconds, -1 for
+ *		  the default timeout
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_dbus_message_get_basic_arg(DBusMessage *message, int type, void *arg, int no);
+int liblazy_dbus_system_send_message(DBusMessage *message, DBusMessage **reply,
+				     int timeout);
 
-/** @brief get a array argument from a DBusMessage as a string list
+/** @brief send a prepared message over the session bus
  *
- * @param message the message to get the argument from
- * @param strlist a pointer to a string array to store the result
- * @param strlist pointer to array of strings to store the result. Has to
- *		  be freed with @ref liblazy_free_strlist
- * @param no a number specifying the n'th string array in the reply
+ * sends a message built by the caller, for arguments the variable
+ * argument list of @ref liblazy_dbus_session_send_method_call cannot
+ * express. Messages sent without waiting for a reply are subject to
+ * @ref liblazy_dbus_set_outbound_batching
+ *
+ * @param message the method call or signal to send, still owned by the
+ *		  caller
+ * @param reply the reply to the method call, which must be freed with
+ *		dbus_message_unref. NULL to not wait for a reply
+ * @param timeout the time to wait for the reply in milliseconds, -1 for
+ *		  the default timeout
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_dbus_message_get_strlist_arg(DBusMessage *message, char ***strlist, int no);
+int liblazy_dbus_session_send_message(DBusMessage *message, DBusMessage **reply,
+				      int timeout);
 
-/** @brief use a private connection for system bus messages
+/** @brief connect to a peer without going through the bus daemon
  *
- * Call this function with a boolean value to tell the library whether to
- * use a private connection for system bus messages
- * (liblazy_dbus_system*). Defaults to false. If a private connection is
- * used, the libarary creates a new connection on _every_ call and
- * immediately closes it. So this should be used very carefully. Only use
- * if your application does very rare dbus calls and doesn't have a
- * mainloop to listen if D-Bus died but still should be able to survive
- * D-Bus restarts.
+ * Opens a private connection to a process listening on a D-Bus server
+ * address, e.g. "unix:path=/run/foo/socket". Messages sent with the
+ * liblazy_dbus_address_* functions go straight to that peer, skipping the
+ * routing and policy checks of the bus daemon. There are no bus names on
+ * such a connection, so calls have no destination.
  *
- * @param use_privat 1 if the library should use a private connection, 0
- *		     otherwise
+ * The connection is cached by address and shared by all threads. The
+ * liblazy_dbus_address_* functions connect on their first use as well,
+ * calling this beforehand only tells whether the peer is there. A lost
+ * connection is reopened by the next call.
+ *
+ * @param address the D-Bus address the peer listens on
+ *
+ * @return 0 on success, LIBLAZY_ERROR_DBUS_NOT_READY if the peer could not
+ *	   be reached, LIBLAZY_ERROR_* on other failures
  */
-void liblazy_dbus_system_use_private_connection(int use_private);
+int liblazy_dbus_connect_address(const char *address);
 
-/** @brief get integer property from HAL
+/** @brief close the connection to a peer
  *
- * fetches one interger value from HAL.
+ * closes the connection opened by @ref liblazy_dbus_connect_address or
+ * the first call to the address. Does nothing if there is none.
  *
- * @param udi the device to fetch the value from
- * @param property the property to fetch
- * @param value location to store the result
+ * @param address the D-Bus address the peer listens on
+ */
+void liblazy_dbus_disconnect_address(const char *address);
+
+/** @brief send a method call directly to a peer
+ *
+ * like @ref liblazy_dbus_system_send_method_call, but sends the call over
+ * the connection to the peer at address, see
+ * @ref liblazy_dbus_connect_address
+ *
+ * @param address the D-Bus address the peer listens on
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param method the method to send
+ * @param reply a DBusMessage to store the reply or NULL if the call
+ *              shouldn't block
+ * @param first_arg_type a DBUS_TYPE_* of the fist argument
+ * @param ... variable argument list finished with DBUS_TYPE_INVALID
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_hal_get_property_int(const char *udi, const char *property, int *value);
+int liblazy_dbus_address_send_method_call(const char *address, const char *path,
+					  const char *interface, const char *method,
+					  DBusMessage **reply,
+					  int first_arg_type, ...);
 
-/** @brief get boolean property from HAL
+/** @brief send a method call directly to a peer with a timeout
  *
- * fetches one boolean value from HAL.
+ * like @ref liblazy_dbus_address_send_method_call, but waits at most
+ * timeout milliseconds for the reply and can be cancelled.
  *
- * @param udi the device to fetch the value from
- * @param property the property to fetch
- * @param value location to store the result
+ * @param address the D-Bus address the peer listens on
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param method the method to send
+ * @param reply a DBusMessage to store the reply or NULL if the call
+ *              shouldn't block
+ * @param timeout timeout in milliseconds or -1 for the default set with
+ *		  @ref liblazy_dbus_set_default_timeout
+ * @param cancellable a cancellable to cancel the call with or NULL
+ * @param first_arg_type a DBUS_TYPE_* of the fist argument
+ * @param ... variable argument list finished with DBUS_TYPE_INVALID
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_hal_get_property_bool(const char *udi, const char *property, int *value);
+int liblazy_dbus_address_send_method_call_with_timeout(const char *address,
+						       const char *path,
+						       const char *interface,
+						       const char *method,
+						       DBusMessage **reply,
+						       int timeout,
+						       LiblazyCancellable *cancellable,
+						       int first_arg_type, ...);
 
-/** @brief get string property from HAL
+/** @brief send a signal directly to a peer
  *
- * fetches one string value from HAL.
+ * sends a signal over the connection to the peer at address. The signal
+ * is written out before this function returns, unless batching is enabled
+ * with @ref liblazy_dbus_set_outbound_batching
  *
- * @param udi the device to fetch the value from
- * @param property the property to fetch
- * @param value location to store the result
+ * @param address the D-Bus address the peer listens on
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param name the name of the signal
+ * @param first_arg_type a DBUS_TYPE_* of the fist argument
+ * @param ... variable argument list finished with DBUS_TYPE_INVALID
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_hal_get_property_string(const char *udi, const char *property, char **value);
+int liblazy_dbus_address_send_signal(const char *address, const char *path,
+				     const char *interface, const char *name,
+				     int first_arg_type, ...);
 
-/** @brief get string list property from HAL
+/** @brief send a prepared message directly to a peer
  *
- * fetches a string list value from HAL.
+ * like @ref liblazy_dbus_system_send_message, but sends the message over
+ * the connection to the peer at address.
  *
- * @param udi the device to fetch the value from
- * @param property the property to fetch
- * @param strlist pointer to array of strings to store the result. Has to
- *		  be freed with @ref liblazy_free_strlist
+ * @param address the D-Bus address the peer listens on
+ * @param message the method call or signal to send, still owned by the
+ *		  caller
+ * @param reply the reply to the method call, which must be freed with
+ *		dbus_message_unref. NULL to not wait for a reply
+ * @param timeout the time to wait for the reply in milliseconds, -1 for
+ *		  the default timeout
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_hal_get_property_strlist(const char *udi, const char *property, char ***strlist);
+int liblazy_dbus_address_send_message(const char *address, DBusMessage *message,
+				      DBusMessage **reply, int timeout);
 
-/** @brief check if a device has a capability
+/** @brief a method call prepared for repeated use
  *
- * @param udi the device to query on
- * @param capability the capability to query for
+ * For a call sent over and over with only its arguments changing. The
+ * names are validated once by @ref liblazy_call_prepare and the message
+ * header is built once, each call copies it and appends the arguments:
  *
- * @return 1 if the device possesses the capability, 0 if not and
- *         LIBLAZY_ERROR_* on failure
+ * @code
+ * LiblazyCall *call = liblazy_call_prepare(DBUS_BUS_SYSTEM, "org.foo",
+ *					     "/org/foo", "org.foo.Bar",
+ *					     "Get", "s");
+ * for (i = 0; i < count; i++)
+ *	liblazy_call_invoke(call, &reply, -1,
+ *			    DBUS_TYPE_STRING, &keys[i], DBUS_TYPE_INVALID);
+ * liblazy_call_free(call);
+ * @endcode
+ *
+ * Each call copies the prebuilt message with dbus_message_copy, the only
+ * way libdbus offers to reuse a header. This takes about a third of the
+ * CPU time of dbus_message_new_method_call and its name checks, but not
+ * fewer allocations: the copy makes a few more, as libdbus duplicates the
+ * header buffer and the empty body. It saves CPU, not malloc calls.
+ *
+ * A handle may be used by several threads at once.
  */
-int liblazy_hal_query_capability(const char *udi, const char *capability);
+typedef struct _LiblazyCall LiblazyCall;
 
-/** @brief find devices with a given capability
+/** @brief prepare a method call to a bus
  *
- * @param capability the capability the devices should have
- * @param strlist pointer to array of strings to store the result. Has to
- *		  be freed with @ref liblazy_free_strlist
+ * @param bus_type DBUS_BUS_SYSTEM or DBUS_BUS_SESSION
+ * @param destination the destination to send to
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param method the method to send
+ * @param signature the D-Bus signature the arguments must have, "" for
+ *		    no arguments or NULL to not check them
+ *
+ * @return the call or NULL if a name is invalid or on failure. Has to be
+ *	   freed with @ref liblazy_call_free
+ */
+LiblazyCall *liblazy_call_prepare(int bus_type, const char *destination,
+				  const char *path, const char *interface,
+				  const char *method, const char *signature);
+
+/** @brief prepare a method call to a peer
+ *
+ * like @ref liblazy_call_prepare, but the call is sent directly to the
+ * peer at address, see @ref liblazy_dbus_connect_address
+ *
+ * @param address the D-Bus address the peer listens on
+ * @param path the object path to send to
+ * @param interface the interface to send to
+ * @param method the method to send
+ * @param signature the D-Bus signature the arguments must have, "" for
+ *		    no arguments or NULL to not check them
+ *
+ * @return the call or NULL if a name is invalid or on failure. Has to be
+ *	   freed with @ref liblazy_call_free
+ */
+LiblazyCall *liblazy_call_prepare_address(const char *address, const char *path,
+					  const char *interface,
+					  const char *method,
+					  const char *signature);
+
+/** @brief send a prepared call
+ *
+ * @param call the prepared call
+ * @param reply a DBusMessage to store the reply or NULL if the call
+ *              shouldn't block
+ * @param timeout timeout in milliseconds or -1 for the default set with
+ *		  @ref liblazy_dbus_set_default_timeout
+ * @param first_arg_type a DBUS_TYPE_* of the fist argument
+ * @param ... variable argument list finished with DBUS_TYPE_INVALID
+ *
+ * @return 0 on success, LIBLAZY_ERROR_INVALID_ARGUMENT if the arguments
+ *	   don't match the signature, LIBLAZY_ERROR_* on other failures
+ */
+int liblazy_call_invoke(LiblazyCall *call, DBusMessage **reply, int timeout,
+			int first_arg_type, ...);
+
+/** @brief get a message of a prepared call to fill in
+ *
+ * for arguments the variable argument list of @ref liblazy_call_invoke
+ * cannot express. Append them with a DBusMessageIter and send the message
+ * with @ref liblazy_call_send
+ *
+ * @param call the prepared call
+ *
+ * @return the message without arguments or NULL on failure. Has to be
+ *	   freed with dbus_message_unref
+ */
+DBusMessage *liblazy_call_new_message(LiblazyCall *call);
+
+/** @brief send a message of a prepared call
+ *
+ * @param call the prepared call
+ * @param message a message returned by @ref liblazy_call_new_message,
+ *		  still owned by the caller
+ * @param reply the reply to the method call, which must be freed with
+ *		dbus_message_unref. NULL to not wait for a reply
+ * @param timeout the time to wait for the reply in milliseconds, -1 for
+ *		  the default timeout
+ *
+ * @return 0 on success, LIBLAZY_ERROR_INVALID_ARGUMENT if the arguments
+ *	   don't match the signature, LIBLAZY_ERROR_* on other failures
+ */
+int liblazy_call_send(LiblazyCall *call, DBusMessage *message,
+		      DBusMessage **reply, int timeout);
+
+/** @brief free a prepared call
+ *
+ * @param call the call to free
+ */
+void liblazy_call_free(LiblazyCall *call);
+
+/** @brief batch signals and calls without reply
+ *
+ * Without batching, every signal and every method call sent without a
+ * reply is written to the bus on its own before the sending function
+ * returns. With batching enabled, they are queued instead and written
+ * together by @ref liblazy_dbus_flush, when the queue is full, or when
+ * the process exits. A full queue is written by the thread adding to
+ * it, which blocks until everything is sent. Before the library closes
+ * one of its connections, e.g. when a thread exits or the connection
+ * setting changes, the queue is written as well.
+ *
+ * @param max_queued the number of messages to queue before writing them,
+ *		     0 to disable batching. Disabling batching writes the
+ *		     queued messages
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_hal_find_device_by_capability(const char *capability, char ***strlist);
+int liblazy_dbus_set_outbound_batching(int max_queued);
 
-/** @brief find devices with given key and value
+/** @brief write all queued messages
  *
- * @param key the key to match against
- * @param value the value to match against
+ * writes the signals and calls queued since batching was enabled with
+ * @ref liblazy_dbus_set_outbound_batching and waits until they are sent.
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_flush(void);
+
+/** @brief called for every signal matching a subscription
+ *
+ * @param message the signal, only valid during the call
+ * @param userdata the pointer given to @ref liblazy_dbus_subscribe
+ */
+typedef void (*LiblazySignalCallback)(DBusMessage *message, void *userdata);
+
+/** @brief receive signals without a mainloop
+ *
+ * Subscribes to the signals matching a D-Bus match rule. The signals are
+ * received by a thread of the library on its own connection to the bus.
+ * By default the callback is run from that thread, see
+ * @ref liblazy_dbus_get_signal_fd to run it from a thread of the
+ * application instead. The connection is reopened and the rules are
+ * added again if the bus goes away.
+ *
+ * Senders given as well known names are checked against the current owner
+ * of the name, which the library follows from the bus. Signals arriving
+ * before the owner is known are not delivered. With
+ * @ref liblazy_dbus_get_signal_fd, a signal is checked against the owner
+ * known when it is delivered, not when it was received.
+ *
+ * @param bus_type DBUS_BUS_SYSTEM or DBUS_BUS_SESSION
+ * @param match_rule the match rule, e.g. "type='signal',interface='x.y'"
+ * @param callback the function to call for each matching signal
+ * @param userdata passed to the callback
+ *
+ * @return the id of the subscription (> 0) on success, LIBLAZY_ERROR_* on
+ *	   failure
+ */
+int liblazy_dbus_subscribe(int bus_type, const char *match_rule,
+			   LiblazySignalCallback callback, void *userdata);
+
+/** @brief stop receiving signals for a subscription
+ *
+ * Waits for callbacks running in other threads to return, so the userdata
+ * of the subscription may be freed afterwards. May be called from within a
+ * callback.
+ *
+ * @param subscription the id returned by @ref liblazy_dbus_subscribe
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_unsubscribe(int subscription);
+
+/** @brief deliver signals from a thread of the application
+ *
+ * Once called, signals are queued instead of being passed to the
+ * callbacks from the thread of the library. The returned eventfd becomes
+ * readable whenever signals are queued. Call
+ * @ref liblazy_dbus_dispatch_signals then to run the callbacks. Signals
+ * queue up as long as nobody dispatches them.
+ *
+ * @return the file descriptor on success, LIBLAZY_ERROR_* on failure. It
+ *	   belongs to the library and must not be closed
+ */
+int liblazy_dbus_get_signal_fd(void);
+
+/** @brief run the callbacks for all queued signals
+ *
+ * @return the number of signals dispatched
+ */
+int liblazy_dbus_dispatch_signals(void);
+
+/** @brief called once an asynchronous method call finished
+ *
+ * @param reply the method return or error reply, only valid during the
+ *		call. NULL if no reply arrived
+ * @param error 0 for a method return, LIBLAZY_ERROR_DBUS_ERROR_IS_SET
+ *		for an error reply, or any other LIBLAZY_ERROR_* the call
+ *		failed with
+ * @param userdata the pointer given when sending the call
+ */
+typedef void (*LiblazyReplyCallback)(DBusMessage *reply, int error, void *userdata);
+
+/** @brief send a method call over the system bus without blocking
+ *
+ * The call is sent and its reply received by the thread that also
+ * receives the signals for @ref liblazy_dbus_subscribe, on its own
+ * connection. The callback is run from that thread, so it should hand
+ * the reply over to the application quickly instead of blocking. Any
+ * number of calls may be in flight at the same time.
+ *
+ * @param message the method call to send. The library keeps a reference
+ *		  until the call finished, it must not be changed meanwhile
+ * @param timeout the time to wait for the reply in milliseconds, -1 for
+ *		  the default timeout
+ * @param callback run exactly once when the call finished, unless this
+ *		   function fails
+ * @param userdata passed to the callback
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_system_send_message_async(DBusMessage *message, int timeout,
+					   LiblazyReplyCallback callback,
+					   void *userdata);
+
+/** @brief send a method call over the session bus without blocking
+ *
+ * like @ref liblazy_dbus_system_send_message_async, for the session bus
+ *
+ * @param message the method call to send. The library keeps a reference
+ *		  until the call finished, it must not be changed meanwhile
+ * @param timeout the time to wait for the reply in milliseconds, -1 for
+ *		  the default timeout
+ * @param callback run exactly once when the call finished, unless this
+ *		   function fails
+ * @param userdata passed to the callback
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_session_send_message_async(DBusMessage *message, int timeout,
+					    LiblazyReplyCallback callback,
+					    void *userdata);
+
+/** @brief get an argument from a DBusMessage
+ *
+ * @param message the DBusMessage to get the argument from
+ * @param type the type of the argument
+ * @param arg a location to store the argument
+ * @param no a number specifying the n'th argument of the given type
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_message_get_basic_arg(DBusMessage *message, int type, void *arg, int no);
+
+/** @brief get a array argument from a DBusMessage as a string list
+ *
+ * @param message the message to get the argument from
+ * @param strlist a pointer to a string array to store the result
  * @param strlist pointer to array of strings to store the result. Has to
  *		  be freed with @ref liblazy_free_strlist
+ * @param no a number specifying the n'th string array in the reply
  *
  * @return 0 on success, LIBLAZY_ERROR_* on failure
  */
-int liblazy_hal_find_device_by_string_match(const char *key, const char *value, char ***strlist);
+int liblazy_dbus_message_get_strlist_arg(DBusMessage *message, char ***strlist, int no);
 
-/** @brief check if a user possesses a privilege
+/** @brief get several arguments from a DBusMessage in one pass
  *
- * Check if the caller possesses the given privilege on the default device
- * '/org/freedesktop/Hal/devices/computer'
+ * reads the arguments of a message one after another as described by
+ * format. Each character of format consumes one location from the
+ * variable argument list:
  *
- * @param privilege the privilege to check for
+ * - a basic D-Bus type code ('y', 'b', 'n', 'q', 'i', 'u', 'x', 't',
+ *   'd', 's', 'o', 'g', 'h') stores the value at the location, which has
+ *   to point to the matching type. Strings are stored as const char * and
+ *   belong to the message
+ * - "as" stores a copy of a string array as a string list, which has to
+ *   be freed with @ref liblazy_free_strlist
  *
- * @return 1 if the caller is privileged, 0 if not, and LIBLAZY_ERROR_* on failure
- */
-int liblazy_hal_is_caller_privileged(const char *privilege);
+ * The following consume no location:
+ *
+ * - '(' and '{' enter a struct or a dict entry, ')' and '}' leave it
+ *   again, skipping any fields that were not read
+ * - 'v' enters a variant, the next complete type is read from inside it
+ * - '*' skips one argument of any type
+ *
+ * Other arrays can be walked with a @ref LiblazyDBusCursor.
+ *
+ * @param message the message to get the arguments from
+ * @param format the types of the arguments to read
+ * @param ... locations to store the arguments
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure. String lists copied
+ *	   before the failure are freed again
+ */
+int liblazy_dbus_message_get_args(DBusMessage *message, const char *format, ...);
+
+/** @brief a position in the arguments of a DBusMessage
+ *
+ * A cursor reads the arguments of a message front to back, including
+ * the contents of containers. It keeps a reference to the message, so
+ * strings read with it are valid until the cursor is freed or reset to
+ * another message.
+ */
+typedef struct _LiblazyDBusCursor LiblazyDBusCursor;
+
+/** @brief create a cursor
+ *
+ * @param message the message to read, may be NULL to set it later with
+ *		  @ref liblazy_dbus_cursor_reset
+ *
+ * @return the new cursor or NULL on failure. Has to be freed with
+ *	   @ref liblazy_dbus_cursor_free
+ */
+LiblazyDBusCursor *liblazy_dbus_cursor_new(DBusMessage *message);
+
+/** @brief move a cursor to the first argument of a message
+ *
+ * @param cursor the cursor to reset
+ * @param message the message to read from now on
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_cursor_reset(LiblazyDBusCursor *cursor, DBusMessage *message);
+
+/** @brief free a cursor
+ *
+ * @param cursor the cursor to free
+ */
+void liblazy_dbus_cursor_free(LiblazyDBusCursor *cursor);
+
+/** @brief get the type of the argument at the cursor
+ *
+ * @param cursor the cursor
+ *
+ * @return the DBUS_TYPE_* of the argument, DBUS_TYPE_INVALID at the end
+ *	   of the message or of the current container
+ */
+int liblazy_dbus_cursor_get_arg_type(LiblazyDBusCursor *cursor);
+
+/** @brief read arguments at the cursor
+ *
+ * reads arguments like @ref liblazy_dbus_message_get_args, starting at
+ * the cursor, and moves the cursor behind them. If an argument doesn't
+ * match the format, the cursor stays where it was, so it can be read
+ * again with a different format.
+ *
+ * @param cursor the cursor to read from
+ * @param format the types of the arguments to read
+ * @param ... locations to store the arguments
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_cursor_get_args(LiblazyDBusCursor *cursor, const char *format, ...);
+
+/** @brief step into the container at the cursor
+ *
+ * moves the cursor to the first element of the array, struct, dict
+ * entry or variant at the cursor.
+ *
+ * @param cursor the cursor
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_cursor_enter(LiblazyDBusCursor *cursor);
+
+/** @brief step out of the current container
+ *
+ * moves the cursor behind the container entered last, skipping any
+ * elements that were not read.
+ *
+ * @param cursor the cursor
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_cursor_leave(LiblazyDBusCursor *cursor);
+
+/** @brief use a private connection for system bus messages
+ *
+ * Call this function with a boolean value to tell the library whether to
+ * use a private connection for system bus messages
+ * (liblazy_dbus_system*). Defaults to false. The private connection is
+ * opened on the first call and kept open for the following ones. If
+ * D-Bus went away in between, for example because it was restarted, the
+ * library notices this on the next call and transparently connects and
+ * registers again. Use this if your application doesn't have a mainloop
+ * to listen if D-Bus died but still should be able to survive D-Bus
+ * restarts. Disabling it closes the private connection.
+ *
+ * @param use_privat 1 if the library should use a private connection, 0
+ *		     otherwise
+ */
+void liblazy_dbus_system_use_private_connection(int use_private);
+
+/** @brief spread calls of several threads over several connections
+ *
+ * All functions of the library may be called from several threads at
+ * once. By default they share one connection per bus, so libdbus handles
+ * their calls one after another. Call this function to give each thread
+ * its own private connections (LIBLAZY_CONNECTION_PER_THREAD), or to
+ * spread the threads over a given number of private connections per bus,
+ * so blocking calls of different threads are processed in parallel. The
+ * connections are opened on first use and reopened if D-Bus went away.
+ * Should be called before the first call is made. Changing it later
+ * closes the shared connections of the previous setting right away, while
+ * the connections of a thread are closed by its next call or when it
+ * exits. The setting applies to the whole process.
+ *
+ * @param shards the number of connections per bus,
+ *		 LIBLAZY_CONNECTION_PER_THREAD or LIBLAZY_CONNECTION_SHARED
+ *		 (default)
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_dbus_set_connection_shards(int shards);
+
+/** @brief set how long a missing HAL property is remembered
+ *
+ * If HAL reports that a property does not exist, the library remembers
+ * this for the given time and answers further requests for the same
+ * property on the same device with LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY
+ * without asking HAL again. Defaults to 1000 milliseconds.
+ *
+ * @param msec time in milliseconds, 0 disables the cache
+ */
+void liblazy_hal_set_missing_property_timeout(int msec);
+
+/** @brief write a snapshot of all HAL devices to a file
+ *
+ * fetches all devices and their properties from HAL and stores them in a
+ * read-only binary file, which can be used with
+ * @ref liblazy_hal_use_snapshot by later processes. The file is replaced
+ * atomically, so processes using an older snapshot are not disturbed.
+ *
+ * @param path the file to write
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_write_snapshot(const char *path);
+
+/** @brief read HAL properties from a snapshot
+ *
+ * maps a file written by @ref liblazy_hal_write_snapshot. As long as it
+ * is used, the liblazy_hal_get_property_* and liblazy_hal_find_device_*
+ * functions answer from the snapshot without talking to HAL, except for
+ * devices that are not part of it. Changes made after the snapshot was
+ * taken are not seen, so it is meant for mostly static data and short
+ * lived processes.
+ *
+ * @param path the snapshot to use or NULL to stop using one
+ * @param max_age the age in seconds up to which the snapshot is used, 0
+ *		  to use it regardless of its age
+ *
+ * @return 0 on success, LIBLAZY_ERROR_HAL_SNAPSHOT_STALE if the snapshot
+ *	   is older than max_age, LIBLAZY_ERROR_HAL_SNAPSHOT_INVALID if it
+ *	   does not exist or can't be read and LIBLAZY_ERROR_* on other
+ *	   failures. The snapshot used before is kept on failure
+ */
+int liblazy_hal_use_snapshot(const char *path, int max_age);
+
+/** @brief set how long liblazy_hal_query_capability remembers capabilities
+ *
+ * @ref liblazy_hal_query_capability fetches all capabilities of a device
+ * at once and answers further queries for it from memory until the
+ * timeout expires. While the property cache is enabled, they are also
+ * forgotten as soon as HAL reports a change of the device.
+ *
+ * @param msec the timeout in milliseconds, 1000 by default. 0 disables
+ *	       remembering capabilities
+ */
+void liblazy_hal_set_capability_timeout(int msec);
+
+/** @brief serve HAL properties from a local cache
+ *
+ * Call this function with a boolean value to tell the library whether to
+ * cache HAL properties. Defaults to false. If enabled, the first property
+ * read of a device fetches all its properties at once and later reads
+ * are answered without asking HAL again. The library listens for HAL's
+ * PropertyModified and DeviceRemoved signals on a private system bus
+ * connection and drops the affected devices from the cache, so values
+ * are never older than the last signal HAL sent. Pending signals are
+ * processed on every read, no mainloop is needed.
+ *
+ * @param use_cache 1 if the library should cache HAL properties, 0
+ *		    otherwise
+ */
+void liblazy_hal_use_property_cache(int use_cache);
+
+/** @brief drop all cached HAL properties
+ *
+ * Drops everything cached by @ref liblazy_hal_use_property_cache and all
+ * capabilities remembered by @ref liblazy_hal_query_capability, so the
+ * next read of each device asks HAL again.
+ */
+void liblazy_hal_flush_property_cache(void);
+
+/** @brief get integer property from HAL
+ *
+ * fetches one interger value from HAL.
+ *
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_property_int(const char *udi, const char *property, int *value);
+
+/** @brief get boolean property from HAL
+ *
+ * fetches one boolean value from HAL.
+ *
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_property_bool(const char *udi, const char *property, int *value);
+
+/** @brief get string property from HAL
+ *
+ * fetches one string value from HAL.
+ *
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_property_string(const char *udi, const char *property, char **value);
+
+/** @brief get string list property from HAL
+ *
+ * fetches a string list value from HAL.
+ *
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ * @param strlist pointer to array of strings to store the result. Has to
+ *		  be freed with @ref liblazy_free_strlist
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_property_strlist(const char *udi, const char *property, char ***strlist);
+
+/** @brief get string property from HAL without copying it
+ *
+ * like @ref liblazy_hal_get_property_string, but the string is borrowed
+ * from reply.
+ *
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ * @param reply the reply to keep the value in. Values previously
+ *		borrowed from it become invalid
+ * @param value location to store the result, valid as long as reply
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_property_string_borrowed(const char *udi, const char *property,
+					     LiblazyReply *reply, const char **value);
+
+/** @brief get string list property from HAL without copying it
+ *
+ * like @ref liblazy_hal_get_property_strlist, but the strings are
+ * borrowed from reply.
+ *
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ * @param reply the reply to keep the value in. Values previously
+ *		borrowed from it become invalid
+ * @param strlist location to store the NULL terminated array of strings,
+ *		  valid as long as reply
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_property_strlist_borrowed(const char *udi, const char *property,
+					      LiblazyReply *reply, const char ***strlist);
+
+/** @brief all properties of a HAL device
+ *
+ * A read-only table of all properties of one device, fetched with one
+ * call by @ref liblazy_hal_get_all_properties. Lookups by key are done
+ * with a binary search. Strings returned by the
+ * liblazy_hal_properties_get_* functions belong to the table and are
+ * valid until it is freed with @ref liblazy_hal_free_properties.
+ */
+typedef struct _LiblazyHalProperties LiblazyHalProperties;
+
+/** @brief get all properties of a device from HAL
+ *
+ * fetches all properties of a device with a single call to HAL.
+ *
+ * @param udi the device to fetch the properties from
+ * @param properties location to store the property table. Has to be
+ *		     freed with @ref liblazy_hal_free_properties
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_get_all_properties(const char *udi, LiblazyHalProperties **properties);
+
+/** @brief free a property table
+ *
+ * @param properties the property table to free
+ */
+void liblazy_hal_free_properties(LiblazyHalProperties *properties);
+
+/** @brief get the number of properties in a property table
+ *
+ * @param properties the property table
+ *
+ * @return the number of properties, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_count(const LiblazyHalProperties *properties);
+
+/** @brief get the key of the n'th property of a property table
+ *
+ * Properties are sorted by key.
+ *
+ * @param properties the property table
+ * @param index a number between 0 and @ref liblazy_hal_properties_count - 1
+ *
+ * @return the key or NULL if index is out of range
+ */
+const char *liblazy_hal_properties_get_key(const LiblazyHalProperties *properties,
+					   int index);
+
+/** @brief get the type of a property in a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ *
+ * @return the DBUS_TYPE_* of the property, DBUS_TYPE_ARRAY for string
+ *	   lists, or LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_type(const LiblazyHalProperties *properties,
+				    const char *key);
+
+/** @brief get an integer property from a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_int(const LiblazyHalProperties *properties,
+				   const char *key, int *value);
+
+/** @brief get an unsigned 64 bit integer property from a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_uint64(const LiblazyHalProperties *properties,
+				      const char *key, dbus_uint64_t *value);
+
+/** @brief get a double property from a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_double(const LiblazyHalProperties *properties,
+				      const char *key, double *value);
+
+/** @brief get a boolean property from a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_bool(const LiblazyHalProperties *properties,
+				    const char *key, int *value);
+
+/** @brief get a string property from a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ * @param value location to store the result. Belongs to the table and
+ *		must not be freed
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_string(const LiblazyHalProperties *properties,
+				      const char *key, const char **value);
+
+/** @brief get a string list property from a property table
+ *
+ * @param properties the property table
+ * @param key the property to look up
+ * @param strlist location to store the NULL terminated result. Belongs to
+ *		  the table and must not be freed
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_properties_get_strlist(const LiblazyHalProperties *properties,
+				       const char *key, const char ***strlist);
+
+/** @brief check if a device has a capability
+ *
+ * @param udi the device to query on
+ * @param capability the capability to query for
+ *
+ * @return 1 if the device possesses the capability, 0 if not and
+ *         LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_query_capability(const char *udi, const char *capability);
+
+/** @brief find devices with a given capability
+ *
+ * @param capability the capability the devices should have
+ * @param strlist pointer to array of strings to store the result. Has to
+ *		  be freed with @ref liblazy_free_strlist
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_find_device_by_capability(const char *capability, char ***strlist);
+
+/** @brief find devices with given key and value
+ *
+ * @param key the key to match against
+ * @param value the value to match against
+ * @param strlist pointer to array of strings to store the result. Has to
+ *		  be freed with @ref liblazy_free_strlist
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_find_device_by_string_match(const char *key, const char *value, char ***strlist);
+
+/** @brief find devices with a given capability without copying them
+ *
+ * like @ref liblazy_hal_find_device_by_capability, but the device names
+ * are borrowed from reply.
+ *
+ * @param capability the capability the devices should have
+ * @param reply the reply to keep the result in
+ * @param strlist location to store the NULL terminated array of strings,
+ *		  valid as long as reply
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_find_device_by_capability_borrowed(const char *capability,
+						   LiblazyReply *reply,
+						   const char ***strlist);
+
+/** @brief find devices with given key and value without copying them
+ *
+ * like @ref liblazy_hal_find_device_by_string_match, but the device
+ * names are borrowed from reply.
+ *
+ * @param key the key to match against
+ * @param value the value to match against
+ * @param reply the reply to keep the result in
+ * @param strlist location to store the NULL terminated array of strings,
+ *		  valid as long as reply
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_find_device_by_string_match_borrowed(const char *key,
+						     const char *value,
+						     LiblazyReply *reply,
+						     const char ***strlist);
+
+/** @brief check if a user possesses a privilege
+ *
+ * Check if the caller possesses the given privilege on the default device
+ * '/org/freedesktop/Hal/devices/computer'
+ *
+ * @param privilege the privilege to check for
+ *
+ * @return 1 if the caller is privileged, 0 if not, and LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_is_caller_privileged(const char *privilege);
+
+/** @brief check several privileges at once
+ *
+ * like @ref liblazy_hal_is_caller_privileged, but all privileges that
+ * are not cached are sent to HAL back to back and the replies are
+ * collected afterwards, so the whole list costs one round trip.
+ *
+ * @param privileges NULL terminated array of the privileges to check
+ * @param results array with one entry per privilege, set to 1 if the
+ *		  caller is privileged, 0 if not and LIBLAZY_ERROR_* if the
+ *		  check failed
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* if no check could be done
+ */
+int liblazy_hal_check_caller_privileges(const char **privileges, int *results);
+
+/** @brief remember privilege decisions for some time
+ *
+ * If enabled, @ref liblazy_hal_is_caller_privileged and
+ * @ref liblazy_hal_check_caller_privileges remember HAL's answer for
+ * each privilege and connection until the timeout expires. All decisions
+ * are forgotten as soon as HAL restarts, PolicyKit reports a changed
+ * configuration or ConsoleKit reports a change of the active session.
+ * The library listens for these signals on a private system bus
+ * connection. Defaults to 0.
+ *
+ * @param msec the timeout in milliseconds, 0 disables caching
+ */
+void liblazy_hal_set_privilege_cache_timeout(int msec);
+
+/** @brief forget all cached privilege decisions
+ */
+void liblazy_hal_flush_privilege_cache(void);
+
+/** @brief a set of HAL property requests sent in one go
+ *
+ * Reading many properties one after another costs one round trip to HAL
+ * for each of them. A batch queues all requests and sends them back to
+ * back on one connection, so reading N properties costs about one round
+ * trip. Create it with @ref liblazy_hal_batch_new, add requests with
+ * liblazy_hal_batch_add_*, send them with @ref liblazy_hal_batch_execute
+ * and fetch the results with liblazy_hal_batch_get_*. A batch may be
+ * executed again to refresh all results.
+ */
+typedef struct _LiblazyHalBatch LiblazyHalBatch;
+
+/** @brief create a new, empty batch of HAL property requests
+ *
+ * @return the new batch or NULL on failure. Has to be freed with @ref
+ *	   liblazy_hal_batch_free
+ */
+LiblazyHalBatch *liblazy_hal_batch_new(void);
+
+/** @brief free a batch and all its results
+ *
+ * @param batch the batch to free
+ */
+void liblazy_hal_batch_free(LiblazyHalBatch *batch);
+
+/** @brief add an integer property request to a batch
+ *
+ * @param batch the batch to add the request to
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ *
+ * @return the index of the request to fetch its result with, or
+ *	   LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_add_int(LiblazyHalBatch *batch, const char *udi,
+			      const char *property);
+
+/** @brief add a boolean property request to a batch
+ *
+ * @param batch the batch to add the request to
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ *
+ * @return the index of the request to fetch its result with, or
+ *	   LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_add_bool(LiblazyHalBatch *batch, const char *udi,
+			       const char *property);
+
+/** @brief add a string property request to a batch
+ *
+ * @param batch the batch to add the request to
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ *
+ * @return the index of the request to fetch its result with, or
+ *	   LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_add_string(LiblazyHalBatch *batch, const char *udi,
+				 const char *property);
+
+/** @brief add a string list property request to a batch
+ *
+ * @param batch the batch to add the request to
+ * @param udi the device to fetch the value from
+ * @param property the property to fetch
+ *
+ * @return the index of the request to fetch its result with, or
+ *	   LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_add_strlist(LiblazyHalBatch *batch, const char *udi,
+				  const char *property);
+
+/** @brief send all requests of a batch and collect the replies
+ *
+ * All requests are sent before waiting for the first reply. The call
+ * blocks until every request got its reply. Failures of single requests
+ * are reported by the liblazy_hal_batch_get_* functions.
+ *
+ * @param batch the batch to execute
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* if the batch could not be sent
+ */
+int liblazy_hal_batch_execute(LiblazyHalBatch *batch);
+
+/** @brief get the result of an integer request of an executed batch
+ *
+ * @param batch the executed batch
+ * @param index the index returned by @ref liblazy_hal_batch_add_int
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_get_int(LiblazyHalBatch *batch, int index, int *value);
+
+/** @brief get the result of a boolean request of an executed batch
+ *
+ * @param batch the executed batch
+ * @param index the index returned by @ref liblazy_hal_batch_add_bool
+ * @param value location to store the result
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_get_bool(LiblazyHalBatch *batch, int index, int *value);
+
+/** @brief get the result of a string request of an executed batch
+ *
+ * @param batch the executed batch
+ * @param index the index returned by @ref liblazy_hal_batch_add_string
+ * @param value location to store the result. Has to be freed with @ref
+ *		liblazy_free_string
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_get_string(LiblazyHalBatch *batch, int index, char **value);
+
+/** @brief get the result of a string list request of an executed batch
+ *
+ * @param batch the executed batch
+ * @param index the index returned by @ref liblazy_hal_batch_add_strlist
+ * @param strlist pointer to array of strings to store the result. Has to
+ *		  be freed with @ref liblazy_free_strlist
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_batch_get_strlist(LiblazyHalBatch *batch, int index,
+				  char ***strlist);
+
+/** a device has to match every predicate of the query */
+#define LIBLAZY_HAL_QUERY_ALL			0
+/** a device has to match at least one predicate of the query */
+#define LIBLAZY_HAL_QUERY_ANY			1
+
+/** no lower bound for @ref liblazy_hal_query_add_range */
+#define LIBLAZY_HAL_QUERY_NO_MIN		(-DBUS_INT64_CONSTANT(0x7fffffffffffffff) - 1)
+/** no upper bound for @ref liblazy_hal_query_add_range */
+#define LIBLAZY_HAL_QUERY_NO_MAX		DBUS_INT64_CONSTANT(0x7fffffffffffffff)
+
+/** @brief find devices matching several predicates at once
+ *
+ * Capability and string predicates are answered by HAL, all of them
+ * sent back to back in one round trip, or by the device snapshot if one
+ * is in use. The devices left are checked against the range predicates,
+ * reading each property like @ref liblazy_hal_get_property_int does: from
+ * the snapshot, then from the property cache, and what both miss with one
+ * more round of batched property reads. For
+ * "mounted storage volumes larger than X":
+ * @code
+ * query = liblazy_hal_query_new(LIBLAZY_HAL_QUERY_ALL);
+ * liblazy_hal_query_add_capability(query, "volume");
+ * liblazy_hal_query_add_bool(query, "volume.is_mounted", 1);
+ * liblazy_hal_query_add_range(query, "volume.size", X + 1,
+ *			       LIBLAZY_HAL_QUERY_NO_MAX);
+ * liblazy_hal_query_execute(query, &udis);
+ * @endcode
+ * A query may be executed again to get the current result.
+ */
+typedef struct _LiblazyHalQuery LiblazyHalQuery;
+
+/** @brief create a new query without predicates
+ *
+ * A query for all predicates without any predicates finds all devices,
+ * one for any of them finds none.
+ *
+ * @param match LIBLAZY_HAL_QUERY_ALL or LIBLAZY_HAL_QUERY_ANY
+ *
+ * @return the new query or NULL on failure. Has to be freed with @ref
+ *	   liblazy_hal_query_free
+ */
+LiblazyHalQuery *liblazy_hal_query_new(int match);
+
+/** @brief free a query
+ *
+ * @param query the query to free
+ */
+void liblazy_hal_query_free(LiblazyHalQuery *query);
+
+/** @brief match devices having a capability
+ *
+ * @param query the query to add the predicate to
+ * @param capability the capability the devices should have
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_query_add_capability(LiblazyHalQuery *query, const char *capability);
+
+/** @brief match devices having a string property set to a value
+ *
+ * @param query the query to add the predicate to
+ * @param key the string property to compare
+ * @param value the value the property should have
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_query_add_string(LiblazyHalQuery *query, const char *key,
+				 const char *value);
+
+/** @brief match devices having a numeric property within a range
+ *
+ * Integer, boolean and double properties are compared, booleans as 0
+ * and 1. Devices without the property or with a property of another
+ * type don't match.
+ *
+ * @param query the query to add the predicate to
+ * @param key the property to compare
+ * @param min the smallest value to match or LIBLAZY_HAL_QUERY_NO_MIN
+ * @param max the largest value to match or LIBLAZY_HAL_QUERY_NO_MAX
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_query_add_range(LiblazyHalQuery *query, const char *key,
+				dbus_int64_t min, dbus_int64_t max);
+
+/** @brief match devices having a boolean property set to a value
+ *
+ * @param query the query to add the predicate to
+ * @param key the boolean property to compare
+ * @param value the value the property should have, 0 or 1
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_query_add_bool(LiblazyHalQuery *query, const char *key, int value);
+
+/** @brief find the devices matching a query
+ *
+ * A device lacking a property of a range predicate, or gone while the
+ * query runs, just doesn't match. Any other error reading the properties
+ * fails the whole query.
+ *
+ * @param query the query to execute
+ * @param udis pointer to the sorted array of the devices found. Has to
+ *	       be freed with @ref liblazy_free_strlist
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+int liblazy_hal_query_execute(LiblazyHalQuery *query, char ***udis);
+
+/** a failure the library could not handle */
+#define LIBLAZY_LOG_ERROR			1
+#define LIBLAZY_LOG_WARNING			2
+#define LIBLAZY_LOG_INFO			3
+#define LIBLAZY_LOG_DEBUG			4
+
+/** @brief receives the messages logged by the library
+ *
+ * @param level one of LIBLAZY_LOG_*
+ * @param function the function of the library logging the message
+ * @param line the line in the source of the library
+ * @param message the message without a trailing newline
+ * @param suppressed the number of messages from the same place dropped by
+ *		     the rate limit since the last one passed on
+ * @param userdata the pointer given to @ref liblazy_log_set_sink
+ */
+typedef void (*LiblazyLogSink)(int level, const char *function, int line,
+			       const char *message, unsigned long suppressed,
+			       void *userdata);
+
+/** @brief set where the library logs to
+ *
+ * Defaults to @ref liblazy_log_stderr, or to no sink at all if the library
+ * was configured with --disable-stderr-log. Without a sink nothing is
+ * formatted. The sink and its userdata are changed together. Sinks
+ * already running in other threads still use the old userdata, which has
+ * to stay valid until they returned.
+ *
+ * @param sink the function to pass messages to, NULL to log nothing
+ * @param userdata passed to the sink
+ */
+void liblazy_log_set_sink(LiblazyLogSink sink, void *userdata);
+
+/** @brief the sink writing to stderr, see @ref liblazy_log_set_sink */
+void liblazy_log_stderr(int level, const char *function, int line,
+			const char *message, unsigned long suppressed,
+			void *userdata);
+
+/** @brief set the least important level to log
+ *
+ * @param level one of LIBLAZY_LOG_*, defaults to LIBLAZY_LOG_ERROR
+ */
+void liblazy_log_set_level(int level);
+
+/** @brief limit how often the same place in the library logs
+ *
+ * Each place logging a message passes at most burst messages per interval
+ * on to the sink. Dropped messages are counted and reported with the next
+ * message passed on from the same place.
+ *
+ * @param burst the number of messages per interval, defaults to 10. 0
+ *		disables the limit
+ * @param interval the interval in milliseconds, defaults to 1000
+ */
+void liblazy_log_set_rate_limit(int burst, int interval);
+
+/** a call or signal was handed to the bus */
+#define LIBLAZY_TRACE_CALL_START		1
+/** the reply to a call was received */
+#define LIBLAZY_TRACE_REPLY			2
+/** the arguments of a reply were decoded */
+#define LIBLAZY_TRACE_DECODED			3
+/** a call failed */
+#define LIBLAZY_TRACE_ERROR			4
+
+/** @brief called for every traced event
+ *
+ * @param event one of LIBLAZY_TRACE_*
+ * @param destination the destination of the call, NULL for
+ *		      LIBLAZY_TRACE_DECODED and signals
+ * @param path the object path, NULL for LIBLAZY_TRACE_DECODED
+ * @param method the method or signal name, NULL for LIBLAZY_TRACE_DECODED
+ * @param serial the serial of the call, which the reply carries as well
+ * @param error the LIBLAZY_ERROR_* for LIBLAZY_TRACE_ERROR and failed
+ *		decoding, 0 otherwise
+ * @param userdata the pointer given to @ref liblazy_trace_set_callback
+ */
+typedef void (*LiblazyTraceCallback)(int event, const char *destination,
+				     const char *path, const char *method,
+				     dbus_uint32_t serial, int error,
+				     void *userdata);
+
+/** @brief trace every bus operation
+ *
+ * The callback is called from the thread doing the call whenever a call
+ * or signal is handed to the bus, when its reply or an error arrives, and
+ * when a reply was decoded. Calls answered from caches are not traced.
+ *
+ * If the library was built with USDT support (configure --enable-usdt),
+ * the same events fire the static probes liblazy:call-start,
+ * liblazy:reply-received, liblazy:error (destination, path, method,
+ * serial, error) and liblazy:decode-done (serial, error) for perf,
+ * bpftrace or systemtap, whether a callback is set or not. The probes
+ * have semaphores, so events are only prepared while a tracer is attached
+ * or a callback is set.
+ *
+ * The callback and its userdata are changed together. Callbacks already
+ * running in other threads still use the old userdata, which has to stay
+ * valid until they returned.
+ *
+ * @param callback the function to call for every event, NULL to stop
+ *		   tracing
+ * @param userdata passed to the callback
+ */
+void liblazy_trace_set_callback(LiblazyTraceCallback callback, void *userdata);
+
+/** number of latency buckets of @ref LiblazyStatsMethod */
+#define LIBLAZY_STATS_BUCKETS			24
+/** size of the errors array of @ref LiblazyStats */
+#define LIBLAZY_STATS_ERROR_CODES		32
+
+/** counters for one D-Bus method or signal name */
+typedef struct _LiblazyStatsMethod {
+	/** the method or signal name */
+	char		*name;
+	unsigned long	calls;
+	/** calls failed with any LIBLAZY_ERROR_* */
+	unsigned long	errors;
+	unsigned long	bytes_sent;
+	unsigned long	bytes_received;
+	/** latency[0] counts calls taking less than a microsecond,
+	 * latency[i] those taking 2^(i-1) up to 2^i microseconds. The last
+	 * bucket counts everything slower */
+	unsigned long	latency[LIBLAZY_STATS_BUCKETS];
+} LiblazyStatsMethod;
+
+/** counters of all threads, see @ref liblazy_stats_snapshot */
+typedef struct _LiblazyStats {
+	/** method calls, with and without reply */
+	unsigned long		calls;
+	unsigned long		signals;
+	/** times a caller waited for replies */
+	unsigned long		round_trips;
+	unsigned long		bytes_sent;
+	unsigned long		bytes_received;
+	/** errors[-code] counts the calls failed with LIBLAZY_ERROR_* code */
+	unsigned long		errors[LIBLAZY_STATS_ERROR_CODES];
+	int			method_count;
+	LiblazyStatsMethod	*methods;
+} LiblazyStats;
+
+/** count calls, round trips, errors and latencies */
+#define LIBLAZY_STATS_COUNT			1
+/** count the bytes on the wire as well, see @ref liblazy_stats_enable */
+#define LIBLAZY_STATS_BYTES			2
+
+/** @brief count calls and signals sent by the library
+ *
+ * Every thread counts its calls, round trips, errors and latencies on its
+ * own, so threads do not contend while counting. That costs two clock
+ * readings, a lock nobody else takes and a short search for the method
+ * per call.
+ *
+ * Counting bytes is much more expensive: libdbus only tells the size of a
+ * message by marshalling a copy of it, so each call and its reply are
+ * allocated and copied once more. bytes_sent and bytes_received stay zero
+ * unless LIBLAZY_STATS_BYTES is given. Calls answered from a cache or
+ * snapshot do not reach the bus and are not counted.
+ *
+ * @param enable LIBLAZY_STATS_COUNT, optionally or-ed with
+ *		 LIBLAZY_STATS_BYTES, or 0 to stop counting
+ */
+void liblazy_stats_enable(int enable);
+
+/** @brief get the counters summed over all threads
+ *
+ * Counters of threads which exited are included.
+ *
+ * @return the counters, which have to be freed with @ref
+ *	   liblazy_stats_free, NULL on failure
+ */
+LiblazyStats *liblazy_stats_snapshot(void);
+
+/** @brief free counters returned by @ref liblazy_stats_snapshot
+ *
+ * @param stats the counters to free
+ */
+void liblazy_stats_free(LiblazyStats *stats);
+
+/** @brief set all counters to zero */
+void liblazy_stats_reset(void);
 
 #ifdef __cplusplus
 }
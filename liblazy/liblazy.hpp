@@ -0,0 +1,954 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *           Copyright (C) 2006 Holger Macht <holger@homac.de>             *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef LIBLAZY_HPP
+#define LIBLAZY_HPP
+
+#if __cplusplus < 201703L
+#error "liblazy.hpp requires C++17"
+#endif
+
+#include "liblazy.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <atomic>
+#include <coroutine>
+#include <mutex>
+#include <new>
+#define LIBLAZY_HAVE_COROUTINES 1
+#endif
+
+/** @defgroup liblazy_cpp Liblazy C++ - typed wrapper around the C API
+ *
+ * A header only layer over liblazy.h. The D-Bus signature of a call is
+ * derived from the C++ types of its arguments and results at compile
+ * time, so no type codes are passed around and a mismatch between the
+ * expected and the received reply is caught by comparing one signature
+ * string. Everything the library returns is owned by a move-only handle
+ * which frees it, and errors are the LIBLAZY_ERROR_* codes of the C API
+ * carried in a @ref liblazy::Result, no exceptions are thrown.
+ *
+ * C++ type				D-Bus type
+ * bool					b
+ * std::uint8_t				y
+ * std::int16_t, std::uint16_t		n, q
+ * std::int32_t, std::uint32_t		i, u
+ * std::int64_t, std::uint64_t		x, t
+ * double				d
+ * const char *, std::string		s
+ * std::string_view			s, only for results
+ * liblazy::ObjectPath			o
+ * std::vector<T>			a followed by the type of T
+ *
+ * Strings returned as const char *, std::string_view or ObjectPath point
+ * into the reply and are valid as long as the @ref liblazy::Reply.
+ * @{ */
+
+namespace liblazy {
+
+/** @brief the bus to talk to */
+enum class Bus {
+	System	= DBUS_BUS_SYSTEM,
+	Session	= DBUS_BUS_SESSION
+};
+
+/** @brief a D-Bus object path, as opposed to a plain string */
+struct ObjectPath {
+	const char *path = nullptr;
+};
+
+/** @brief the destination of a method call */
+struct Method {
+	const char	*destination;
+	const char	*path;
+	const char	*interface;
+	const char	*name;
+	/** milliseconds to wait for the reply, -1 for the default */
+	int		timeout = -1;
+};
+
+/** @brief a LIBLAZY_ERROR_* code to construct a failed @ref Result from */
+struct Error {
+	int code;
+};
+
+/** @brief the value of a call or the LIBLAZY_ERROR_* code it failed with
+ *
+ * The value must only be accessed if the result converts to true.
+ */
+template <typename T>
+class [[nodiscard]] Result {
+public:
+	Result(T &&value) : value_(std::move(value)) {}
+	Result(const T &value) : value_(value) {}
+	Result(Error error) : error_(error.code) { assert(error.code != 0); }
+
+	explicit operator bool() const noexcept { return error_ == 0; }
+	/** @return 0 on success, LIBLAZY_ERROR_* on failure */
+	int error() const noexcept { return error_; }
+
+	T &value() & { assert(error_ == 0); return *value_; }
+	const T &value() const & { assert(error_ == 0); return *value_; }
+	T &&value() && { assert(error_ == 0); return std::move(*value_); }
+
+	T &operator*() & { return value(); }
+	const T &operator*() const & { return value(); }
+	T *operator->() { return &value(); }
+	const T *operator->() const { return &value(); }
+
+private:
+	std::optional<T>	value_;
+	int			error_ = 0;
+};
+
+/** @brief owns a reference to a DBusMessage */
+class Message {
+public:
+	Message() noexcept = default;
+	/** takes over the reference held by the caller */
+	explicit Message(DBusMessage *message) noexcept : message_(message) {}
+	Message(Message &&other) noexcept : message_(other.release()) {}
+	Message &operator=(Message &&other) noexcept
+	{
+		reset(other.release());
+		return *this;
+	}
+	Message(const Message &) = delete;
+	Message &operator=(const Message &) = delete;
+	~Message() { reset(); }
+
+	DBusMessage *get() const noexcept { return message_; }
+	explicit operator bool() const noexcept { return message_ != nullptr; }
+
+	/** hands the reference back to the caller */
+	DBusMessage *release() noexcept
+	{
+		DBusMessage *message = message_;
+
+		message_ = nullptr;
+		return message;
+	}
+
+	void reset(DBusMessage *message = nullptr) noexcept
+	{
+		DBusMessage *old = message_;
+
+		message_ = message;
+		if (old != nullptr)
+			dbus_message_unref(old);
+	}
+
+private:
+	DBusMessage *message_ = nullptr;
+};
+
+/** @brief owns a string returned by the library */
+class String {
+public:
+	String() noexcept = default;
+	explicit String(char *string) noexcept : string_(string) {}
+	String(String &&other) noexcept : string_(other.release()) {}
+	String &operator=(String &&other) noexcept
+	{
+		reset(other.release());
+		return *this;
+	}
+	String(const String &) = delete;
+	String &operator=(const String &) = delete;
+	~String() { reset(); }
+
+	const char *c_str() const noexcept { return string_; }
+	std::string_view view() const noexcept
+	{
+		return string_ != nullptr ? std::string_view(string_) : std::string_view();
+	}
+	operator std::string_view() const noexcept { return view(); }
+
+	char *release() noexcept
+	{
+		char *string = string_;
+
+		string_ = nullptr;
+		return string;
+	}
+
+	void reset(char *string = nullptr) noexcept
+	{
+		char *old = string_;
+
+		string_ = string;
+		if (old != nullptr)
+			liblazy_free_string(old);
+	}
+
+private:
+	char *string_ = nullptr;
+};
+
+/** @brief owns a NULL terminated string list returned by the library */
+class StringList {
+public:
+	using iterator = const char *const *;
+
+	StringList() noexcept = default;
+	explicit StringList(char **strlist) noexcept : strlist_(strlist)
+	{
+		while (strlist_ != nullptr && strlist_[size_] != nullptr)
+			size_++;
+	}
+	StringList(StringList &&other) noexcept : strlist_(other.strlist_), size_(other.size_)
+	{
+		other.strlist_ = nullptr;
+		other.size_ = 0;
+	}
+	StringList &operator=(StringList &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			std::swap(strlist_, other.strlist_);
+			std::swap(size_, other.size_);
+		}
+		return *this;
+	}
+	StringList(const StringList &) = delete;
+	StringList &operator=(const StringList &) = delete;
+	~StringList() { reset(); }
+
+	std::size_t size() const noexcept { return size_; }
+	bool empty() const noexcept { return size_ == 0; }
+	const char *operator[](std::size_t index) const { return strlist_[index]; }
+	iterator begin() const noexcept { return strlist_; }
+	iterator end() const noexcept { return strlist_ + size_; }
+	char **get() const noexcept { return strlist_; }
+
+	char **release() noexcept
+	{
+		char **strlist = strlist_;
+
+		strlist_ = nullptr;
+		size_ = 0;
+		return strlist;
+	}
+
+	void reset() noexcept
+	{
+		if (strlist_ != nullptr)
+			liblazy_free_strlist(strlist_);
+		strlist_ = nullptr;
+		size_ = 0;
+	}
+
+private:
+	char		**strlist_ = nullptr;
+	std::size_t	size_ = 0;
+};
+
+namespace detail {
+
+template <typename T>
+inline constexpr bool always_false = false;
+
+/* a signature as a pack of characters, joined at compile time */
+template <char... C>
+struct chars {
+	static constexpr char value[] = { C..., '\0' };
+};
+
+template <typename... S>
+struct join {
+	using type = chars<>;
+};
+
+template <char... A>
+struct join<chars<A...>> {
+	using type = chars<A...>;
+};
+
+template <char... A, char... B, typename... Rest>
+struct join<chars<A...>, chars<B...>, Rest...> : join<chars<A..., B...>, Rest...> {};
+
+/* string literals arrive as arrays and char * as mutable */
+template <typename T>
+using plain = std::conditional_t<std::is_same_v<std::decay_t<T>, char *>,
+				 const char *, std::remove_cv_t<std::decay_t<T>>>;
+
+template <typename T>
+struct dbus_type {
+	static_assert(always_false<T>, "type has no D-Bus equivalent");
+};
+
+template <typename T, int Code, char C, typename Wire = T>
+struct basic_type {
+	using signature = chars<C>;
+	static constexpr int code = Code;
+	/* arrays of it can be copied as one block */
+	static constexpr bool fixed = sizeof(T) == sizeof(Wire) && !std::is_same_v<T, bool>;
+
+	static bool append(DBusMessageIter *iter, const T &value)
+	{
+		Wire wire = value;
+
+		return dbus_message_iter_append_basic(iter, Code, &wire);
+	}
+
+	static void read(DBusMessageIter *iter, T &value)
+	{
+		Wire wire;
+
+		dbus_message_iter_get_basic(iter, &wire);
+		value = static_cast<T>(wire);
+	}
+};
+
+template <> struct dbus_type<bool> : basic_type<bool, DBUS_TYPE_BOOLEAN, 'b', dbus_bool_t> {};
+template <> struct dbus_type<std::uint8_t> : basic_type<std::uint8_t, DBUS_TYPE_BYTE, 'y'> {};
+template <> struct dbus_type<std::int16_t> : basic_type<std::int16_t, DBUS_TYPE_INT16, 'n', dbus_int16_t> {};
+template <> struct dbus_type<std::uint16_t> : basic_type<std::uint16_t, DBUS_TYPE_UINT16, 'q', dbus_uint16_t> {};
+template <> struct dbus_type<std::int32_t> : basic_type<std::int32_t, DBUS_TYPE_INT32, 'i', dbus_int32_t> {};
+template <> struct dbus_type<std::uint32_t> : basic_type<std::uint32_t, DBUS_TYPE_UINT32, 'u', dbus_uint32_t> {};
+template <> struct dbus_type<std::int64_t> : basic_type<std::int64_t, DBUS_TYPE_INT64, 'x', dbus_int64_t> {};
+template <> struct dbus_type<std::uint64_t> : basic_type<std::uint64_t, DBUS_TYPE_UINT64, 't', dbus_uint64_t> {};
+template <> struct dbus_type<double> : basic_type<double, DBUS_TYPE_DOUBLE, 'd'> {};
+
+template <int Code, char C>
+struct string_type {
+	using signature = chars<C>;
+	static constexpr int code = Code;
+	static constexpr bool fixed = false;
+
+	static bool append_string(DBusMessageIter *iter, const char *value)
+	{
+		/* libdbus aborts on NULL strings */
+		if (value == nullptr)
+			value = "";
+		return dbus_message_iter_append_basic(iter, Code, &value);
+	}
+
+	static const char *read_string(DBusMessageIter *iter)
+	{
+		const char *value;
+
+		dbus_message_iter_get_basic(iter, &value);
+		return value;
+	}
+};
+
+template <>
+struct dbus_type<const char *> : string_type<DBUS_TYPE_STRING, 's'> {
+	static bool append(DBusMessageIter *iter, const char *value)
+	{
+		return append_string(iter, value);
+	}
+
+	static void read(DBusMessageIter *iter, const char *&value)
+	{
+		value = read_string(iter);
+	}
+};
+
+template <>
+struct dbus_type<std::string> : string_type<DBUS_TYPE_STRING, 's'> {
+	static bool append(DBusMessageIter *iter, const std::string &value)
+	{
+		return append_string(iter, value.c_str());
+	}
+
+	static void read(DBusMessageIter *iter, std::string &value)
+	{
+		value = read_string(iter);
+	}
+};
+
+/* not NUL terminated, so it can only be received */
+template <>
+struct dbus_type<std::string_view> : string_type<DBUS_TYPE_STRING, 's'> {
+	static void read(DBusMessageIter *iter, std::string_view &value)
+	{
+		value = read_string(iter);
+	}
+};
+
+template <>
+struct dbus_type<ObjectPath> : string_type<DBUS_TYPE_OBJECT_PATH, 'o'> {
+	static bool append(DBusMessageIter *iter, const ObjectPath &value)
+	{
+		return append_string(iter, value.path != nullptr ? value.path : "/");
+	}
+
+	static void read(DBusMessageIter *iter, ObjectPath &value)
+	{
+		value.path = read_string(iter);
+	}
+};
+
+template <typename T>
+struct dbus_type<std::vector<T>> {
+	using element = dbus_type<T>;
+	using signature = typename join<chars<'a'>, typename element::signature>::type;
+	static constexpr int code = DBUS_TYPE_ARRAY;
+	static constexpr bool fixed = false;
+
+	static bool append(DBusMessageIter *iter, const std::vector<T> &value)
+	{
+		DBusMessageIter array;
+
+		if (!dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+						      element::signature::value, &array))
+			return false;
+
+		if constexpr (element::fixed) {
+			const T *data = value.data();
+
+			if (!dbus_message_iter_append_fixed_array(&array, element::code, &data,
+								  static_cast<int>(value.size())))
+				goto Error;
+		} else {
+			for (const T &item : value)
+				if (!element::append(&array, item))
+					goto Error;
+		}
+		return dbus_message_iter_close_container(iter, &array);
+
+	Error:
+		dbus_message_iter_abandon_container(iter, &array);
+		return false;
+	}
+
+	static void read(DBusMessageIter *iter, std::vector<T> &value)
+	{
+		DBusMessageIter array;
+
+		dbus_message_iter_recurse(iter, &array);
+		value.clear();
+
+		if constexpr (element::fixed) {
+			const T	*data;
+			int	count;
+
+			dbus_message_iter_get_fixed_array(&array, &data, &count);
+			value.assign(data, data + count);
+		} else {
+			while (dbus_message_iter_get_arg_type(&array) != DBUS_TYPE_INVALID) {
+				value.emplace_back();
+				element::read(&array, value.back());
+				dbus_message_iter_next(&array);
+			}
+		}
+	}
+};
+
+template <typename... T>
+bool append_args(DBusMessage *message, const T &... args)
+{
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(message, &iter);
+	return (dbus_type<plain<T>>::append(&iter, args) && ...);
+}
+
+template <typename... T, std::size_t... I>
+void read_args(DBusMessageIter *iter, std::tuple<T...> &values,
+	       std::index_sequence<I...>)
+{
+	((dbus_type<T>::read(iter, std::get<I>(values)), dbus_message_iter_next(iter)), ...);
+}
+
+inline int send(Bus bus, DBusMessage *message, DBusMessage **reply, int timeout)
+{
+	if (bus == Bus::Session)
+		return liblazy_dbus_session_send_message(message, reply, timeout);
+	return liblazy_dbus_system_send_message(message, reply, timeout);
+}
+
+} /* namespace detail */
+
+/** @brief the D-Bus signature of a list of C++ types, built at compile time */
+template <typename... T>
+constexpr const char *signature() noexcept
+{
+	return detail::join<typename detail::dbus_type<detail::plain<T>>::signature...>::type::value;
+}
+
+/** @brief a method return together with its decoded arguments
+ *
+ * Owns the reply, so borrowed strings among the values stay valid as
+ * long as it lives, wherever it is moved to.
+ */
+template <typename... Out>
+class Reply {
+public:
+	Reply(Message message, std::tuple<Out...> values)
+		: message_(std::move(message)), values_(std::move(values)) {}
+
+	template <std::size_t I>
+	const auto &get() const noexcept { return std::get<I>(values_); }
+
+	/** the only argument of the reply */
+	const auto &value() const noexcept
+	{
+		static_assert(sizeof...(Out) == 1, "value() needs a reply with one argument");
+		return std::get<0>(values_);
+	}
+
+	const std::tuple<Out...> &values() const noexcept { return values_; }
+	DBusMessage *message() const noexcept { return message_.get(); }
+
+private:
+	Message			message_;
+	std::tuple<Out...>	values_;
+};
+
+namespace detail {
+
+/* checks the signature of the reply and decodes its arguments */
+template <typename... Out>
+Result<Reply<Out...>> decode(Message reply)
+{
+	DBusMessageIter		iter;
+	std::tuple<Out...>	values;
+
+	if constexpr (sizeof...(Out) > 0) {
+		if (!dbus_message_has_signature(reply.get(), signature<Out...>()))
+			return Error{ LIBLAZY_ERROR_GENERAL };
+		dbus_message_iter_init(reply.get(), &iter);
+		read_args(&iter, values, std::index_sequence_for<Out...>());
+	}
+	return Reply<Out...>(std::move(reply), std::move(values));
+}
+
+} /* namespace detail */
+
+/** @brief call a method and decode its reply
+ *
+ * the result types are given explicitly, the argument types are deduced:
+ * @code
+ * auto r = liblazy::call<bool>(liblazy::Bus::System, method, "info.product");
+ * if (r && r->value())
+ *	...
+ * @endcode
+ *
+ * @param bus the bus to send the call over
+ * @param method where to send the call to
+ * @param args the arguments of the call
+ *
+ * @return the reply on success, LIBLAZY_ERROR_GENERAL if the reply does
+ *	   not have the signature of Out, or any other LIBLAZY_ERROR_* the
+ *	   call failed with
+ */
+template <typename... Out, typename... In>
+Result<Reply<Out...>> call(Bus bus, const Method &method, const In &... args)
+{
+	Message			message(dbus_message_new_method_call(method.destination,
+								     method.path,
+								     method.interface,
+								     method.name));
+	DBusMessage		*reply;
+	int			ret;
+
+	if (!message || !detail::append_args(message.get(), args...))
+		return Error{ LIBLAZY_ERROR_GENERAL };
+
+	ret = detail::send(bus, message.get(), &reply, method.timeout);
+	if (ret != 0)
+		return Error{ ret };
+	return detail::decode<Out...>(Message(reply));
+}
+
+/** @brief call a method without waiting for a reply
+ *
+ * subject to @ref liblazy_dbus_set_outbound_batching like the C API
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+template <typename... In>
+int call_no_reply(Bus bus, const Method &method, const In &... args)
+{
+	Message message(dbus_message_new_method_call(method.destination, method.path,
+						     method.interface, method.name));
+
+	if (!message || !detail::append_args(message.get(), args...))
+		return LIBLAZY_ERROR_GENERAL;
+	return detail::send(bus, message.get(), nullptr, -1);
+}
+
+/** @brief send a signal
+ *
+ * subject to @ref liblazy_dbus_set_outbound_batching like the C API
+ *
+ * @return 0 on success, LIBLAZY_ERROR_* on failure
+ */
+template <typename... In>
+int emit(Bus bus, const char *path, const char *interface, const char *name,
+	 const In &... args)
+{
+	Message message(dbus_message_new_signal(path, interface, name));
+
+	if (!message || !detail::append_args(message.get(), args...))
+		return LIBLAZY_ERROR_GENERAL;
+	return detail::send(bus, message.get(), nullptr, -1);
+}
+
+namespace hal {
+
+/** @brief get a property of a device
+ *
+ * T is one of int, bool, @ref String or @ref StringList and selects the
+ * liblazy_hal_get_property_* function used, so the property cache and
+ * snapshots apply as in the C API.
+ */
+template <typename T>
+Result<T> get_property(const char *udi, const char *property)
+{
+	int ret;
+
+	if constexpr (std::is_same_v<T, int> || std::is_same_v<T, bool>) {
+		int value;
+
+		if constexpr (std::is_same_v<T, int>)
+			ret = liblazy_hal_get_property_int(udi, property, &value);
+		else
+			ret = liblazy_hal_get_property_bool(udi, property, &value);
+		if (ret != 0)
+			return Error{ ret };
+		return static_cast<T>(value);
+	} else if constexpr (std::is_same_v<T, String>) {
+		char *value;
+
+		ret = liblazy_hal_get_property_string(udi, property, &value);
+		if (ret != 0)
+			return Error{ ret };
+		return String(value);
+	} else if constexpr (std::is_same_v<T, StringList>) {
+		char **value;
+
+		ret = liblazy_hal_get_property_strlist(udi, property, &value);
+		if (ret != 0)
+			return Error{ ret };
+		return StringList(value);
+	} else {
+		static_assert(detail::always_false<T>, "HAL properties are int, bool, String or StringList");
+	}
+}
+
+/** @brief check if a device has a capability */
+inline Result<bool> query_capability(const char *udi, const char *capability)
+{
+	int ret = liblazy_hal_query_capability(udi, capability);
+
+	if (ret < 0)
+		return Error{ ret };
+	return ret == 1;
+}
+
+/** @brief find devices with a given capability */
+inline Result<StringList> find_device_by_capability(const char *capability)
+{
+	char	**devices;
+	int	ret;
+
+	ret = liblazy_hal_find_device_by_capability(capability, &devices);
+	if (ret != 0)
+		return Error{ ret };
+	return StringList(devices);
+}
+
+/** @brief find devices with given key and value */
+inline Result<StringList> find_device_by_string_match(const char *key, const char *value)
+{
+	char	**devices;
+	int	ret;
+
+	ret = liblazy_hal_find_device_by_string_match(key, value, &devices);
+	if (ret != 0)
+		return Error{ ret };
+	return StringList(devices);
+}
+
+/** @brief check if the caller possesses a privilege */
+inline Result<bool> is_caller_privileged(const char *privilege)
+{
+	int ret = liblazy_hal_is_caller_privileged(privilege);
+
+	if (ret < 0)
+		return Error{ ret };
+	return ret == 1;
+}
+
+} /* namespace hal */
+
+#ifdef LIBLAZY_HAVE_COROUTINES
+
+/** @brief resumes a coroutine on the thread that received the reply
+ *
+ * That is the single thread of the library, so a coroutine resumed by it
+ * must not block, or no other reply or signal is handled meanwhile. It
+ * has to be asked for explicitly. Executors of the application are plain
+ * callables taking the std::coroutine_handle<> to resume.
+ */
+struct InlineExecutor {
+	void operator()(std::coroutine_handle<> handle) const { handle.resume(); }
+};
+
+namespace detail {
+
+/* what a call in flight shares with its awaiter. The awaiter is destroyed
+ * with its coroutine, which may happen before the reply arrives, so each
+ * of them holds a reference */
+template <typename Executor>
+struct CallState {
+	explicit CallState(Executor executor) : executor(std::move(executor)) {}
+
+	void unref()
+	{
+		if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	std::atomic<int>	refs{ 2 };
+	/* protects handle against the awaiter going away */
+	std::mutex		lock;
+	Executor		executor;
+	/* null once the awaiter is gone or the coroutine was handed on */
+	std::coroutine_handle<>	handle;
+	Message			reply;
+	int			error = 0;
+};
+
+} /* namespace detail */
+
+/** @brief awaits a method call sent with @ref liblazy_dbus_system_send_message_async
+ *
+ * co_await yields a Result<Reply<Out...>> like @ref call. The awaiting
+ * coroutine is resumed through the executor once the reply arrived. If
+ * the coroutine is destroyed before, the reply is dropped.
+ */
+template <typename Executor, typename... Out>
+class [[nodiscard]] CallAwaiter {
+	using State = detail::CallState<Executor>;
+
+public:
+	CallAwaiter(Executor executor, Bus bus, Message message, int timeout, int error)
+		: executor_(std::move(executor)), bus_(bus), message_(std::move(message)),
+		  timeout_(timeout), error_(error) {}
+	CallAwaiter(CallAwaiter &&other)
+		: executor_(std::move(other.executor_)), bus_(other.bus_),
+		  message_(std::move(other.message_)),
+		  state_(std::exchange(other.state_, nullptr)),
+		  timeout_(other.timeout_), error_(other.error_) {}
+	CallAwaiter(const CallAwaiter &) = delete;
+	CallAwaiter &operator=(const CallAwaiter &) = delete;
+
+	~CallAwaiter()
+	{
+		if (state_ == nullptr)
+			return;
+		/* a reply arriving later must not resume the coroutine */
+		{
+			std::lock_guard<std::mutex> guard(state_->lock);
+			state_->handle = nullptr;
+		}
+		state_->unref();
+	}
+
+	bool await_ready() const noexcept { return error_ != 0; }
+
+	bool await_suspend(std::coroutine_handle<> handle) noexcept
+	{
+		int ret;
+
+		state_ = new (std::nothrow) State(std::move(executor_));
+		if (state_ == nullptr) {
+			error_ = LIBLAZY_ERROR_GENERAL;
+			return false;
+		}
+		state_->handle = handle;
+
+		if (bus_ == Bus::Session)
+			ret = liblazy_dbus_session_send_message_async(message_.get(), timeout_,
+								      completed, state_);
+		else
+			ret = liblazy_dbus_system_send_message_async(message_.get(), timeout_,
+								     completed, state_);
+		if (ret != 0) {
+			/* the call never holds its reference */
+			state_->handle = nullptr;
+			state_->unref();
+			error_ = ret;
+			return false;
+		}
+		return true;
+	}
+
+	Result<Reply<Out...>> await_resume()
+	{
+		if (error_ != 0)
+			return Error{ error_ };
+		if (state_->error != 0)
+			return Error{ state_->error };
+		return detail::decode<Out...>(std::move(state_->reply));
+	}
+
+protected:
+	/* the error reply, if the call failed with one */
+	const char *error_name() const noexcept
+	{
+		return state_ != nullptr && state_->reply ?
+			dbus_message_get_error_name(state_->reply.get()) : nullptr;
+	}
+
+private:
+	static void completed(DBusMessage *reply, int error, void *userdata)
+	{
+		State			*state = static_cast<State *>(userdata);
+		std::coroutine_handle<>	handle;
+
+		{
+			std::lock_guard<std::mutex> guard(state->lock);
+			handle = std::exchange(state->handle, nullptr);
+			state->error = error;
+			if (reply != nullptr)
+				state->reply.reset(dbus_message_ref(reply));
+		}
+
+		/* resuming may destroy the awaiter, the state stays until
+		 * the reference of the call is dropped */
+		if (handle)
+			state->executor(handle);
+		state->unref();
+	}
+
+	Executor		executor_;
+	Bus			bus_;
+	Message			message_;
+	State			*state_ = nullptr;
+	int			timeout_;
+	int			error_;
+};
+
+/** @brief call a method from a coroutine
+ *
+ * like @ref call, but without blocking the thread:
+ * @code
+ * auto r = co_await liblazy::async_call<bool>(executor, liblazy::Bus::System,
+ *					       method, "info.product");
+ * @endcode
+ * The coroutine is resumed by passing its handle to executor, which
+ * usually posts it to the executor the coroutine was running on. Pass
+ * @ref InlineExecutor to resume it on the thread of the library.
+ */
+template <typename... Out, typename Executor, typename... In>
+CallAwaiter<Executor, Out...> async_call(Executor executor, Bus bus,
+					 const Method &method, const In &... args)
+{
+	Message message(dbus_message_new_method_call(method.destination, method.path,
+						     method.interface, method.name));
+	int	error = 0;
+
+	if (!message || !detail::append_args(message.get(), args...))
+		error = LIBLAZY_ERROR_GENERAL;
+	return CallAwaiter<Executor, Out...>(std::move(executor), bus, std::move(message),
+					     method.timeout, error);
+}
+
+namespace detail {
+
+/* the HAL method returning a property of type T */
+template <typename T>
+struct hal_property_method {
+	static_assert(always_false<T>,
+		      "HAL properties are int, bool, std::string or std::vector<std::string>");
+};
+
+template <> struct hal_property_method<int> { static constexpr const char *name = "GetPropertyInteger"; };
+template <> struct hal_property_method<bool> { static constexpr const char *name = "GetPropertyBoolean"; };
+template <> struct hal_property_method<std::string> { static constexpr const char *name = "GetPropertyString"; };
+template <> struct hal_property_method<std::vector<std::string>> { static constexpr const char *name = "GetPropertyStringList"; };
+
+} /* namespace detail */
+
+namespace hal {
+
+/** @brief awaits a HAL property, yielding a Result<T> */
+template <typename T, typename Executor>
+class [[nodiscard]] PropertyAwaiter : public CallAwaiter<Executor, T> {
+public:
+	using CallAwaiter<Executor, T>::CallAwaiter;
+
+	Result<T> await_resume()
+	{
+		Result<Reply<T>>	reply = CallAwaiter<Executor, T>::await_resume();
+		const char		*name = this->error_name();
+
+		if (reply)
+			return T(std::move(reply).value().value());
+		/* the same codes the C getters return */
+		if (name != nullptr && std::string_view(name) == "org.freedesktop.Hal.NoSuchProperty")
+			return Error{ LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY };
+		if (name != nullptr && std::string_view(name) == "org.freedesktop.Hal.TypeMismatch")
+			return Error{ LIBLAZY_ERROR_HAL_TYPE_MISMATCH };
+		return Error{ reply.error() };
+	}
+};
+
+/** @brief get a property of a device from a coroutine
+ *
+ * T is one of int, bool, std::string or std::vector<std::string>. Unlike
+ * @ref get_property, the property is always asked from HAL.
+ */
+template <typename T, typename Executor>
+PropertyAwaiter<T, Executor> async_get(Executor executor, const char *udi,
+				       const char *property)
+{
+	Message message(dbus_message_new_method_call("org.freedesktop.Hal", udi,
+						     "org.freedesktop.Hal.Device",
+						     detail::hal_property_method<T>::name));
+	int	error = 0;
+
+	if (!message || !detail::append_args(message.get(), property))
+		error = LIBLAZY_ERROR_GENERAL;
+	return PropertyAwaiter<T, Executor>(std::move(executor), Bus::System,
+					    std::move(message), -1, error);
+}
+
+} /* namespace hal */
+
+#endif /* LIBLAZY_HAVE_COROUTINES */
+
+} /* namespace liblazy */
+
+/** @} */
+
+#endif /* LIBLAZY_HPP */
@@ -0,0 +1,272 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+struct _LiblazyCall {
+	int		bus_type;
+	/* NULL unless the call goes to a peer instead of a bus */
+	char		*address;
+	/* never sent, copied for each call so the header is only built once */
+	DBusMessage	*message;
+	/* NULL if the arguments are not checked */
+	char		*signature;
+};
+
+#ifndef HAVE_DBUS_VALIDATE_PATH
+/* returns 1 if name is made of elements of [A-Za-z0-9_], and '-' with
+ * dash set, split by separator. The first character of an element may
+ * only be a digit with digit_first set */
+static int liblazy_call_valid_name(const char *name, char separator,
+				   int min_elements, int digit_first, int dash)
+{
+	const char	*c;
+	int		elements	= 1;
+	int		start		= 1;
+
+	for (c = name; *c != '\0'; c++) {
+		if (*c == separator) {
+			if (start)
+				return 0;
+			elements++;
+			start = 1;
+			continue;
+		}
+		if (!((*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z') ||
+		      *c == '_' || (dash && *c == '-') ||
+		      (*c >= '0' && *c <= '9' && (digit_first || !start))))
+			return 0;
+		start = 0;
+	}
+	return !start && elements >= min_elements;
+}
+
+/* the checks of dbus_validate_*, for libdbus versions without them,
+ * which abort in dbus_message_new_method_call on invalid names instead
+ * of failing */
+static int liblazy_call_validate_names(const char *destination,
+				       const char *path, const char *interface,
+				       const char *method, DBusError *dbus_error)
+{
+	const char *what = NULL;
+
+	if (destination != NULL &&
+	    (strlen(destination) > DBUS_MAXIMUM_NAME_LENGTH ||
+	     (destination[0] == ':' ?
+	      !liblazy_call_valid_name(destination + 1, '.', 1, 1, 1) :
+	      !liblazy_call_valid_name(destination, '.', 2, 0, 1))))
+		what = "bus name";
+	else if (path[0] != '/' ||
+		 (path[1] != '\0' && !liblazy_call_valid_name(path + 1, '/', 1, 1, 0)))
+		what = "object path";
+	else if (interface != NULL &&
+		 (strlen(interface) > DBUS_MAXIMUM_NAME_LENGTH ||
+		  !liblazy_call_valid_name(interface, '.', 2, 0, 0)))
+		what = "interface";
+	else if (strlen(method) > DBUS_MAXIMUM_NAME_LENGTH ||
+		 !liblazy_call_valid_name(method, '\0', 1, 0, 0))
+		what = "member";
+
+	if (what == NULL)
+		return 1;
+	dbus_set_error(dbus_error, DBUS_ERROR_INVALID_ARGS, "Invalid %s", what);
+	return 0;
+}
+#endif
+
+/* checks the names once, so libdbus doesn't complain about them on every
+ * call, and doesn't abort on invalid ones */
+static int liblazy_call_validate(const char *destination, const char *path,
+				 const char *interface, const char *method,
+				 const char *signature)
+{
+	DBusError	dbus_error;
+	int		ret		= 0;
+
+	dbus_error_init(&dbus_error);
+
+#ifdef HAVE_DBUS_VALIDATE_PATH
+	if ((destination != NULL &&
+	     !dbus_validate_bus_name(destination, &dbus_error)) ||
+	    !dbus_validate_path(path, &dbus_error) ||
+	    (interface != NULL &&
+	     !dbus_validate_interface(interface, &dbus_error)) ||
+	    !dbus_validate_member(method, &dbus_error))
+		ret = LIBLAZY_ERROR_INVALID_ARGUMENT;
+#else
+	if (!liblazy_call_validate_names(destination, path, interface, method,
+					 &dbus_error))
+		ret = LIBLAZY_ERROR_INVALID_ARGUMENT;
+#endif
+
+	if (ret == 0 && signature != NULL &&
+	    !dbus_signature_validate(signature, &dbus_error))
+		ret = LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (ret != 0)
+		ERROR("Could not prepare call %s: %s", method, dbus_error.message);
+
+	dbus_error_free(&dbus_error);
+	return ret;
+}
+
+static LiblazyCall *liblazy_call_new(int bus_type, const char *address,
+				     const char *destination, const char *path,
+				     const char *interface, const char *method,
+				     const char *signature)
+{
+	LiblazyCall *call;
+
+	if (path == NULL || method == NULL)
+		return NULL;
+
+	if (liblazy_call_validate(destination, path, interface, method,
+				  signature) != 0)
+		return NULL;
+
+	call = calloc(1, sizeof(LiblazyCall));
+	if (call == NULL)
+		goto Error;
+
+	call->bus_type = bus_type;
+	if (address != NULL && (call->address = strdup(address)) == NULL)
+		goto Error;
+	if (signature != NULL && (call->signature = strdup(signature)) == NULL)
+		goto Error;
+
+	call->message = dbus_message_new_method_call(destination, path,
+						      interface, method);
+	if (call->message == NULL)
+		goto Error;
+
+	return call;
+
+Error:
+	ERROR("Could not prepare call %s: OOM or invalid name", method);
+	liblazy_call_free(call);
+	return NULL;
+}
+
+LiblazyCall *liblazy_call_prepare(int bus_type, const char *destination,
+				  const char *path, const char *interface,
+				  const char *method, const char *signature)
+{
+	if (bus_type != DBUS_BUS_SYSTEM && bus_type != DBUS_BUS_SESSION)
+		return NULL;
+
+	return liblazy_call_new(bus_type, NULL, destination, path, interface,
+				method, signature);
+}
+
+LiblazyCall *liblazy_call_prepare_address(const char *address, const char *path,
+					  const char *interface,
+					  const char *method,
+					  const char *signature)
+{
+	if (address == NULL)
+		return NULL;
+
+	return liblazy_call_new(0, address, NULL, path, interface, method,
+				signature);
+}
+
+DBusMessage *liblazy_call_new_message(LiblazyCall *call)
+{
+	DBusMessage *message;
+
+	if (call == NULL)
+		return NULL;
+
+	/* only reads the template, so calls may share the handle */
+	message = dbus_message_copy(call->message);
+	if (message == NULL)
+		ERROR("Could not copy call %s: OOM",
+		      dbus_message_get_member(call->message));
+	return message;
+}
+
+int liblazy_call_send(LiblazyCall *call, DBusMessage *message,
+		      DBusMessage **reply, int timeout)
+{
+	if (call == NULL || message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (call->signature != NULL &&
+	    !dbus_message_has_signature(message, call->signature)) {
+		ERROR("Arguments of %s are '%s', expected '%s'",
+		      dbus_message_get_member(message),
+		      dbus_message_get_signature(message), call->signature);
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	}
+
+	if (call->address != NULL)
+		return liblazy_dbus_send_message_to_address(call->address,
+							    message, reply,
+							    timeout, NULL);
+	return liblazy_dbus_send_message(call->bus_type, message, reply,
+					 timeout, NULL, NULL);
+}
+
+int liblazy_call_invoke(LiblazyCall *call, DBusMessage **reply, int timeout,
+			int first_arg_type, ...)
+{
+	DBusMessage	*message;
+	va_list		var_args;
+	int		ret;
+
+	message = liblazy_call_new_message(call);
+	if (message == NULL)
+		return call == NULL ? LIBLAZY_ERROR_INVALID_ARGUMENT :
+				      LIBLAZY_ERROR_GENERAL;
+
+	va_start(var_args, first_arg_type);
+	if (!dbus_message_append_args_valist(message, first_arg_type, var_args)) {
+		ERROR("Could not append arguments to %s: OOM",
+		      dbus_message_get_member(message));
+		ret = LIBLAZY_ERROR_GENERAL;
+	} else
+		ret = liblazy_call_send(call, message, reply, timeout);
+	va_end(var_args);
+
+	dbus_message_unref(message);
+	return ret;
+}
+
+void liblazy_call_free(LiblazyCall *call)
+{
+	if (call == NULL)
+		return;
+	if (call->message != NULL)
+		dbus_message_unref(call->message);
+	free(call->signature);
+	free(call->address);
+	free(call);
+}
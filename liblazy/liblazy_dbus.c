@@ -31,84 +31,1202 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
-static int dbus_system_use_private_connection = 0;
+/* longest time to sleep while waiting for a cancellable call, in case
+ * another thread reads our reply from the connection */
+#define CANCELLABLE_POLL_INTERVAL	100
+
+struct _LiblazyCancellable {
+	/* only accessed atomically, cancelled from any thread */
+	int		cancelled;
+	/* written to on cancellation to wake up a waiting call */
+	int		fds[2];
+};
+
+/* a private connection which is kept open across calls */
+struct connection_slot {
+	pthread_mutex_t	lock;
+	DBusConnection	*connection;
+};
+
+/* a private connection to a peer listening on a D-Bus server address,
+ * talked to without a bus daemon in between */
+struct address_connection {
+	char				*address;
+	struct connection_slot		slot;
+	struct address_connection	*next;
+};
+
+/* connections owned by one thread, index 0 is the system bus */
+struct thread_connections {
+	int		shard;
+	/* dbus_connection_generation when the connections were opened */
+	unsigned int	generation;
+	DBusConnection	*connection[2];
+};
+
+/* protects the configuration and the shard table */
+static pthread_mutex_t		config_lock = PTHREAD_MUTEX_INITIALIZER;
+static int			dbus_system_use_private_connection = 0;
+static int			dbus_default_timeout = -1;
+static int			dbus_connection_shards = LIBLAZY_CONNECTION_SHARED;
+static struct connection_slot	dbus_system_private_slot = {
+	PTHREAD_MUTEX_INITIALIZER, NULL
+};
+/* cancellable calls need a connection they may dispatch, used instead of
+ * the shared one of the application. Index 0 is the system bus */
+static struct connection_slot	dbus_cancellable_slots[2] = {
+	{ PTHREAD_MUTEX_INITIALIZER, NULL },
+	{ PTHREAD_MUTEX_INITIALIZER, NULL }
+};
+/* dbus_connection_shards * 2 slots, system and session bus interleaved */
+static struct connection_slot	*dbus_shard_slots = NULL;
+static unsigned int		dbus_next_shard = 0;
+/* bumped whenever the shard setting changes */
+static unsigned int		dbus_connection_generation = 0;
+
+/* protects the list of peer connections, not the connections in it */
+static pthread_mutex_t		address_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct address_connection *address_connections = NULL;
+
+static pthread_once_t		threads_once = PTHREAD_ONCE_INIT;
+static pthread_key_t		thread_key;
+
+/* a signal or call without reply waiting to be written */
+struct queued_message {
+	DBusConnection	*connection;
+	DBusMessage	*message;
+};
+
+/* protects the send queue, held while it is written to keep the order */
+static pthread_mutex_t		queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct queued_message	*send_queue = NULL;
+static int			send_queue_used = 0;
+/* 0 if batching is disabled */
+static int			send_queue_size = 0;
+static pthread_once_t		exit_flush_once = PTHREAD_ONCE_INIT;
+
+static int liblazy_dbus_bus_index(int bus_type)
+{
+	return bus_type == DBUS_BUS_SYSTEM ? 0 : 1;
+}
+
+/* closes a connection owned by the library. Batched messages may still
+ * wait for it, they are written first so libdbus doesn't drop them */
+static void liblazy_dbus_close_connection(DBusConnection *dbus_connection)
+{
+	if (dbus_connection == NULL)
+		return;
+	liblazy_dbus_flush();
+	dbus_connection_close(dbus_connection);
+	dbus_connection_unref(dbus_connection);
+}
+
+static void liblazy_dbus_free_thread_connections(void *data)
+{
+	struct thread_connections *connections = data;
+
+	liblazy_dbus_close_connection(connections->connection[0]);
+	liblazy_dbus_close_connection(connections->connection[1]);
+	free(connections);
+}
+
+static void liblazy_dbus_threads_init_once(void)
+{
+	dbus_threads_init_default();
+	pthread_key_create(&thread_key, liblazy_dbus_free_thread_connections);
+}
+
+void liblazy_dbus_threads_init(void)
+{
+	pthread_once(&threads_once, liblazy_dbus_threads_init_once);
+}
+
+static struct thread_connections *liblazy_dbus_get_thread_connections(void)
+{
+	struct thread_connections *connections;
+
+	connections = pthread_getspecific(thread_key);
+	if (connections != NULL)
+		return connections;
+
+	connections = calloc(1, sizeof(struct thread_connections));
+	if (connections == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&config_lock);
+	connections->shard = dbus_next_shard++;
+	connections->generation = dbus_connection_generation;
+	pthread_mutex_unlock(&config_lock);
+
+	pthread_setspecific(thread_key, connections);
+	return connections;
+}
+
+/* closes and frees all shard slots, config_lock has to be held */
+static void liblazy_dbus_free_shards(void)
+{
+	int i;
+
+	if (dbus_shard_slots == NULL)
+		return;
+	for (i = 0; i < dbus_connection_shards * 2; i++) {
+		/* wait for threads still looking up their connection */
+		pthread_mutex_lock(&dbus_shard_slots[i].lock);
+		liblazy_dbus_close_connection(dbus_shard_slots[i].connection);
+		pthread_mutex_unlock(&dbus_shard_slots[i].lock);
+		pthread_mutex_destroy(&dbus_shard_slots[i].lock);
+	}
+	free(dbus_shard_slots);
+	dbus_shard_slots = NULL;
+}
 
 void liblazy_dbus_system_use_private_connection(int use_private) {
+	liblazy_dbus_threads_init();
+
+	pthread_mutex_lock(&config_lock);
 	dbus_system_use_private_connection = use_private;
+	pthread_mutex_unlock(&config_lock);
+
+	if (!use_private) {
+		pthread_mutex_lock(&dbus_system_private_slot.lock);
+		liblazy_dbus_close_connection(dbus_system_private_slot.connection);
+		dbus_system_private_slot.connection = NULL;
+		pthread_mutex_unlock(&dbus_system_private_slot.lock);
+	}
+}
+
+int liblazy_dbus_set_connection_shards(int shards)
+{
+	struct connection_slot	*slots	= NULL;
+	int			i;
+
+	if (shards < LIBLAZY_CONNECTION_PER_THREAD)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	liblazy_dbus_threads_init();
+
+	if (shards > 0) {
+		slots = calloc(shards * 2, sizeof(struct connection_slot));
+		if (slots == NULL) {
+			ERROR("Could not allocate connection shards: OOM");
+			return LIBLAZY_ERROR_GENERAL;
+		}
+		for (i = 0; i < shards * 2; i++)
+			pthread_mutex_init(&slots[i].lock, NULL);
+	}
+
+	pthread_mutex_lock(&config_lock);
+	liblazy_dbus_free_shards();
+	dbus_shard_slots = slots;
+	dbus_connection_shards = shards;
+	/* per thread connections belong to their threads, which close them
+	 * on their next call */
+	dbus_connection_generation++;
+	pthread_mutex_unlock(&config_lock);
+	return 0;
+}
+
+void liblazy_dbus_set_default_timeout(int timeout)
+{
+	pthread_mutex_lock(&config_lock);
+	dbus_default_timeout = timeout < 0 ? -1 : timeout;
+	pthread_mutex_unlock(&config_lock);
+}
+
+int liblazy_dbus_get_timeout(int timeout)
+{
+	if (timeout < 0) {
+		pthread_mutex_lock(&config_lock);
+		timeout = dbus_default_timeout;
+		pthread_mutex_unlock(&config_lock);
+	}
+	return timeout;
+}
+
+int liblazy_dbus_error_code(DBusError *dbus_error)
+{
+	if (dbus_error_has_name(dbus_error, DBUS_ERROR_TIMEOUT) ||
+	    dbus_error_has_name(dbus_error, DBUS_ERROR_TIMED_OUT))
+		return LIBLAZY_ERROR_DBUS_TIMEOUT;
+	/* the bus sends this when the callee went away before replying */
+	if (dbus_error_has_name(dbus_error, DBUS_ERROR_NO_REPLY))
+		return LIBLAZY_ERROR_DBUS_NO_REPLY;
+	return LIBLAZY_ERROR_DBUS_ERROR_IS_SET;
+}
+
+/* like dbus_set_error_from_message, but tells the NoReply libdbus makes up
+ * when the timeout of a pending call expired, which has no sender, from
+ * the one the bus sends when the callee disconnected. The former is
+ * reported as DBUS_ERROR_TIMEOUT */
+static int liblazy_dbus_set_error_from_reply(DBusConnection *dbus_connection,
+					     DBusError *dbus_error,
+					     DBusMessage *reply)
+{
+	if (dbus_message_is_error(reply, DBUS_ERROR_NO_REPLY) &&
+	    dbus_message_get_sender(reply) == NULL &&
+	    dbus_connection_get_is_connected(dbus_connection)) {
+		dbus_set_error_const(dbus_error, DBUS_ERROR_TIMEOUT,
+				     "Did not receive a reply in time");
+		return TRUE;
+	}
+	return dbus_set_error_from_message(dbus_error, reply);
+}
+
+LiblazyCancellable *liblazy_cancellable_new(void)
+{
+	LiblazyCancellable *cancellable;
+
+	cancellable = calloc(1, sizeof(LiblazyCancellable));
+	if (cancellable == NULL) {
+		ERROR("Could not allocate cancellable: OOM");
+		return NULL;
+	}
+
+	if (pipe(cancellable->fds) != 0) {
+		ERROR("Could not create pipe: %s", strerror(errno));
+		free(cancellable);
+		return NULL;
+	}
+	fcntl(cancellable->fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(cancellable->fds[1], F_SETFL, O_NONBLOCK);
+	fcntl(cancellable->fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(cancellable->fds[1], F_SETFD, FD_CLOEXEC);
+	return cancellable;
+}
+
+void liblazy_cancellable_cancel(LiblazyCancellable *cancellable)
+{
+	char c = 0;
+
+	if (cancellable == NULL ||
+	    !__sync_bool_compare_and_swap(&cancellable->cancelled, 0, 1))
+		return;
+	/* if the pipe is full, the waiter is woken up anyway */
+	if (write(cancellable->fds[1], &c, 1) < 0)
+		return;
+}
+
+int liblazy_cancellable_is_cancelled(LiblazyCancellable *cancellable)
+{
+	return cancellable != NULL &&
+		__sync_fetch_and_add(&cancellable->cancelled, 0);
+}
+
+void liblazy_cancellable_reset(LiblazyCancellable *cancellable)
+{
+	char buf[16];
+
+	if (cancellable == NULL)
+		return;
+	while (read(cancellable->fds[0], buf, sizeof(buf)) > 0)
+		;
+	__sync_bool_compare_and_swap(&cancellable->cancelled, 1, 0);
+}
+
+void liblazy_cancellable_free(LiblazyCancellable *cancellable)
+{
+	if (cancellable == NULL)
+		return;
+	close(cancellable->fds[0]);
+	close(cancellable->fds[1]);
+	free(cancellable);
+}
+
+DBusConnection *liblazy_dbus_open_private(int bus_type, DBusError *dbus_error)
+{
+	DBusConnection	*dbus_connection;
+	const char	*address;
+
+	liblazy_dbus_threads_init();
+
+	if (bus_type == DBUS_BUS_SYSTEM) {
+		address = getenv("DBUS_SYSTEM_BUS_ADDRESS");
+		if (address == NULL)
+			address = DBUS_SYSTEM_BUS_SOCKET;
+	} else {
+		address = getenv("DBUS_SESSION_BUS_ADDRESS");
+		if (address == NULL) {
+			dbus_set_error_const(dbus_error, DBUS_ERROR_BAD_ADDRESS,
+					     "DBUS_SESSION_BUS_ADDRESS not set");
+			return NULL;
+		}
+	}
+
+	dbus_connection = dbus_connection_open_private(address, dbus_error);
+	if (dbus_connection == NULL || dbus_error_is_set(dbus_error))
+		return NULL;
+
+	if (!dbus_bus_register(dbus_connection, dbus_error)) {
+		dbus_connection_close(dbus_connection);
+		dbus_connection_unref(dbus_connection);
+		return NULL;
+	}
+
+	dbus_connection_set_exit_on_disconnect(dbus_connection, FALSE);
+	return dbus_connection;
+}
+
+/* opens a private connection to a peer, there is no bus to register with */
+static DBusConnection *liblazy_dbus_open_address(const char *address,
+						 DBusError *dbus_error)
+{
+	DBusConnection *dbus_connection;
+
+	liblazy_dbus_threads_init();
+
+	dbus_connection = dbus_connection_open_private(address, dbus_error);
+	if (dbus_connection == NULL || dbus_error_is_set(dbus_error))
+		return NULL;
+
+	dbus_connection_set_exit_on_disconnect(dbus_connection, FALSE);
+	return dbus_connection;
+}
+
+DBusConnection *liblazy_dbus_open_watch(int bus_type, const char * const *rules,
+					DBusHandleMessageFunction filter,
+					DBusError *dbus_error)
+{
+	DBusConnection	*dbus_connection;
+	int		i;
+
+	dbus_connection = liblazy_dbus_open_private(bus_type, dbus_error);
+	if (dbus_connection == NULL)
+		return NULL;
+
+	if (!dbus_connection_add_filter(dbus_connection, filter, NULL, NULL)) {
+		dbus_set_error_const(dbus_error, DBUS_ERROR_NO_MEMORY,
+				     "Could not add signal filter");
+		dbus_connection_close(dbus_connection);
+		dbus_connection_unref(dbus_connection);
+		return NULL;
+	}
+
+	for (i = 0; rules[i] != NULL; i++) {
+		dbus_bus_add_match(dbus_connection, rules[i], dbus_error);
+		if (dbus_error_is_set(dbus_error)) {
+			liblazy_dbus_close_watch(dbus_connection, filter);
+			return NULL;
+		}
+	}
+	return dbus_connection;
+}
+
+void liblazy_dbus_close_watch(DBusConnection *dbus_connection,
+			      DBusHandleMessageFunction filter)
+{
+	dbus_connection_remove_filter(dbus_connection, filter, NULL);
+	dbus_connection_close(dbus_connection);
+	dbus_connection_unref(dbus_connection);
+}
+
+int liblazy_dbus_dispatch_watch(DBusConnection *dbus_connection)
+{
+	struct pollfd	fds;
+
+	if (!dbus_connection_get_unix_fd(dbus_connection, &fds.fd))
+		return 0;
+	fds.events = POLLIN;
+
+	/* one read_write only reads a bounded chunk, keep going until the
+	 * socket is drained so no queued signal is left behind */
+	do {
+		dbus_connection_read_write(dbus_connection, 0);
+		while (dbus_connection_dispatch(dbus_connection) == DBUS_DISPATCH_DATA_REMAINS)
+			;
+		if (!dbus_connection_get_is_connected(dbus_connection))
+			return 0;
+	} while (poll(&fds, 1, 0) > 0);
+
+	return 1;
+}
+
+/* returns a new reference to the connection in the given slot, reconnecting
+ * if D-Bus went away since the last call. Connects to address instead of
+ * the bus if it is not NULL */
+static DBusConnection *liblazy_dbus_get_private_connection(DBusConnection **slot,
+							   int bus_type,
+							   const char *address,
+							   DBusError *dbus_error)
+{
+	DBusConnection *dbus_connection = *slot;
+
+	if (dbus_connection != NULL) {
+		/* nobody reads from this connection between our calls, so
+		 * notice a hangup and drop what was sent to us meanwhile */
+		if (liblazy_dbus_dispatch_watch(dbus_connection))
+			return dbus_connection_ref(dbus_connection);
+		liblazy_dbus_close_connection(dbus_connection);
+		*slot = NULL;
+	}
+
+	if (address != NULL)
+		*slot = liblazy_dbus_open_address(address, dbus_error);
+	else
+		*slot = liblazy_dbus_open_private(bus_type, dbus_error);
+	if (*slot == NULL)
+		return NULL;
+	return dbus_connection_ref(*slot);
+}
+
+static DBusConnection *liblazy_dbus_get_slot_connection(struct connection_slot *slot,
+							int bus_type,
+							DBusError *dbus_error)
+{
+	DBusConnection *dbus_connection;
+
+	pthread_mutex_lock(&slot->lock);
+	dbus_connection = liblazy_dbus_get_private_connection(&slot->connection,
+							      bus_type, NULL,
+							      dbus_error);
+	pthread_mutex_unlock(&slot->lock);
+	return dbus_connection;
+}
+
+/* closes the calling thread's own connections if they were opened before
+ * the shard setting last changed */
+static void liblazy_dbus_drop_thread_connections(unsigned int generation)
+{
+	struct thread_connections *connections;
+
+	connections = pthread_getspecific(thread_key);
+	if (connections == NULL || connections->generation == generation)
+		return;
+
+	liblazy_dbus_close_connection(connections->connection[0]);
+	liblazy_dbus_close_connection(connections->connection[1]);
+	connections->connection[0] = NULL;
+	connections->connection[1] = NULL;
+	connections->generation = generation;
+}
+
+/* returns the connection of the calling thread's shard */
+static DBusConnection *liblazy_dbus_get_shard_connection(int bus_type,
+							 DBusError *dbus_error)
+{
+	struct thread_connections	*connections;
+	struct connection_slot		*slot		= NULL;
+	DBusConnection			*dbus_connection;
+	int				bus		= liblazy_dbus_bus_index(bus_type);
+
+	connections = liblazy_dbus_get_thread_connections();
+	if (connections == NULL) {
+		dbus_set_error_const(dbus_error, DBUS_ERROR_NO_MEMORY,
+				     "Could not allocate thread connections");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&config_lock);
+	if (dbus_connection_shards > 0) {
+		slot = &dbus_shard_slots[(connections->shard % dbus_connection_shards) * 2
+					 + bus];
+		/* taken while the shard table is locked, so the slot can't be
+		 * freed underneath us */
+		pthread_mutex_lock(&slot->lock);
+	}
+	pthread_mutex_unlock(&config_lock);
+
+	/* the thread's own connections need no locking */
+	if (slot == NULL)
+		return liblazy_dbus_get_private_connection(&connections->connection[bus],
+							   bus_type, NULL,
+							   dbus_error);
+
+	dbus_connection = liblazy_dbus_get_private_connection(&slot->connection,
+							      bus_type, NULL,
+							      dbus_error);
+	pthread_mutex_unlock(&slot->lock);
+	return dbus_connection;
+}
+
+/* returns a new reference to a connection to the given bus or NULL if the
+ * bus is not available. With owned set, never the shared connection of the
+ * application. Has to be unreffed by the caller */
+static DBusConnection *liblazy_dbus_lookup_connection(int bus_type,
+						      const char *what,
+						      int owned)
+{
+	DBusError	dbus_error;
+	DBusConnection	*dbus_connection	= NULL;
+	unsigned int	generation;
+	int		bus			= liblazy_dbus_bus_index(bus_type);
+	int		use_private;
+	int		shards;
+
+	liblazy_dbus_threads_init();
+	dbus_error_init(&dbus_error);
+
+	pthread_mutex_lock(&config_lock);
+	use_private = dbus_system_use_private_connection;
+	shards = dbus_connection_shards;
+	generation = dbus_connection_generation;
+	pthread_mutex_unlock(&config_lock);
+
+	liblazy_dbus_drop_thread_connections(generation);
+
+	if (shards != LIBLAZY_CONNECTION_SHARED)
+		dbus_connection = liblazy_dbus_get_shard_connection(bus_type,
+								    &dbus_error);
+	else if (bus_type == DBUS_BUS_SYSTEM && use_private)
+		dbus_connection = liblazy_dbus_get_slot_connection(&dbus_system_private_slot,
+								   bus_type,
+								   &dbus_error);
+	else if (owned)
+		dbus_connection = liblazy_dbus_get_slot_connection(&dbus_cancellable_slots[bus],
+								   bus_type,
+								   &dbus_error);
+	else {
+		dbus_connection = dbus_bus_get(bus_type, &dbus_error);
+		if (dbus_connection != NULL && dbus_error_is_set(&dbus_error)) {
+			dbus_connection_unref(dbus_connection);
+			dbus_connection = NULL;
+		}
+	}
+
+	if (dbus_connection == NULL)
+		ERROR("Connection to dbus not ready, skipping %s: %s",
+		      what, dbus_error.message);
+
+	dbus_error_free(&dbus_error);
+	return dbus_connection;
+}
+
+DBusConnection *liblazy_dbus_get_connection(int bus_type, const char *what)
+{
+	return liblazy_dbus_lookup_connection(bus_type, what, 0);
+}
+
+/* returns a new reference to the cached connection to a peer, connecting
+ * if there is none yet or the old one was lost. Has to be unreffed by the
+ * caller */
+static DBusConnection *liblazy_dbus_get_address_connection(const char *address,
+							   const char *what)
+{
+	struct address_connection	*entry;
+	DBusConnection			*dbus_connection;
+	DBusError			dbus_error;
+
+	pthread_mutex_lock(&address_lock);
+	for (entry = address_connections; entry != NULL; entry = entry->next)
+		if (strcmp(entry->address, address) == 0)
+			break;
+
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(struct address_connection));
+		if (entry == NULL || (entry->address = strdup(address)) == NULL) {
+			pthread_mutex_unlock(&address_lock);
+			free(entry);
+			ERROR("Could not allocate connection to %s: OOM", address);
+			return NULL;
+		}
+		pthread_mutex_init(&entry->slot.lock, NULL);
+		entry->next = address_connections;
+		address_connections = entry;
+	}
+	/* taken while the list is locked, so the entry can't be freed
+	 * underneath us. Connecting to one peer doesn't hold up the others */
+	pthread_mutex_lock(&entry->slot.lock);
+	pthread_mutex_unlock(&address_lock);
+
+	dbus_error_init(&dbus_error);
+	dbus_connection = liblazy_dbus_get_private_connection(&entry->slot.connection,
+							      0, address,
+							      &dbus_error);
+	pthread_mutex_unlock(&entry->slot.lock);
+
+	if (dbus_connection == NULL)
+		ERROR("Connection to %s not ready, skipping %s: %s",
+		      address, what, dbus_error.message);
+
+	dbus_error_free(&dbus_error);
+	return dbus_connection;
+}
+
+int liblazy_dbus_connect_address(const char *address)
+{
+	DBusConnection *dbus_connection;
+
+	if (address == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	dbus_connection = liblazy_dbus_get_address_connection(address, "connect");
+	if (dbus_connection == NULL)
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+
+	dbus_connection_unref(dbus_connection);
+	return 0;
+}
+
+void liblazy_dbus_disconnect_address(const char *address)
+{
+	struct address_connection	**prev;
+	struct address_connection	*entry;
+
+	if (address == NULL)
+		return;
+
+	pthread_mutex_lock(&address_lock);
+	for (prev = &address_connections; *prev != NULL; prev = &(*prev)->next)
+		if (strcmp((*prev)->address, address) == 0)
+			break;
+	entry = *prev;
+	if (entry != NULL)
+		*prev = entry->next;
+	pthread_mutex_unlock(&address_lock);
+
+	if (entry == NULL)
+		return;
+
+	/* wait for a thread still looking up the connection */
+	pthread_mutex_lock(&entry->slot.lock);
+	liblazy_dbus_close_connection(entry->slot.connection);
+	pthread_mutex_unlock(&entry->slot.lock);
+	pthread_mutex_destroy(&entry->slot.lock);
+	free(entry->address);
+	free(entry);
+}
+
+/* like dbus_connection_send_with_reply_and_block, but gives up as soon as
+ * the cancellable is cancelled. Dispatches the connection while waiting,
+ * so it must be one of ours and never the shared one of the application,
+ * whose filters and handlers would run here */
+static DBusMessage *liblazy_dbus_send_cancellable(DBusConnection *dbus_connection,
+						  DBusMessage *message, int timeout,
+						  LiblazyCancellable *cancellable,
+						  DBusError *dbus_error)
+{
+	DBusPendingCall	*pending	= NULL;
+	DBusMessage	*reply		= NULL;
+	struct pollfd	fds[2];
+	struct timespec	deadline;
+	long		remaining;
+	int		fd;
+
+	if (liblazy_cancellable_is_cancelled(cancellable)) {
+		dbus_set_error_const(dbus_error, LIBLAZY_DBUS_ERROR_CANCELLED,
+				     "Call was cancelled");
+		return NULL;
+	}
+
+	if (!dbus_connection_get_unix_fd(dbus_connection, &fd) ||
+	    !dbus_connection_send_with_reply(dbus_connection, message, &pending,
+					     -1) || pending == NULL) {
+		dbus_set_error_const(dbus_error, DBUS_ERROR_DISCONNECTED,
+				     "Could not send message");
+		return NULL;
+	}
+	dbus_connection_flush(dbus_connection);
+	if (TRACE_ENABLED)
+		liblazy_trace_call(LIBLAZY_TRACE_CALL_START, message, 0);
+
+	/* libdbus only enforces timeouts of pending calls when blocking on
+	 * them or from a mainloop, so keep the deadline ourselves */
+	if (timeout < 0)
+		timeout = LIBLAZY_DBUS_DEFAULT_TIMEOUT;
+	liblazy_deadline_set(&deadline, timeout);
+
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = cancellable->fds[0];
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		while (dbus_connection_get_dispatch_status(dbus_connection) ==
+		       DBUS_DISPATCH_DATA_REMAINS)
+			dbus_connection_dispatch(dbus_connection);
+
+		if (dbus_pending_call_get_completed(pending))
+			break;
+		if (liblazy_cancellable_is_cancelled(cancellable)) {
+			dbus_set_error_const(dbus_error, LIBLAZY_DBUS_ERROR_CANCELLED,
+					     "Call was cancelled");
+			goto Cancel;
+		}
+		if (!dbus_connection_get_is_connected(dbus_connection)) {
+			dbus_set_error_const(dbus_error, DBUS_ERROR_DISCONNECTED,
+					     "Connection was closed");
+			goto Cancel;
+		}
+		remaining = liblazy_deadline_remaining(&deadline);
+		if (remaining <= 0) {
+			dbus_set_error_const(dbus_error, DBUS_ERROR_TIMEOUT,
+					     "Did not receive a reply in time");
+			goto Cancel;
+		}
+
+		if (remaining > CANCELLABLE_POLL_INTERVAL)
+			remaining = CANCELLABLE_POLL_INTERVAL;
+		poll(fds, 2, remaining);
+		dbus_connection_read_write(dbus_connection, 0);
+	}
+
+	reply = dbus_pending_call_steal_reply(pending);
+	dbus_pending_call_unref(pending);
+	if (reply != NULL &&
+	    liblazy_dbus_set_error_from_reply(dbus_connection, dbus_error, reply)) {
+		dbus_message_unref(reply);
+		reply = NULL;
+	}
+	return reply;
+
+Cancel:
+	dbus_pending_call_cancel(pending);
+	dbus_pending_call_unref(pending);
+	return NULL;
+}
+
+/* like dbus_connection_send_with_reply_and_block, which does the same
+ * internally, but lets the call be traced once it got its serial */
+static DBusMessage *liblazy_dbus_send_blocking(DBusConnection *dbus_connection,
+					       DBusMessage *message, int timeout,
+					       DBusError *dbus_error)
+{
+	DBusPendingCall	*pending	= NULL;
+	DBusMessage	*reply;
+
+	if (!dbus_connection_send_with_reply(dbus_connection, message, &pending,
+					     timeout) || pending == NULL) {
+		dbus_set_error_const(dbus_error, DBUS_ERROR_DISCONNECTED,
+				     "Could not send message");
+		return NULL;
+	}
+	if (TRACE_ENABLED)
+		liblazy_trace_call(LIBLAZY_TRACE_CALL_START, message, 0);
+
+	dbus_pending_call_block(pending);
+	reply = dbus_pending_call_steal_reply(pending);
+	dbus_pending_call_unref(pending);
+
+	if (reply == NULL)
+		dbus_set_error_const(dbus_error, DBUS_ERROR_NO_REPLY,
+				     "Did not receive a reply");
+	else if (liblazy_dbus_set_error_from_reply(dbus_connection, dbus_error,
+						   reply)) {
+		dbus_message_unref(reply);
+		reply = NULL;
+	}
+	return reply;
+}
+
+/* writes out all queued messages, called with queue_lock held */
+static int liblazy_dbus_flush_queue(void)
+{
+	struct queued_message	*entry;
+	int			ret	= 0;
+	int			i;
+
+	for (i = 0; i < send_queue_used; i++) {
+		entry = &send_queue[i];
+		if (!dbus_connection_send(entry->connection, entry->message, NULL)) {
+			ERROR("Could not send message: OOM");
+			ret = LIBLAZY_ERROR_GENERAL;
+		} else if (TRACE_ENABLED)
+			liblazy_trace_call(LIBLAZY_TRACE_CALL_START, entry->message, 0);
+		/* flush once per run of messages for the same connection */
+		if (i + 1 == send_queue_used ||
+		    send_queue[i + 1].connection != entry->connection)
+			dbus_connection_flush(entry->connection);
+	}
+
+	for (i = 0; i < send_queue_used; i++) {
+		dbus_message_unref(send_queue[i].message);
+		dbus_connection_unref(send_queue[i].connection);
+	}
+	send_queue_used = 0;
+	return ret;
+}
+
+static void liblazy_dbus_flush_at_exit(void)
+{
+	liblazy_dbus_flush();
+}
+
+static void liblazy_dbus_register_exit_flush(void)
+{
+	atexit(liblazy_dbus_flush_at_exit);
+}
+
+int liblazy_dbus_set_outbound_batching(int max_queued)
+{
+	struct queued_message	*queue;
+	int			ret;
+
+	if (max_queued < 0)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (max_queued > 0)
+		pthread_once(&exit_flush_once, liblazy_dbus_register_exit_flush);
+
+	pthread_mutex_lock(&queue_lock);
+	ret = liblazy_dbus_flush_queue();
+	if (max_queued == 0) {
+		free(send_queue);
+		send_queue = NULL;
+	} else {
+		queue = realloc(send_queue, max_queued * sizeof(struct queued_message));
+		if (queue == NULL) {
+			ERROR("Could not allocate send queue: OOM");
+			pthread_mutex_unlock(&queue_lock);
+			return LIBLAZY_ERROR_GENERAL;
+		}
+		send_queue = queue;
+	}
+	send_queue_size = max_queued;
+	pthread_mutex_unlock(&queue_lock);
+	return ret;
+}
+
+int liblazy_dbus_flush(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&queue_lock);
+	ret = liblazy_dbus_flush_queue();
+	pthread_mutex_unlock(&queue_lock);
+	return ret;
+}
+
+/* sends a message nobody waits a reply for, or queues it if batching is
+ * enabled */
+static int liblazy_dbus_queue_message(DBusConnection *dbus_connection,
+				      DBusMessage *message)
+{
+	pthread_mutex_lock(&queue_lock);
+	if (send_queue_size == 0) {
+		pthread_mutex_unlock(&queue_lock);
+		if (!dbus_connection_send(dbus_connection, message, NULL)) {
+			ERROR("Could not send message: OOM");
+			return LIBLAZY_ERROR_GENERAL;
+		}
+		if (TRACE_ENABLED)
+			liblazy_trace_call(LIBLAZY_TRACE_CALL_START, message, 0);
+		/* otherwise the message may still sit in libdbus when a short
+		 * lived process exits */
+		dbus_connection_flush(dbus_connection);
+		return 0;
+	}
+
+	/* the queue is full, the sender has to wait until it is written.
+	 * Failures belong to the messages of other callers and are logged */
+	if (send_queue_used == send_queue_size)
+		liblazy_dbus_flush_queue();
+
+	send_queue[send_queue_used].connection = dbus_connection_ref(dbus_connection);
+	send_queue[send_queue_used].message = dbus_message_ref(message);
+	send_queue_used++;
+	pthread_mutex_unlock(&queue_lock);
+	return 0;
+}
+
+/* the part of liblazy_dbus_send_message after the connection is known,
+ * drops the given reference to it. started is NULL if statistics were
+ * disabled when the call started */
+static int liblazy_dbus_send_on_connection(DBusConnection *dbus_connection,
+					   DBusMessage *message,
+					   DBusMessage **reply, int timeout,
+					   LiblazyCancellable *cancellable,
+					   DBusError *error,
+					   const struct timespec *started)
+{
+	DBusError	dbus_error;
+	int		ret			= 0;
+
+	dbus_error_init(&dbus_error);
+	timeout = liblazy_dbus_get_timeout(timeout);
+
+	if (reply == NULL) {
+		/* spare the peer a reply nobody waits for */
+		if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_METHOD_CALL)
+			dbus_message_set_no_reply(message, TRUE);
+		ret = liblazy_dbus_queue_message(dbus_connection, message);
+	} else {
+		if (cancellable != NULL)
+			*reply = liblazy_dbus_send_cancellable(dbus_connection,
+							       message, timeout,
+							       cancellable,
+							       &dbus_error);
+		else
+			*reply = liblazy_dbus_send_blocking(dbus_connection,
+							    message, timeout,
+							    &dbus_error);
+		if (dbus_error_is_set(&dbus_error)) {
+			if (dbus_error_has_name(&dbus_error, LIBLAZY_DBUS_ERROR_CANCELLED))
+				ret = LIBLAZY_ERROR_DBUS_CANCELLED;
+			else
+				ret = liblazy_dbus_error_code(&dbus_error);
+
+			if (started != NULL)
+				liblazy_stats_record(message, NULL, 1, started,
+						     ret, dbus_error.name);
+			if (TRACE_ENABLED)
+				liblazy_trace_call(LIBLAZY_TRACE_ERROR, message, ret);
+
+			/* the caller wants to look at the error reply itself */
+			if (error != NULL)
+				dbus_move_error(&dbus_error, error);
+			else if (ret == LIBLAZY_ERROR_DBUS_ERROR_IS_SET)
+				ERROR("Received error reply: %s", dbus_error.message);
+		} else {
+			if (started != NULL)
+				liblazy_stats_record(message, *reply, 1, started,
+						     ret, NULL);
+			if (TRACE_ENABLED)
+				liblazy_trace_call(LIBLAZY_TRACE_REPLY, message, 0);
+		}
+	}
+
+	if (reply == NULL && started != NULL)
+		liblazy_stats_record(message, NULL, 0, started, ret, NULL);
+
+	dbus_connection_unref(dbus_connection);
+	dbus_error_free(&dbus_error);
+	return ret;
+}
+
+int liblazy_dbus_send_message(int bus_type, DBusMessage *message,
+			      DBusMessage **reply, int timeout,
+			      LiblazyCancellable *cancellable, DBusError *error)
+{
+	DBusConnection	*dbus_connection;
+	struct timespec	started;
+	struct timespec	*timed			= NULL;
+
+	if (message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	/* the flag may change meanwhile, it is only read once */
+	if (liblazy_stats_enabled) {
+		liblazy_stats_start(&started);
+		timed = &started;
+	}
+
+	/* a cancellable call dispatches the connection while waiting */
+	dbus_connection = liblazy_dbus_lookup_connection(bus_type,
+							 dbus_message_get_member(message),
+							 cancellable != NULL);
+	if (dbus_connection == NULL) {
+		if (timed != NULL)
+			liblazy_stats_record(message, NULL, 0, timed,
+					     LIBLAZY_ERROR_DBUS_NOT_READY, NULL);
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+	}
+
+	return liblazy_dbus_send_on_connection(dbus_connection, message, reply,
+					       timeout, cancellable, error,
+					       timed);
 }
 
-int liblazy_dbus_send_method_call(const char *destination, const char *path,
-				  const char *interface, const char *method,
-				  int bus_type,
-				  DBusMessage **reply,
-				  int first_arg_type, va_list var_args)
+int liblazy_dbus_send_message_on(DBusConnection *dbus_connection,
+				 DBusMessage *message, DBusMessage **reply,
+				 int timeout, DBusError *error)
 {
-	DBusError	dbus_error;
-	DBusConnection	*dbus_connection	= NULL;
-	DBusMessage	*message		= NULL;
+	struct timespec	started;
+	struct timespec	*timed			= NULL;
+
+	if (dbus_connection == NULL || message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (liblazy_stats_enabled) {
+		liblazy_stats_start(&started);
+		timed = &started;
+	}
+
+	/* no cancellable, waiting for it would dispatch the connection */
+	return liblazy_dbus_send_on_connection(dbus_connection_ref(dbus_connection),
+					       message, reply, timeout, NULL,
+					       error, timed);
+}
+
+int liblazy_dbus_send_message_to_address(const char *address,
+					 DBusMessage *message,
+					 DBusMessage **reply, int timeout,
+					 LiblazyCancellable *cancellable)
+{
+	DBusConnection	*dbus_connection;
+	struct timespec	started;
+	struct timespec	*timed			= NULL;
+
+	if (address == NULL || message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (liblazy_stats_enabled) {
+		liblazy_stats_start(&started);
+		timed = &started;
+	}
+
+	dbus_connection = liblazy_dbus_get_address_connection(address,
+							      dbus_message_get_member(message));
+	if (dbus_connection == NULL) {
+		if (timed != NULL)
+			liblazy_stats_record(message, NULL, 0, timed,
+					     LIBLAZY_ERROR_DBUS_NOT_READY, NULL);
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+	}
+
+	return liblazy_dbus_send_on_connection(dbus_connection, message, reply,
+					       timeout, cancellable, NULL,
+					       timed);
+}
+
+/* sends one message of liblazy_dbus_send_messages without flushing */
+static void liblazy_dbus_send_pending(DBusConnection *dbus_connection,
+				      DBusMessage *message,
+				      DBusPendingCall **pending, DBusError *error)
+{
+	if (!dbus_connection_send_with_reply(dbus_connection, message, pending,
+					     liblazy_dbus_get_timeout(-1)) ||
+	    *pending == NULL) {
+		dbus_set_error_const(error, DBUS_ERROR_DISCONNECTED,
+				     "Could not send message");
+		*pending = NULL;
+	} else if (TRACE_ENABLED)
+		liblazy_trace_call(LIBLAZY_TRACE_CALL_START, message, 0);
+}
+
+int liblazy_dbus_send_messages(int bus_type, DBusMessage **messages, int count,
+			       DBusMessage **replies, DBusError *errors)
+{
+	DBusConnection	*dbus_connection;
+	DBusPendingCall	**pending;
+	DBusMessage	*reply;
+	struct timespec	started;
+	int		stats			= liblazy_stats_enabled;
 	int		ret			= 0;
+	int		i;
 
-	if (path == NULL || method == NULL)
+	if (messages == NULL || replies == NULL || errors == NULL || count < 0)
 		return LIBLAZY_ERROR_INVALID_ARGUMENT;
-	
-	dbus_error_init(&dbus_error);
 
-	if (bus_type == DBUS_BUS_SYSTEM && dbus_system_use_private_connection) {
-		dbus_connection = dbus_connection_open_private(DBUS_SYSTEM_BUS_SOCKET,
-							       &dbus_error);
-		if (dbus_connection == NULL || dbus_error_is_set(&dbus_error)) {
-			ERROR("Connection to dbus not ready, skipping method call %s: %s",
-			      method, dbus_error.message);
-			ret = LIBLAZY_ERROR_DBUS_NOT_READY;
-			goto Free_Error;
-		}
-		
-		dbus_bus_register(dbus_connection, &dbus_error);
-		if (dbus_error_is_set(&dbus_error)) {
-			ERROR("Could not register private connection, skipping method call %s: %s",
-			      method, dbus_error.message);
-			ret = LIBLAZY_ERROR_DBUS_NOT_READY;
-			goto Free_Error;
+	if (stats)
+		liblazy_stats_start(&started);
+
+	for (i = 0; i < count; i++)
+		replies[i] = NULL;
+	if (count == 0)
+		return 0;
+
+	dbus_connection = liblazy_dbus_get_connection(bus_type, "batch");
+	if (dbus_connection == NULL) {
+		for (i = 0; stats && i < count; i++)
+			liblazy_stats_record(messages[i], NULL, 0, &started,
+					     LIBLAZY_ERROR_DBUS_NOT_READY, NULL);
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+	}
+
+	pending = calloc(count, sizeof(DBusPendingCall *));
+	if (pending == NULL) {
+		ERROR("Could not allocate pending calls: OOM");
+		dbus_connection_unref(dbus_connection);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	/* queue as much as the bus lets us have in flight first, so the
+	 * requests are on the wire before we wait for the first reply */
+	for (i = 0; i < count && i < LIBLAZY_DBUS_MAX_PENDING; i++)
+		liblazy_dbus_send_pending(dbus_connection, messages[i], &pending[i],
+					  &errors[i]);
+	dbus_connection_flush(dbus_connection);
+
+	/* replies are matched to their pending call by serial, so whatever
+	 * arrives while blocking on one call completes the others as well */
+	for (i = 0; i < count; i++) {
+		if (pending[i] != NULL) {
+			dbus_pending_call_block(pending[i]);
+			reply = dbus_pending_call_steal_reply(pending[i]);
+			dbus_pending_call_unref(pending[i]);
+
+			if (reply == NULL)
+				dbus_set_error_const(&errors[i], DBUS_ERROR_NO_REPLY,
+						     "Did not receive a reply");
+			else if (liblazy_dbus_set_error_from_reply(dbus_connection,
+								   &errors[i], reply))
+				dbus_message_unref(reply);
+			else
+				replies[i] = reply;
 		}
-	} else  {
-		dbus_connection = dbus_bus_get(bus_type, &dbus_error);
-		if (dbus_connection == NULL || dbus_error_is_set(&dbus_error)) {
-			ERROR("Connection to dbus not ready, skipping method call %s: %s",
-			      method, dbus_error.message);
-			ret = LIBLAZY_ERROR_DBUS_NOT_READY;
-			goto Free_Error;
+
+		/* each finished call makes room for the next one */
+		if (i + LIBLAZY_DBUS_MAX_PENDING < count) {
+			liblazy_dbus_send_pending(dbus_connection,
+						  messages[i + LIBLAZY_DBUS_MAX_PENDING],
+						  &pending[i + LIBLAZY_DBUS_MAX_PENDING],
+						  &errors[i + LIBLAZY_DBUS_MAX_PENDING]);
+			dbus_connection_flush(dbus_connection);
 		}
 	}
 
+	for (i = 0; TRACE_ENABLED && i < count; i++) {
+		if (replies[i] != NULL)
+			liblazy_trace_call(LIBLAZY_TRACE_REPLY, messages[i], 0);
+		else
+			liblazy_trace_call(LIBLAZY_TRACE_ERROR, messages[i],
+					   liblazy_dbus_error_code(&errors[i]));
+	}
+
+	/* all calls share the one round trip they waited for together */
+	for (i = 0; stats && i < count; i++)
+		liblazy_stats_record(messages[i], replies[i], i == 0, &started,
+				     replies[i] != NULL ? 0 :
+				     liblazy_dbus_error_code(&errors[i]),
+				     errors[i].name);
+
+	free(pending);
+	dbus_connection_unref(dbus_connection);
+	return ret;
+}
+
+/* sends the call to the peer at address or, if it is NULL, over the bus */
+static int liblazy_dbus_send_method_call_to(const char *address,
+					    const char *destination,
+					    const char *path,
+					    const char *interface,
+					    const char *method, int bus_type,
+					    DBusMessage **reply, int timeout,
+					    LiblazyCancellable *cancellable,
+					    int first_arg_type, va_list var_args)
+{
+	DBusMessage	*message;
+	int		ret;
+
+	if (path == NULL || method == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
 	message = dbus_message_new_method_call(destination, path, interface, method);
+	if (message == NULL) {
+		ERROR("Could not create method call %s: OOM", method);
+		return LIBLAZY_ERROR_GENERAL;
+	}
 	dbus_message_append_args_valist(message, first_arg_type, var_args);
 
-	if (reply == NULL) {
-		if (!dbus_connection_send(dbus_connection, message, NULL)) {
-			ERROR("Could not send method call: OOM");
-			ret = LIBLAZY_ERROR_GENERAL;
-		}
-	} else {
-		*reply = dbus_connection_send_with_reply_and_block(dbus_connection,
-								   message, -1,
-								   &dbus_error);
-		if (dbus_error_is_set(&dbus_error)) {
-			ERROR("Received error reply: %s", dbus_error.message);
-			ret = LIBLAZY_ERROR_DBUS_ERROR_IS_SET;
-		}
-	}
+	if (address != NULL)
+		ret = liblazy_dbus_send_message_to_address(address, message, reply,
+							   timeout, cancellable);
+	else
+		ret = liblazy_dbus_send_message(bus_type, message, reply, timeout,
+						cancellable, NULL);
 
 	dbus_message_unref(message);
-	if (dbus_system_use_private_connection) {
-		dbus_connection_close(dbus_connection);
-		dbus_connection_unref(dbus_connection);
-	}
-Free_Error:
-	dbus_error_free(&dbus_error);
 	return ret;
 }
 
+int liblazy_dbus_send_method_call(const char *destination, const char *path,
+				  const char *interface, const char *method,
+				  int bus_type,
+				  DBusMessage **reply, int timeout,
+				  LiblazyCancellable *cancellable,
+				  int first_arg_type, va_list var_args)
+{
+	return liblazy_dbus_send_method_call_to(NULL, destination, path,
+						interface, method, bus_type,
+						reply, timeout, cancellable,
+						first_arg_type, var_args);
+}
+
 int liblazy_dbus_system_send_method_call(const char *destination, const char *path,
 					 const char *interface, const char *method,
 					 DBusMessage **reply,
@@ -123,7 +1241,7 @@ int liblazy_dbus_system_send_method_call(const char *destination, const char *pa
 					    interface,
 					    method,
 					    DBUS_BUS_SYSTEM,
-					    reply,
+					    reply, -1, NULL,
 					    first_arg_type,
 					    var_args);
 	va_end(var_args);
@@ -144,46 +1262,90 @@ int liblazy_dbus_session_send_method_call(const char *destination, const char *p
 					    interface,
 					    method,
 					    DBUS_BUS_SESSION,
-					    reply,
+					    reply, -1, NULL,
+					    first_arg_type,
+					    var_args);
+	va_end(var_args);
+	return ret;
+}
+
+int liblazy_dbus_system_send_method_call_with_timeout(const char *destination,
+						      const char *path,
+						      const char *interface,
+						      const char *method,
+						      DBusMessage **reply,
+						      int timeout,
+						      LiblazyCancellable *cancellable,
+						      int first_arg_type, ...)
+{
+	int	ret;
+	va_list	var_args;
+
+	va_start(var_args, first_arg_type);
+	ret = liblazy_dbus_send_method_call(destination,
+					    path,
+					    interface,
+					    method,
+					    DBUS_BUS_SYSTEM,
+					    reply, timeout, cancellable,
+					    first_arg_type,
+					    var_args);
+	va_end(var_args);
+	return ret;
+}
+
+int liblazy_dbus_session_send_method_call_with_timeout(const char *destination,
+						       const char *path,
+						       const char *interface,
+						       const char *method,
+						       DBusMessage **reply,
+						       int timeout,
+						       LiblazyCancellable *cancellable,
+						       int first_arg_type, ...)
+{
+	int	ret;
+	va_list	var_args;
+
+	va_start(var_args, first_arg_type);
+	ret = liblazy_dbus_send_method_call(destination,
+					    path,
+					    interface,
+					    method,
+					    DBUS_BUS_SESSION,
+					    reply, timeout, cancellable,
 					    first_arg_type,
 					    var_args);
 	va_end(var_args);
 	return ret;
 }
 
-static int liblazy_dbus_send_signal(const char *path, const char *interface,
-				    const char *name, int bus_type,
+/* sends the signal to the peer at address or, if it is NULL, over the bus */
+static int liblazy_dbus_send_signal(const char *address, const char *path,
+				    const char *interface, const char *name,
+				    int bus_type,
 				    int first_arg_type, va_list var_args)
 {
-	DBusError	dbus_error;
 	DBusMessage	*message;
-	DBusConnection	*dbus_connection;
-	int		ret = 0;
+	int		ret;
 
 	if (path == NULL || interface == NULL || name == NULL)
 		return LIBLAZY_ERROR_INVALID_ARGUMENT;
-	
-	dbus_error_init(&dbus_error);
-
-	dbus_connection = dbus_bus_get(bus_type, &dbus_error);
-	if (dbus_connection == NULL || dbus_error_is_set(&dbus_error)) {
-		ERROR("Connection to dbus not ready, skipping signal %s: %s",
-		      name, dbus_error.message);
-		ret = LIBLAZY_ERROR_DBUS_NOT_READY;
-		goto Free_Error;
-	}
 
 	message = dbus_message_new_signal(path, interface, name);
+	if (message == NULL) {
+		ERROR("Could not create signal %s: OOM", name);
+		return LIBLAZY_ERROR_GENERAL;
+	}
 	dbus_message_append_args_valist(message, first_arg_type, var_args);
 
-	if (!dbus_connection_send(dbus_connection, message, NULL)) {
-		ERROR("Could not send signal to D-BUS system bus.");
-		ret = LIBLAZY_ERROR_GENERAL;
-	}
+	if (address != NULL)
+		ret = liblazy_dbus_send_message_to_address(address, message, NULL,
+							   -1, NULL);
+	else
+		ret = liblazy_dbus_send_message(bus_type, message, NULL, -1,
+						NULL, NULL);
 
 	dbus_message_unref(message);
-Free_Error:
-	dbus_error_free(&dbus_error);
 	return ret;
 }
 
@@ -194,7 +1356,7 @@ int liblazy_dbus_system_send_signal(const char *path, const char *interface,
 	va_list	var_args;
 
 	va_start(var_args, first_arg_type);
-	ret = liblazy_dbus_send_signal(path, interface, name, DBUS_BUS_SYSTEM,
+	ret = liblazy_dbus_send_signal(NULL, path, interface, name, DBUS_BUS_SYSTEM,
 				       first_arg_type, var_args);
 	va_end(var_args);
 	return ret;
@@ -207,11 +1369,92 @@ int liblazy_dbus_session_send_signal(const char *path, const char *interface,
 	va_list	var_args;
 
 	va_start(var_args, first_arg_type);
-	ret = liblazy_dbus_send_signal(path, interface, name, DBUS_BUS_SESSION,
+	ret = liblazy_dbus_send_signal(NULL, path, interface, name, DBUS_BUS_SESSION,
+				       first_arg_type, var_args);
+	va_end(var_args);
+	return ret;
+
+}
+
+int liblazy_dbus_system_send_message(DBusMessage *message, DBusMessage **reply,
+				     int timeout)
+{
+	return liblazy_dbus_send_message(DBUS_BUS_SYSTEM, message, reply, timeout,
+					 NULL, NULL);
+}
+
+int liblazy_dbus_session_send_message(DBusMessage *message, DBusMessage **reply,
+				      int timeout)
+{
+	return liblazy_dbus_send_message(DBUS_BUS_SESSION, message, reply, timeout,
+					 NULL, NULL);
+}
+
+int liblazy_dbus_address_send_method_call(const char *address, const char *path,
+					  const char *interface, const char *method,
+					  DBusMessage **reply,
+					  int first_arg_type, ...)
+{
+	int	ret;
+	va_list	var_args;
+
+	if (address == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	va_start(var_args, first_arg_type);
+	ret = liblazy_dbus_send_method_call_to(address, NULL, path, interface,
+					       method, 0, reply, -1, NULL,
+					       first_arg_type, var_args);
+	va_end(var_args);
+	return ret;
+}
+
+int liblazy_dbus_address_send_method_call_with_timeout(const char *address,
+						       const char *path,
+						       const char *interface,
+						       const char *method,
+						       DBusMessage **reply,
+						       int timeout,
+						       LiblazyCancellable *cancellable,
+						       int first_arg_type, ...)
+{
+	int	ret;
+	va_list	var_args;
+
+	if (address == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	va_start(var_args, first_arg_type);
+	ret = liblazy_dbus_send_method_call_to(address, NULL, path, interface,
+					       method, 0, reply, timeout,
+					       cancellable, first_arg_type,
+					       var_args);
+	va_end(var_args);
+	return ret;
+}
+
+int liblazy_dbus_address_send_signal(const char *address, const char *path,
+				     const char *interface, const char *name,
+				     int first_arg_type, ...)
+{
+	int	ret;
+	va_list	var_args;
+
+	if (address == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	va_start(var_args, first_arg_type);
+	ret = liblazy_dbus_send_signal(address, path, interface, name, 0,
 				       first_arg_type, var_args);
 	va_end(var_args);
 	return ret;
+}
 
+int liblazy_dbus_address_send_message(const char *address, DBusMessage *message,
+				      DBusMessage **reply, int timeout)
+{
+	return liblazy_dbus_send_message_to_address(address, message, reply,
+						    timeout, NULL);
 }
 
 int liblazy_dbus_message_get_basic_arg(DBusMessage *message, int type,
@@ -243,35 +1486,51 @@ int liblazy_dbus_message_get_basic_arg(DBusMessage *message, int type,
 		}
 	}
 
+	if (TRACE_ENABLED)
+		liblazy_trace_decoded(message, ret);
 	return ret;
 }
 
-static char **liblazy_dbus_get_strlist_from_array(DBusMessageIter *reply_iter)
+char **liblazy_dbus_get_strlist_from_array(DBusMessageIter *reply_iter)
 {
 	const char	*val;
 	DBusMessageIter	iter_array;
 	char		**strlist	= NULL;
-	int		i		= 0;
+	char		*pos;
+	size_t		size		= 0;
+	size_t		len;
+	int		count		= 0;
+	int		i;
 
 	if (dbus_message_iter_get_arg_type(reply_iter) != DBUS_TYPE_ARRAY) {
 		ERROR("Iterator doesn't contain an array at current position");
 		return NULL;
 	}
-	
-	dbus_message_iter_recurse(reply_iter, &iter_array);
 
-	strlist = (char **)malloc(0);
+	/* size the pointers and the strings first, so the whole list is a
+	 * single allocation */
+	dbus_message_iter_recurse(reply_iter, &iter_array);
 	while (dbus_message_iter_get_arg_type(&iter_array) == DBUS_TYPE_STRING) {
 		dbus_message_iter_get_basic(&iter_array, &val);
-		strlist = realloc(strlist, sizeof(char**) * (i + 1));
-		strlist[i] = strdup(val);
+		size += strlen(val) + 1;
+		count++;
 		dbus_message_iter_next(&iter_array);
-		i++;
 	}
-	strlist = realloc(strlist, sizeof(char**) * (i + 1));
-	strlist[i] = NULL;
-	return strlist;
 
+	strlist = liblazy_strlist_alloc(count, size, &pos);
+	if (strlist == NULL)
+		return NULL;
+
+	dbus_message_iter_recurse(reply_iter, &iter_array);
+	for (i = 0; i < count; i++) {
+		dbus_message_iter_get_basic(&iter_array, &val);
+		len = strlen(val) + 1;
+		memcpy(pos, val, len);
+		strlist[i] = pos;
+		pos += len;
+		dbus_message_iter_next(&iter_array);
+	}
+	return strlist;
 }
 
 int liblazy_dbus_message_get_strlist_arg(DBusMessage *message,
@@ -302,5 +1561,287 @@ int liblazy_dbus_message_get_strlist_arg(DBusMessage *message,
 			}
 		}
 	}
+
+	if (TRACE_ENABLED)
+		liblazy_trace_decoded(message, ret);
+	return ret;
+}
+
+/* D-Bus allows 32 levels of arrays and another 32 of structs */
+#define CURSOR_MAX_DEPTH	64
+
+struct _LiblazyDBusCursor {
+	DBusMessage	*message;
+	/* iter[depth] is the current position, the ones below it point to
+	 * the containers that were entered */
+	int		depth;
+	DBusMessageIter	iter[CURSOR_MAX_DEPTH + 1];
+};
+
+static void liblazy_dbus_cursor_init(LiblazyDBusCursor *cursor,
+				     DBusMessage *message)
+{
+	cursor->message = message;
+	cursor->depth = 0;
+	dbus_message_iter_init(message, &cursor->iter[0]);
+}
+
+LiblazyDBusCursor *liblazy_dbus_cursor_new(DBusMessage *message)
+{
+	LiblazyDBusCursor *cursor;
+
+	cursor = calloc(1, sizeof(LiblazyDBusCursor));
+	if (cursor == NULL) {
+		ERROR("Could not allocate cursor: OOM");
+		return NULL;
+	}
+	if (message != NULL)
+		liblazy_dbus_cursor_reset(cursor, message);
+	return cursor;
+}
+
+int liblazy_dbus_cursor_reset(LiblazyDBusCursor *cursor, DBusMessage *message)
+{
+	if (cursor == NULL || message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	dbus_message_ref(message);
+	if (cursor->message != NULL)
+		dbus_message_unref(cursor->message);
+	liblazy_dbus_cursor_init(cursor, message);
+	return 0;
+}
+
+void liblazy_dbus_cursor_free(LiblazyDBusCursor *cursor)
+{
+	if (cursor == NULL)
+		return;
+	if (cursor->message != NULL)
+		dbus_message_unref(cursor->message);
+	free(cursor);
+}
+
+int liblazy_dbus_cursor_get_arg_type(LiblazyDBusCursor *cursor)
+{
+	if (cursor == NULL || cursor->message == NULL)
+		return DBUS_TYPE_INVALID;
+	return dbus_message_iter_get_arg_type(&cursor->iter[cursor->depth]);
+}
+
+int liblazy_dbus_cursor_enter(LiblazyDBusCursor *cursor)
+{
+	int type;
+
+	if (cursor == NULL || cursor->message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	type = dbus_message_iter_get_arg_type(&cursor->iter[cursor->depth]);
+	if (!dbus_type_is_container(type)) {
+		ERROR("Argument at cursor is not a container");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	if (cursor->depth == CURSOR_MAX_DEPTH) {
+		ERROR("Containers nested too deeply");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	dbus_message_iter_recurse(&cursor->iter[cursor->depth],
+				  &cursor->iter[cursor->depth + 1]);
+	cursor->depth++;
+	return 0;
+}
+
+int liblazy_dbus_cursor_leave(LiblazyDBusCursor *cursor)
+{
+	if (cursor == NULL || cursor->message == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (cursor->depth == 0) {
+		ERROR("Cursor is not inside a container");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	cursor->depth--;
+	dbus_message_iter_next(&cursor->iter[cursor->depth]);
+	return 0;
+}
+
+/* reads the arguments described by format in a single forward pass. On
+ * failure the string lists copied so far are freed again and the cursor
+ * is put back where it was */
+static int liblazy_dbus_cursor_read(LiblazyDBusCursor *cursor,
+				    const char *format, va_list var_args)
+{
+	DBusMessageIter	*iter;
+	DBusMessageIter	start;
+	char		****lists	= NULL;
+	char		****grown;
+	char		***strlist;
+	/* levels entered for a 'v', left again after one complete type */
+	unsigned char	variant[CURSOR_MAX_DEPTH + 1];
+	int		base		= cursor->depth;
+	int		lists_used	= 0;
+	int		lists_size	= 0;
+	int		expected;
+	int		type;
+	int		ret		= 0;
+	int		i;
+
+	start = cursor->iter[base];
+	for (; *format != '\0'; format++) {
+		iter = &cursor->iter[cursor->depth];
+		type = dbus_message_iter_get_arg_type(iter);
+
+		switch (*format) {
+		case '(':
+		case '{':
+		case 'v':
+			expected = *format == '(' ? DBUS_TYPE_STRUCT :
+				   *format == '{' ? DBUS_TYPE_DICT_ENTRY :
+				   DBUS_TYPE_VARIANT;
+			if (type != expected)
+				goto Mismatch;
+			ret = liblazy_dbus_cursor_enter(cursor);
+			if (ret)
+				goto Error;
+			variant[cursor->depth] = *format == 'v';
+			continue;
+		case ')':
+		case '}':
+			expected = *format == ')' ? DBUS_TYPE_STRUCT :
+				   DBUS_TYPE_DICT_ENTRY;
+			if (cursor->depth <= base || variant[cursor->depth] ||
+			    dbus_message_iter_get_arg_type(&cursor->iter[cursor->depth - 1])
+			    != expected)
+				goto Invalid;
+			liblazy_dbus_cursor_leave(cursor);
+			break;
+		case '*':
+			expected = '*';
+			if (type == DBUS_TYPE_INVALID)
+				goto Mismatch;
+			dbus_message_iter_next(iter);
+			break;
+		case 'a':
+			expected = DBUS_TYPE_ARRAY;
+			if (format[1] != 's')
+				goto Invalid;
+			format++;
+			if (type != DBUS_TYPE_ARRAY ||
+			    dbus_message_iter_get_element_type(iter) != DBUS_TYPE_STRING)
+				goto Mismatch;
+
+			if (lists_used == lists_size) {
+				lists_size = lists_size ? lists_size * 2 : 4;
+				grown = realloc(lists, lists_size * sizeof(char ***));
+				if (grown == NULL) {
+					ERROR("Could not allocate string list: OOM");
+					ret = LIBLAZY_ERROR_GENERAL;
+					goto Error;
+				}
+				lists = grown;
+			}
+			strlist = va_arg(var_args, char ***);
+			*strlist = liblazy_dbus_get_strlist_from_array(iter);
+			if (*strlist == NULL) {
+				ret = LIBLAZY_ERROR_GENERAL;
+				goto Error;
+			}
+			lists[lists_used++] = strlist;
+			dbus_message_iter_next(iter);
+			break;
+		case DBUS_TYPE_BYTE:
+		case DBUS_TYPE_BOOLEAN:
+		case DBUS_TYPE_INT16:
+		case DBUS_TYPE_UINT16:
+		case DBUS_TYPE_INT32:
+		case DBUS_TYPE_UINT32:
+		case DBUS_TYPE_INT64:
+		case DBUS_TYPE_UINT64:
+		case DBUS_TYPE_DOUBLE:
+		case DBUS_TYPE_STRING:
+		case DBUS_TYPE_OBJECT_PATH:
+		case DBUS_TYPE_SIGNATURE:
+#ifdef DBUS_TYPE_UNIX_FD
+		case DBUS_TYPE_UNIX_FD:
+#endif
+			/* spelled out, libdbus aborts when asked about
+			 * characters that are no type code at all */
+			expected = *format;
+			if (type != expected)
+				goto Mismatch;
+			dbus_message_iter_get_basic(iter, va_arg(var_args, void *));
+			dbus_message_iter_next(iter);
+			break;
+		default:
+			goto Invalid;
+		}
+
+		/* a complete type was read, leave the variants around it */
+		while (cursor->depth > base && variant[cursor->depth])
+			liblazy_dbus_cursor_leave(cursor);
+	}
+
+	if (cursor->depth != base)
+		goto Invalid;
+
+	free(lists);
+	return 0;
+
+Mismatch:
+	if (type == DBUS_TYPE_INVALID) {
+		ERROR("Expected argument of type '%c', but there are no more",
+		      expected);
+	} else {
+		ERROR("Expected argument of type '%c', got '%c'", expected, type);
+	}
+	ret = LIBLAZY_ERROR_GENERAL;
+	goto Error;
+Invalid:
+	ERROR("Invalid argument format at '%s'", format);
+	ret = LIBLAZY_ERROR_INVALID_ARGUMENT;
+Error:
+	for (i = 0; i < lists_used; i++) {
+		liblazy_free_strlist(*lists[i]);
+		*lists[i] = NULL;
+	}
+	free(lists);
+	cursor->depth = base;
+	cursor->iter[base] = start;
+	return ret;
+}
+
+int liblazy_dbus_cursor_get_args(LiblazyDBusCursor *cursor, const char *format, ...)
+{
+	va_list	var_args;
+	int	ret;
+
+	if (cursor == NULL || cursor->message == NULL || format == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	va_start(var_args, format);
+	ret = liblazy_dbus_cursor_read(cursor, format, var_args);
+	va_end(var_args);
+	return ret;
+}
+
+int liblazy_dbus_message_get_args(DBusMessage *message, const char *format, ...)
+{
+	LiblazyDBusCursor	cursor;
+	va_list			var_args;
+	int			ret;
+
+	if (message == NULL || format == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	/* the caller holds the message, so the cursor needs no reference */
+	liblazy_dbus_cursor_init(&cursor, message);
+
+	va_start(var_args, format);
+	ret = liblazy_dbus_cursor_read(&cursor, format, var_args);
+	va_end(var_args);
+
+	if (TRACE_ENABLED)
+		liblazy_trace_decoded(message, ret);
 	return ret;
 }
@@ -0,0 +1,1229 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* how often the dispatch thread tries to get back a lost connection */
+#define SUBSCRIBE_RECONNECT_INTERVAL	1000
+
+#define SUBSCRIBE_MAX_EVENTS		4
+
+/* the default timeout of libdbus, which does not export it */
+
+#define DBUS_ERROR_MATCH_RULE_INVALID	"org.freedesktop.DBus.Error.MatchRuleInvalid"
+
+#define SUBSCRIBE_MATCH_OWNER_CHANGED	"type='signal',"			\
+					"sender='" DBUS_SERVICE_DBUS "',"	\
+					"interface='" DBUS_INTERFACE_DBUS "',"	\
+					"member='NameOwnerChanged',"		\
+					"arg0='%s'"
+
+/* one key='value' pair of a match rule */
+struct match_key {
+	char	*key;
+	char	*value;
+};
+
+struct subscription {
+	int			id;
+	/* 0 for the system bus, 1 for the session bus */
+	int			bus;
+	char			*rule;
+	struct match_key	*keys;
+	int			key_count;
+	/* the well known name in a sender key, its unique owner and the rule
+	 * telling when it changes. The owner is NULL while it is unknown or
+	 * the name has none */
+	const char		*sender;
+	char			*owner;
+	char			*owner_rule;
+	LiblazySignalCallback	callback;
+	void			*userdata;
+	/* set by liblazy_dbus_unsubscribe with callback_lock held */
+	int			removed;
+	/* held by the list and by deliveries in progress */
+	int			refcount;
+	struct subscription	*next;
+};
+
+/* a signal waiting for liblazy_dbus_dispatch_signals */
+struct queued_signal {
+	int			bus;
+	DBusMessage		*message;
+	struct queued_signal	*next;
+};
+
+/* a method call sent with liblazy_dbus_send_message_async */
+struct async_call {
+	int			bus;
+	DBusMessage		*message;
+	DBusPendingCall		*pending;
+	/* set if statistics were enabled when the call was made */
+	int			timed;
+	struct timespec		started;
+	struct timespec		deadline;
+	LiblazyReplyCallback	callback;
+	void			*userdata;
+	struct async_call	*next;
+	/* the pointer to this call in async_pending */
+	struct async_call	**link;
+};
+
+/* protects everything below */
+static pthread_mutex_t		subscribe_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct subscription	*subscriptions = NULL;
+static int			next_subscription_id = 1;
+/* owned by the dispatch thread, index 0 is the system bus */
+static DBusConnection		*dispatch_connection[2] = { NULL, NULL };
+static int			epoll_fd = -1;
+/* wakes up the dispatch thread if libdbus queued messages on its own */
+static int			wakeup_fd = -1;
+/* -1 as long as callbacks are run from the dispatch thread */
+static int			signal_fd = -1;
+static struct queued_signal	*signal_queue = NULL;
+static struct queued_signal	**signal_queue_tail = &signal_queue;
+/* calls waiting to be sent by the dispatch thread, which sends them
+ * itself so their replies can't be dispatched before it is ready */
+static struct async_call	*async_queue = NULL;
+static struct async_call	**async_queue_tail = &async_queue;
+/* calls waiting for their reply */
+static struct async_call	*async_pending = NULL;
+static int			async_pending_count[2] = { 0, 0 };
+
+/* held while callbacks run, so liblazy_dbus_unsubscribe can wait for them.
+ * Recursive to allow unsubscribing from within a callback */
+static pthread_once_t		callback_lock_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t		callback_lock;
+
+static const int		bus_index[2] = { 0, 1 };
+
+static void liblazy_dbus_callback_lock_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&callback_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void liblazy_dbus_free_subscription(struct subscription *subscription)
+{
+	int i;
+
+	for (i = 0; i < subscription->key_count; i++) {
+		free(subscription->keys[i].key);
+		free(subscription->keys[i].value);
+	}
+	free(subscription->keys);
+	free(subscription->rule);
+	free(subscription->owner);
+	free(subscription->owner_rule);
+	free(subscription);
+}
+
+/* called with subscribe_lock held */
+static void liblazy_dbus_unref_subscription(struct subscription *subscription)
+{
+	if (--subscription->refcount == 0)
+		liblazy_dbus_free_subscription(subscription);
+}
+
+/* splits a match rule into its keys and unquoted values */
+static int liblazy_dbus_parse_rule(struct subscription *subscription,
+				   const char *rule)
+{
+	struct match_key	*keys;
+	const char		*p		= rule;
+	const char		*equals;
+	char			*value;
+	int			quoted;
+
+	while (*p != '\0') {
+		while (*p == ' ')
+			p++;
+		if (*p == '\0')
+			break;
+
+		equals = strchr(p, '=');
+		if (equals == NULL || equals == p)
+			return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+		keys = realloc(subscription->keys, (subscription->key_count + 1) *
+			       sizeof(struct match_key));
+		if (keys == NULL)
+			goto Error;
+		subscription->keys = keys;
+		keys += subscription->key_count;
+		keys->key = strndup(p, equals - p);
+		keys->value = value = malloc(strlen(equals));
+		if (keys->key == NULL || keys->value == NULL) {
+			free(keys->key);
+			free(keys->value);
+			goto Error;
+		}
+		subscription->key_count++;
+
+		quoted = 0;
+		for (p = equals + 1; *p != '\0'; p++) {
+			if (*p == '\'')
+				quoted = !quoted;
+			else if (!quoted && *p == ',')
+				break;
+			else if (!quoted && p[0] == '\\' && p[1] == '\'')
+				*value++ = *++p;
+			else
+				*value++ = *p;
+		}
+		*value = '\0';
+		if (quoted)
+			return LIBLAZY_ERROR_INVALID_ARGUMENT;
+		if (*p == ',')
+			p++;
+	}
+	return 0;
+
+Error:
+	ERROR("Could not allocate match rule: OOM");
+	return LIBLAZY_ERROR_GENERAL;
+}
+
+static const char *liblazy_dbus_message_type_name(int type)
+{
+	switch (type) {
+	case DBUS_MESSAGE_TYPE_METHOD_CALL:
+		return "method_call";
+	case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+		return "method_return";
+	case DBUS_MESSAGE_TYPE_ERROR:
+		return "error";
+	case DBUS_MESSAGE_TYPE_SIGNAL:
+		return "signal";
+	}
+	return "";
+}
+
+static int liblazy_dbus_match_string(const char *field, const char *value)
+{
+	return field != NULL && strcmp(field, value) == 0;
+}
+
+static int liblazy_dbus_match_arg(DBusMessage *message, long n,
+				  const char *value)
+{
+	DBusMessageIter	iter;
+	const char	*arg;
+
+	if (!dbus_message_iter_init(message, &iter))
+		return 0;
+	while (n-- > 0) {
+		if (!dbus_message_iter_next(&iter))
+			return 0;
+	}
+	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
+		return 0;
+	dbus_message_iter_get_basic(&iter, &arg);
+	return strcmp(arg, value) == 0;
+}
+
+static int liblazy_dbus_match_path_namespace(const char *path,
+					     const char *value)
+{
+	size_t length = strlen(value);
+
+	if (path == NULL)
+		return 0;
+	if (strcmp(value, "/") == 0)
+		return 1;
+	return strncmp(path, value, length) == 0 &&
+		(path[length] == '\0' || path[length] == '/');
+}
+
+/* the bus delivers everything matching any rule of the connection, so the
+ * signal is checked against the rule of each subscription again. Well
+ * known sender names are compared to their last known owner, keys not
+ * understood are taken as matching. Called with subscribe_lock held */
+static int liblazy_dbus_subscription_matches(struct subscription *subscription,
+					     DBusMessage *message)
+{
+	struct match_key	*key;
+	const char		*type;
+	const char		*sender;
+	char			*end;
+	long			n;
+	int			match;
+	int			i;
+
+	for (i = 0; i < subscription->key_count; i++) {
+		key = &subscription->keys[i];
+
+		if (strcmp(key->key, "type") == 0) {
+			type = liblazy_dbus_message_type_name(dbus_message_get_type(message));
+			match = strcmp(type, key->value) == 0;
+		} else if (strcmp(key->key, "sender") == 0) {
+			sender = key->value[0] == ':' ? key->value : subscription->owner;
+			match = sender != NULL &&
+				liblazy_dbus_match_string(dbus_message_get_sender(message),
+							  sender);
+		} else if (strcmp(key->key, "interface") == 0)
+			match = liblazy_dbus_match_string(dbus_message_get_interface(message),
+							  key->value);
+		else if (strcmp(key->key, "member") == 0)
+			match = liblazy_dbus_match_string(dbus_message_get_member(message),
+							  key->value);
+		else if (strcmp(key->key, "path") == 0)
+			match = liblazy_dbus_match_string(dbus_message_get_path(message),
+							  key->value);
+		else if (strcmp(key->key, "destination") == 0)
+			match = liblazy_dbus_match_string(dbus_message_get_destination(message),
+							  key->value);
+		else if (strcmp(key->key, "path_namespace") == 0)
+			match = liblazy_dbus_match_path_namespace(dbus_message_get_path(message),
+								  key->value);
+		else if (strncmp(key->key, "arg", 3) == 0) {
+			n = strtol(key->key + 3, &end, 10);
+			/* argNpath and arg0namespace are not checked */
+			match = end == key->key + 3 || *end != '\0' ||
+				liblazy_dbus_match_arg(message, n, key->value);
+		} else
+			match = 1;
+
+		if (!match)
+			return 0;
+	}
+	return 1;
+}
+
+/* runs the callbacks of all subscriptions matching the signal */
+static void liblazy_dbus_deliver_signal(int bus, DBusMessage *message)
+{
+	struct subscription	**matching	= NULL;
+	struct subscription	**grown;
+	struct subscription	*subscription;
+	int			count		= 0;
+	int			size		= 0;
+	int			i;
+
+	pthread_once(&callback_lock_once, liblazy_dbus_callback_lock_init);
+	pthread_mutex_lock(&callback_lock);
+
+	pthread_mutex_lock(&subscribe_lock);
+	for (subscription = subscriptions; subscription != NULL;
+	     subscription = subscription->next) {
+		if (subscription->bus != bus ||
+		    !liblazy_dbus_subscription_matches(subscription, message))
+			continue;
+		if (count == size) {
+			size = size == 0 ? 4 : size * 2;
+			grown = realloc(matching, size * sizeof(struct subscription *));
+			if (grown == NULL) {
+				ERROR("Could not deliver signal: OOM");
+				break;
+			}
+			matching = grown;
+		}
+		subscription->refcount++;
+		matching[count++] = subscription;
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+
+	/* a callback may unsubscribe itself or others */
+	for (i = 0; i < count; i++) {
+		if (!matching[i]->removed)
+			matching[i]->callback(message, matching[i]->userdata);
+	}
+
+	pthread_mutex_lock(&subscribe_lock);
+	for (i = 0; i < count; i++)
+		liblazy_dbus_unref_subscription(matching[i]);
+	pthread_mutex_unlock(&subscribe_lock);
+
+	pthread_mutex_unlock(&callback_lock);
+	free(matching);
+}
+
+/* called with subscribe_lock held */
+static void liblazy_dbus_set_owner(struct subscription *subscription,
+				   const char *owner)
+{
+	free(subscription->owner);
+	/* without memory the signals of the name are dropped */
+	subscription->owner = owner[0] != '\0' ? strdup(owner) : NULL;
+}
+
+/* keeps the owners of well known sender names up to date, in the order
+ * the bus announced the changes. Called from the dispatch thread */
+static void liblazy_dbus_track_owner(int bus, DBusMessage *message)
+{
+	struct subscription	*subscription;
+	const char		*name;
+	const char		*old_owner;
+	const char		*new_owner;
+
+	if (!dbus_message_is_signal(message, DBUS_INTERFACE_DBUS, "NameOwnerChanged") ||
+	    !liblazy_dbus_match_string(dbus_message_get_sender(message),
+				       DBUS_SERVICE_DBUS) ||
+	    !dbus_message_get_args(message, NULL,
+				   DBUS_TYPE_STRING, &name,
+				   DBUS_TYPE_STRING, &old_owner,
+				   DBUS_TYPE_STRING, &new_owner,
+				   DBUS_TYPE_INVALID))
+		return;
+
+	pthread_mutex_lock(&subscribe_lock);
+	for (subscription = subscriptions; subscription != NULL;
+	     subscription = subscription->next) {
+		if (subscription->bus == bus && subscription->sender != NULL &&
+		    strcmp(subscription->sender, name) == 0)
+			liblazy_dbus_set_owner(subscription, new_owner);
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+}
+
+/* run by libdbus from the dispatch thread with the reply to GetNameOwner,
+ * ahead of the changes announced after it */
+static void liblazy_dbus_owner_notify(DBusPendingCall *pending, void *data)
+{
+	struct subscription	*subscription;
+	DBusMessage		*reply;
+	const char		*owner		= "";
+	int			id		= *(int *)data;
+
+	reply = dbus_pending_call_steal_reply(pending);
+	/* an error reply means the name has no owner */
+	if (reply != NULL &&
+	    dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+	    !dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner,
+				   DBUS_TYPE_INVALID))
+		owner = "";
+
+	pthread_mutex_lock(&subscribe_lock);
+	for (subscription = subscriptions; subscription != NULL;
+	     subscription = subscription->next) {
+		if (subscription->id == id) {
+			liblazy_dbus_set_owner(subscription, owner);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+
+	if (reply != NULL)
+		dbus_message_unref(reply);
+}
+
+/* starts following the owner of the well known sender name of the
+ * subscription on a new connection, called with subscribe_lock held */
+static void liblazy_dbus_follow_owner(struct subscription *subscription,
+				      DBusConnection *dbus_connection)
+{
+	DBusPendingCall	*pending	= NULL;
+	DBusMessage	*message;
+	int		*id;
+
+	if (subscription->sender == NULL)
+		return;
+
+	/* the owner is unknown until the reply arrives */
+	free(subscription->owner);
+	subscription->owner = NULL;
+
+	/* the bus handles our messages in order, so it announces every change
+	 * after the reply */
+	dbus_bus_add_match(dbus_connection, subscription->owner_rule, NULL);
+
+	message = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+					       DBUS_INTERFACE_DBUS, "GetNameOwner");
+	id = malloc(sizeof(int));
+	if (message == NULL || id == NULL ||
+	    !dbus_message_append_args(message,
+				      DBUS_TYPE_STRING, &subscription->sender,
+				      DBUS_TYPE_INVALID) ||
+	    !dbus_connection_send_with_reply(dbus_connection, message, &pending, -1) ||
+	    pending == NULL) {
+		ERROR("Could not look up the owner of %s: OOM", subscription->sender);
+		free(id);
+		goto Out;
+	}
+
+	*id = subscription->id;
+	if (!dbus_pending_call_set_notify(pending, liblazy_dbus_owner_notify,
+					  id, free)) {
+		ERROR("Could not look up the owner of %s: OOM", subscription->sender);
+		dbus_pending_call_cancel(pending);
+		free(id);
+	}
+	dbus_pending_call_unref(pending);
+
+Out:
+	if (message != NULL)
+		dbus_message_unref(message);
+}
+
+static DBusHandlerResult liblazy_dbus_subscribe_filter(DBusConnection *dbus_connection,
+						       DBusMessage *message,
+						       void *data)
+{
+	struct queued_signal	*queued;
+	int			bus		= *(const int *)data;
+	uint64_t		one		= 1;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	liblazy_dbus_track_owner(bus, message);
+
+	pthread_mutex_lock(&subscribe_lock);
+	if (signal_fd < 0) {
+		pthread_mutex_unlock(&subscribe_lock);
+		liblazy_dbus_deliver_signal(bus, message);
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	queued = malloc(sizeof(struct queued_signal));
+	if (queued == NULL) {
+		ERROR("Could not queue signal: OOM");
+	} else {
+		queued->bus = bus;
+		queued->message = dbus_message_ref(message);
+		queued->next = NULL;
+		*signal_queue_tail = queued;
+		signal_queue_tail = &queued->next;
+		if (write(signal_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			ERROR("Could not wake up signal fd: %s", strerror(errno));
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* libdbus read messages for us while another thread waited for a reply on
+ * the connection, so the socket won't tell about them */
+static void liblazy_dbus_subscribe_wakeup(DBusConnection *dbus_connection,
+					  DBusDispatchStatus status,
+					  void *data)
+{
+	uint64_t one = 1;
+
+	if (status == DBUS_DISPATCH_DATA_REMAINS &&
+	    write(wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		ERROR("Could not wake up dispatch thread: %s", strerror(errno));
+}
+
+/* opens a connection for bus, called without subscribe_lock as it waits
+ * for the bus */
+static DBusConnection *liblazy_dbus_subscribe_open(int bus)
+{
+	DBusConnection	*dbus_connection;
+	DBusError	dbus_error;
+
+	dbus_error_init(&dbus_error);
+	dbus_connection = liblazy_dbus_open_private(bus == 0 ? DBUS_BUS_SYSTEM :
+						    DBUS_BUS_SESSION, &dbus_error);
+	if (dbus_connection == NULL) {
+		if (dbus_error_is_set(&dbus_error)) {
+			ERROR("Connection to dbus failed: %s", dbus_error.message);
+			dbus_error_free(&dbus_error);
+		}
+		return NULL;
+	}
+
+	if (!dbus_connection_add_filter(dbus_connection, liblazy_dbus_subscribe_filter,
+					(void *)&bus_index[bus], NULL)) {
+		ERROR("Could not watch connection");
+		dbus_connection_close(dbus_connection);
+		dbus_connection_unref(dbus_connection);
+		return NULL;
+	}
+	dbus_connection_set_dispatch_status_function(dbus_connection,
+						     liblazy_dbus_subscribe_wakeup,
+						     NULL, NULL);
+	return dbus_connection;
+}
+
+static void liblazy_dbus_subscribe_close(int bus, DBusConnection *dbus_connection)
+{
+	dbus_connection_remove_filter(dbus_connection, liblazy_dbus_subscribe_filter,
+				      (void *)&bus_index[bus]);
+	dbus_connection_close(dbus_connection);
+	dbus_connection_unref(dbus_connection);
+}
+
+/* makes an opened connection the one of bus and adds the rules of all its
+ * subscriptions, taking over the reference. The connection is dropped if
+ * another thread was faster. Called with subscribe_lock held */
+static int liblazy_dbus_subscribe_install(int bus, DBusConnection *dbus_connection)
+{
+	struct subscription	*subscription;
+	struct epoll_event	event;
+	int			fd;
+
+	if (dispatch_connection[bus] != NULL) {
+		liblazy_dbus_subscribe_close(bus, dbus_connection);
+		return 0;
+	}
+
+	if (!dbus_connection_get_unix_fd(dbus_connection, &fd)) {
+		ERROR("Could not watch connection");
+		goto Error;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		ERROR("Could not watch connection: %s", strerror(errno));
+		goto Error;
+	}
+
+	/* the rules were lost together with the old connection */
+	for (subscription = subscriptions; subscription != NULL;
+	     subscription = subscription->next) {
+		if (subscription->bus != bus)
+			continue;
+		dbus_bus_add_match(dbus_connection, subscription->rule, NULL);
+		liblazy_dbus_follow_owner(subscription, dbus_connection);
+	}
+
+	dispatch_connection[bus] = dbus_connection;
+	return 0;
+
+Error:
+	liblazy_dbus_subscribe_close(bus, dbus_connection);
+	return LIBLAZY_ERROR_GENERAL;
+}
+
+/* returns a new reference to the connection of bus, connecting if there is
+ * none. Called without subscribe_lock */
+static DBusConnection *liblazy_dbus_subscribe_connect(int bus)
+{
+	DBusConnection *dbus_connection;
+
+	pthread_mutex_lock(&subscribe_lock);
+	dbus_connection = dispatch_connection[bus];
+	if (dbus_connection != NULL)
+		dbus_connection_ref(dbus_connection);
+	pthread_mutex_unlock(&subscribe_lock);
+	if (dbus_connection != NULL)
+		return dbus_connection;
+
+	dbus_connection = liblazy_dbus_subscribe_open(bus);
+	if (dbus_connection == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&subscribe_lock);
+	liblazy_dbus_subscribe_install(bus, dbus_connection);
+	dbus_connection = dispatch_connection[bus];
+	if (dbus_connection != NULL)
+		dbus_connection_ref(dbus_connection);
+	pthread_mutex_unlock(&subscribe_lock);
+	return dbus_connection;
+}
+
+/* called with subscribe_lock held */
+static void liblazy_dbus_subscribe_disconnect(int bus)
+{
+	DBusConnection	*dbus_connection	= dispatch_connection[bus];
+	int		fd;
+
+	if (dbus_connection_get_unix_fd(dbus_connection, &fd))
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	dispatch_connection[bus] = NULL;
+	liblazy_dbus_subscribe_close(bus, dbus_connection);
+}
+
+/* returns 1 if bus has subscriptions but lost its connection, called with
+ * subscribe_lock held */
+static int liblazy_dbus_subscribe_needs_connection(int bus)
+{
+	struct subscription *subscription;
+
+	struct async_call	*call;
+
+	if (dispatch_connection[bus] != NULL)
+		return 0;
+	for (subscription = subscriptions; subscription != NULL;
+	     subscription = subscription->next) {
+		if (subscription->bus == bus)
+			return 1;
+	}
+	for (call = async_queue; call != NULL; call = call->next) {
+		if (call->bus == bus)
+			return 1;
+	}
+	return 0;
+}
+
+/* called with subscribe_lock held */
+static void liblazy_dbus_async_unlink(struct async_call *call)
+{
+	*call->link = call->next;
+	if (call->next != NULL)
+		call->next->link = call->link;
+	call->next = NULL;
+	async_pending_count[call->bus]--;
+}
+
+/* removes the calls for bus from the queue, at most max of them, or those
+ * past their deadline if bus is -1. Called with subscribe_lock held */
+static struct async_call *liblazy_dbus_async_dequeue(int bus, int max)
+{
+	struct async_call	**link;
+	struct async_call	*calls		= NULL;
+	struct async_call	**tail		= &calls;
+	struct async_call	*call;
+
+	for (link = &async_queue; *link != NULL;) {
+		call = *link;
+		if (max == 0 || (bus < 0 ? !liblazy_deadline_passed(&call->deadline) :
+				 call->bus != bus)) {
+			link = &call->next;
+			continue;
+		}
+		*link = call->next;
+		call->next = NULL;
+		*tail = call;
+		tail = &call->next;
+		max--;
+	}
+	async_queue_tail = link;
+	return calls;
+}
+
+/* runs the callback and frees the call, reply is unreffed */
+static void liblazy_dbus_async_finish(struct async_call *call,
+				      DBusMessage *reply, int error)
+{
+	DBusError	dbus_error;
+	const char	*error_name	= NULL;
+
+	if (reply != NULL && dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+		dbus_error_init(&dbus_error);
+		dbus_set_error_from_message(&dbus_error, reply);
+		error = liblazy_dbus_error_code(&dbus_error);
+		dbus_error_free(&dbus_error);
+		error_name = dbus_message_get_error_name(reply);
+	}
+
+	if (call->timed)
+		liblazy_stats_record(call->message, error ? NULL : reply, 1,
+				     &call->started, error, error_name);
+	if (TRACE_ENABLED)
+		liblazy_trace_call(error ? LIBLAZY_TRACE_ERROR : LIBLAZY_TRACE_REPLY,
+				   call->message, error);
+
+	call->callback(reply, error, call->userdata);
+
+	if (reply != NULL)
+		dbus_message_unref(reply);
+	if (call->pending != NULL)
+		dbus_pending_call_unref(call->pending);
+	dbus_message_unref(call->message);
+	free(call);
+}
+
+/* run by libdbus from the dispatch thread */
+static void liblazy_dbus_async_notify(DBusPendingCall *pending, void *data)
+{
+	struct async_call *call = data;
+
+	pthread_mutex_lock(&subscribe_lock);
+	liblazy_dbus_async_unlink(call);
+	pthread_mutex_unlock(&subscribe_lock);
+
+	liblazy_dbus_async_finish(call, dbus_pending_call_steal_reply(pending), 0);
+}
+
+/* sends the calls queued for bus, as many as may be in flight */
+static void liblazy_dbus_async_start(int bus)
+{
+	struct async_call	*calls;
+	struct async_call	*call;
+	struct async_call	*next;
+	DBusConnection		*dbus_connection;
+
+	pthread_mutex_lock(&subscribe_lock);
+	dbus_connection = dispatch_connection[bus];
+	/* without a connection they all fail */
+	calls = liblazy_dbus_async_dequeue(bus, dbus_connection == NULL ? -1 :
+					   LIBLAZY_DBUS_MAX_PENDING - async_pending_count[bus]);
+	if (dbus_connection != NULL)
+		dbus_connection_ref(dbus_connection);
+	pthread_mutex_unlock(&subscribe_lock);
+
+	for (call = calls; call != NULL; call = next) {
+		next = call->next;
+		/* the deadline is kept by the dispatch thread */
+		if (dbus_connection == NULL ||
+		    !dbus_connection_send_with_reply(dbus_connection, call->message,
+						     &call->pending, INT32_MAX) ||
+		    call->pending == NULL) {
+			liblazy_dbus_async_finish(call, NULL, LIBLAZY_ERROR_DBUS_NOT_READY);
+			continue;
+		}
+		if (TRACE_ENABLED)
+			liblazy_trace_call(LIBLAZY_TRACE_CALL_START, call->message, 0);
+
+		pthread_mutex_lock(&subscribe_lock);
+		call->next = async_pending;
+		if (async_pending != NULL)
+			async_pending->link = &call->next;
+		call->link = &async_pending;
+		async_pending = call;
+		async_pending_count[bus]++;
+		pthread_mutex_unlock(&subscribe_lock);
+
+		dbus_pending_call_set_notify(call->pending, liblazy_dbus_async_notify,
+					     call, NULL);
+	}
+
+	if (dbus_connection != NULL) {
+		if (calls != NULL)
+			dbus_connection_flush(dbus_connection);
+		dbus_connection_unref(dbus_connection);
+	}
+}
+
+/* fails the pending calls of bus, or the queued and pending calls past
+ * their deadline if bus is -1. Returns the milliseconds until the next
+ * deadline, -1 if there is none */
+static int liblazy_dbus_async_fail(int bus, int error)
+{
+	struct async_call	*failed		= NULL;
+	struct async_call	*expired	= NULL;
+	struct async_call	*call;
+	struct async_call	*next;
+	long			remaining;
+	long			timeout		= -1;
+
+	pthread_mutex_lock(&subscribe_lock);
+	if (bus < 0) {
+		expired = liblazy_dbus_async_dequeue(-1, -1);
+		for (call = async_queue; call != NULL; call = call->next) {
+			remaining = liblazy_deadline_remaining(&call->deadline) + 1;
+			if (timeout < 0 || remaining < timeout)
+				timeout = remaining;
+		}
+	}
+	for (call = async_pending; call != NULL; call = next) {
+		next = call->next;
+		if (bus < 0 ? liblazy_deadline_passed(&call->deadline) :
+		    call->bus == bus) {
+			liblazy_dbus_async_unlink(call);
+			call->next = failed;
+			failed = call;
+		} else if (bus < 0) {
+			/* rounded up, waking up early would spin */
+			remaining = liblazy_deadline_remaining(&call->deadline) + 1;
+			if (timeout < 0 || remaining < timeout)
+				timeout = remaining;
+		}
+	}
+	pthread_mutex_unlock(&subscribe_lock);
+
+	for (call = expired; call != NULL; call = next) {
+		next = call->next;
+		liblazy_dbus_async_finish(call, NULL, error);
+	}
+	for (call = failed; call != NULL; call = next) {
+		next = call->next;
+		dbus_pending_call_cancel(call->pending);
+		liblazy_dbus_async_finish(call, NULL, error);
+	}
+	return timeout;
+}
+
+static void *liblazy_dbus_dispatch_thread(void *data)
+{
+	struct epoll_event	events[SUBSCRIBE_MAX_EVENTS];
+	DBusConnection		*dbus_connection;
+	uint64_t		value;
+	int			timeout		= -1;
+	int			needs_connection;
+	int			deadline;
+	int			count;
+	int			bus;
+	int			i;
+
+	for (;;) {
+		count = epoll_wait(epoll_fd, events, SUBSCRIBE_MAX_EVENTS, timeout);
+		if (count < 0 && errno != EINTR) {
+			ERROR("Could not wait for signals: %s", strerror(errno));
+			break;
+		}
+		for (i = 0; i < count; i++) {
+			if (events[i].data.fd == wakeup_fd &&
+			    read(wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+				ERROR("Could not read wakeup fd: %s", strerror(errno));
+		}
+
+		timeout = -1;
+		for (bus = 0; bus < 2; bus++) {
+			pthread_mutex_lock(&subscribe_lock);
+			dbus_connection = dispatch_connection[bus];
+			if (dbus_connection != NULL)
+				dbus_connection_ref(dbus_connection);
+			pthread_mutex_unlock(&subscribe_lock);
+
+			/* reading without subscribe_lock, callbacks may
+			 * subscribe */
+			if (dbus_connection != NULL) {
+				if (!liblazy_dbus_dispatch_watch(dbus_connection)) {
+					pthread_mutex_lock(&subscribe_lock);
+					if (dispatch_connection[bus] == dbus_connection)
+						liblazy_dbus_subscribe_disconnect(bus);
+					pthread_mutex_unlock(&subscribe_lock);
+					/* their replies can't arrive anymore */
+					liblazy_dbus_async_fail(bus, LIBLAZY_ERROR_DBUS_NOT_READY);
+				}
+				dbus_connection_unref(dbus_connection);
+			}
+
+			pthread_mutex_lock(&subscribe_lock);
+			needs_connection = liblazy_dbus_subscribe_needs_connection(bus);
+			pthread_mutex_unlock(&subscribe_lock);
+
+			if (needs_connection) {
+				dbus_connection = liblazy_dbus_subscribe_connect(bus);
+				if (dbus_connection != NULL)
+					dbus_connection_unref(dbus_connection);
+				else
+					timeout = SUBSCRIBE_RECONNECT_INTERVAL;
+			}
+
+			liblazy_dbus_async_start(bus);
+		}
+
+		deadline = liblazy_dbus_async_fail(-1, LIBLAZY_ERROR_DBUS_TIMEOUT);
+		if (deadline >= 0 && (timeout < 0 || deadline < timeout))
+			timeout = deadline;
+	}
+	return NULL;
+}
+
+/* starts the dispatch thread, called with subscribe_lock held */
+static int liblazy_dbus_start_dispatch(void)
+{
+	struct epoll_event	event;
+	pthread_t		thread;
+
+	if (epoll_fd >= 0)
+		return 0;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		ERROR("Could not create epoll fd: %s", strerror(errno));
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeup_fd < 0) {
+		ERROR("Could not create eventfd: %s", strerror(errno));
+		goto Error;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = wakeup_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event) != 0) {
+		ERROR("Could not watch eventfd: %s", strerror(errno));
+		goto Error;
+	}
+
+	if (pthread_create(&thread, NULL, liblazy_dbus_dispatch_thread, NULL) != 0) {
+		ERROR("Could not start dispatch thread");
+		goto Error;
+	}
+	pthread_detach(thread);
+	return 0;
+
+Error:
+	if (wakeup_fd >= 0)
+		close(wakeup_fd);
+	close(epoll_fd);
+	wakeup_fd = epoll_fd = -1;
+	return LIBLAZY_ERROR_GENERAL;
+}
+
+/* finds a well known name in the sender key of the rule, whose owner has to
+ * be followed to check signals against the rule */
+static int liblazy_dbus_parse_sender(struct subscription *subscription)
+{
+	int i;
+
+	for (i = 0; i < subscription->key_count; i++) {
+		if (strcmp(subscription->keys[i].key, "sender") == 0 &&
+		    subscription->keys[i].value[0] != ':')
+			break;
+	}
+	if (i == subscription->key_count)
+		return 0;
+
+	subscription->sender = subscription->keys[i].value;
+	subscription->owner_rule = malloc(sizeof(SUBSCRIBE_MATCH_OWNER_CHANGED) +
+					  strlen(subscription->sender));
+	if (subscription->owner_rule == NULL) {
+		ERROR("Could not allocate match rule: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	sprintf(subscription->owner_rule, SUBSCRIBE_MATCH_OWNER_CHANGED,
+		subscription->sender);
+	return 0;
+}
+
+int liblazy_dbus_subscribe(int bus_type, const char *match_rule,
+			   LiblazySignalCallback callback, void *userdata)
+{
+	struct subscription	*subscription;
+	DBusConnection		*dbus_connection;
+	DBusError		dbus_error;
+	int			bus;
+	int			ret;
+
+	if ((bus_type != DBUS_BUS_SYSTEM && bus_type != DBUS_BUS_SESSION) ||
+	    match_rule == NULL || callback == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	bus = bus_type == DBUS_BUS_SYSTEM ? 0 : 1;
+
+	subscription = calloc(1, sizeof(struct subscription));
+	if (subscription == NULL) {
+		ERROR("Could not allocate subscription: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	subscription->bus = bus;
+	subscription->callback = callback;
+	subscription->userdata = userdata;
+	subscription->refcount = 1;
+	subscription->rule = strdup(match_rule);
+	if (subscription->rule == NULL) {
+		ERROR("Could not allocate subscription: OOM");
+		liblazy_dbus_free_subscription(subscription);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	ret = liblazy_dbus_parse_rule(subscription, match_rule);
+	if (ret == 0)
+		ret = liblazy_dbus_parse_sender(subscription);
+	if (ret != 0)
+		goto Error;
+
+	pthread_mutex_lock(&subscribe_lock);
+	ret = liblazy_dbus_start_dispatch();
+	pthread_mutex_unlock(&subscribe_lock);
+	if (ret != 0)
+		goto Error;
+
+	/* connecting and checking the rule wait for the bus, other threads
+	 * keep subscribing and receiving signals meanwhile */
+	dbus_connection = liblazy_dbus_subscribe_connect(bus);
+	if (dbus_connection == NULL) {
+		ret = LIBLAZY_ERROR_DBUS_NOT_READY;
+		goto Error;
+	}
+
+	dbus_error_init(&dbus_error);
+	dbus_bus_add_match(dbus_connection, match_rule, &dbus_error);
+	if (dbus_error_is_set(&dbus_error)) {
+		ERROR("Could not add match rule '%s': %s", match_rule,
+		      dbus_error.message);
+		if (dbus_error_has_name(&dbus_error, DBUS_ERROR_MATCH_RULE_INVALID))
+			ret = LIBLAZY_ERROR_INVALID_ARGUMENT;
+		else
+			ret = liblazy_dbus_error_code(&dbus_error);
+		dbus_error_free(&dbus_error);
+		dbus_connection_unref(dbus_connection);
+		goto Error;
+	}
+
+	pthread_mutex_lock(&subscribe_lock);
+	subscription->id = next_subscription_id++;
+	subscription->next = subscriptions;
+	subscriptions = subscription;
+	ret = subscription->id;
+
+	/* the dispatch thread may have replaced a lost connection meanwhile,
+	 * before it knew about the subscription */
+	if (dispatch_connection[bus] != NULL &&
+	    dispatch_connection[bus] != dbus_connection)
+		dbus_bus_add_match(dispatch_connection[bus], match_rule, NULL);
+	if (dispatch_connection[bus] != NULL)
+		liblazy_dbus_follow_owner(subscription, dispatch_connection[bus]);
+	pthread_mutex_unlock(&subscribe_lock);
+
+	dbus_connection_unref(dbus_connection);
+	return ret;
+
+Error:
+	liblazy_dbus_free_subscription(subscription);
+	return ret;
+}
+
+int liblazy_dbus_unsubscribe(int subscription_id)
+{
+	struct subscription	**link;
+	struct subscription	*subscription;
+	int			ret		= LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	/* waits for callbacks running in other threads */
+	pthread_once(&callback_lock_once, liblazy_dbus_callback_lock_init);
+	pthread_mutex_lock(&callback_lock);
+	pthread_mutex_lock(&subscribe_lock);
+
+	for (link = &subscriptions; *link != NULL; link = &(*link)->next) {
+		subscription = *link;
+		if (subscription->id != subscription_id)
+			continue;
+
+		*link = subscription->next;
+		subscription->removed = 1;
+		if (dispatch_connection[subscription->bus] != NULL) {
+			dbus_bus_remove_match(dispatch_connection[subscription->bus],
+					      subscription->rule, NULL);
+			if (subscription->owner_rule != NULL)
+				dbus_bus_remove_match(dispatch_connection[subscription->bus],
+						      subscription->owner_rule, NULL);
+		}
+		liblazy_dbus_unref_subscription(subscription);
+		ret = 0;
+		break;
+	}
+
+	pthread_mutex_unlock(&subscribe_lock);
+	pthread_mutex_unlock(&callback_lock);
+	return ret;
+}
+
+int liblazy_dbus_get_signal_fd(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&subscribe_lock);
+	if (signal_fd < 0) {
+		signal_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (signal_fd < 0)
+			ERROR("Could not create eventfd: %s", strerror(errno));
+	}
+	ret = signal_fd < 0 ? LIBLAZY_ERROR_GENERAL : signal_fd;
+	pthread_mutex_unlock(&subscribe_lock);
+	return ret;
+}
+
+int liblazy_dbus_dispatch_signals(void)
+{
+	struct queued_signal	*queued;
+	struct queued_signal	*next;
+	uint64_t		value;
+	int			count		= 0;
+
+	pthread_mutex_lock(&subscribe_lock);
+	if (signal_fd >= 0 && read(signal_fd, &value, sizeof(value)) < 0 &&
+	    errno != EAGAIN)
+		ERROR("Could not read signal fd: %s", strerror(errno));
+	queued = signal_queue;
+	signal_queue = NULL;
+	signal_queue_tail = &signal_queue;
+	pthread_mutex_unlock(&subscribe_lock);
+
+	for (; queued != NULL; queued = next) {
+		next = queued->next;
+		liblazy_dbus_deliver_signal(queued->bus, queued->message);
+		dbus_message_unref(queued->message);
+		free(queued);
+		count++;
+	}
+	return count;
+}
+
+static int liblazy_dbus_send_message_async(int bus_type, DBusMessage *message,
+					   int timeout,
+					   LiblazyReplyCallback callback,
+					   void *userdata)
+{
+	struct async_call	*call;
+	uint64_t		one		= 1;
+	int			ret;
+
+	if (message == NULL || callback == NULL ||
+	    dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	call = calloc(1, sizeof(struct async_call));
+	if (call == NULL) {
+		ERROR("Could not allocate call: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	call->bus = bus_type == DBUS_BUS_SYSTEM ? 0 : 1;
+	call->message = dbus_message_ref(message);
+	call->callback = callback;
+	call->userdata = userdata;
+	call->timed = liblazy_stats_enabled;
+	if (call->timed)
+		liblazy_stats_start(&call->started);
+
+	timeout = liblazy_dbus_get_timeout(timeout);
+	if (timeout < 0)
+		timeout = LIBLAZY_DBUS_DEFAULT_TIMEOUT;
+	liblazy_deadline_set(&call->deadline, timeout);
+
+	pthread_mutex_lock(&subscribe_lock);
+	ret = liblazy_dbus_start_dispatch();
+	if (ret != 0) {
+		pthread_mutex_unlock(&subscribe_lock);
+		dbus_message_unref(call->message);
+		free(call);
+		return ret;
+	}
+
+	*async_queue_tail = call;
+	async_queue_tail = &call->next;
+	if (write(wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		ERROR("Could not wake up dispatch thread: %s", strerror(errno));
+	pthread_mutex_unlock(&subscribe_lock);
+	return 0;
+}
+
+int liblazy_dbus_system_send_message_async(DBusMessage *message, int timeout,
+					   LiblazyReplyCallback callback,
+					   void *userdata)
+{
+	return liblazy_dbus_send_message_async(DBUS_BUS_SYSTEM, message, timeout,
+					       callback, userdata);
+}
+
+int liblazy_dbus_session_send_message_async(DBusMessage *message, int timeout,
+					    LiblazyReplyCallback callback,
+					    void *userdata)
+{
+	return liblazy_dbus_send_message_async(DBUS_BUS_SESSION, message, timeout,
+					       callback, userdata);
+}
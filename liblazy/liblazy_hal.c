@@ -29,83 +29,251 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 
-#define DBUS_HAL_SERVICE		"org.freedesktop.Hal"
-#define DBUS_HAL_DEVICE_INTERFACE	"org.freedesktop.Hal.Device"
-#define DBUS_HAL_MANAGER_PATH		"/org/freedesktop/Hal/Manager"
-#define DBUS_HAL_MANAGER_INTERFACE	"org.freedesktop.Hal.Manager"
-#define DBUS_HAL_COMPUTER_PATH		"/org/freedesktop/Hal/devices/computer"
+/* number of slots of the missing property cache, power of two */
+#define HAL_MISSING_CACHE_SIZE		64
 
-static int liblazy_hal_property_exists(const char *udi, const char *property)
+struct missing_property {
+	char		*udi;
+	char		*property;
+	struct timespec	expires;
+};
+
+static pthread_mutex_t		missing_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct missing_property	missing_cache[HAL_MISSING_CACHE_SIZE];
+static int			missing_cache_timeout = 1000;
+
+void liblazy_hal_set_missing_property_timeout(int msec)
 {
-	int		error	= 0;
-	int		exists	= 0;
-	DBusMessage	*reply;
+	int i;
+
+	pthread_mutex_lock(&missing_cache_lock);
+	missing_cache_timeout = msec > 0 ? msec : 0;
+	if (!missing_cache_timeout) {
+		for (i = 0; i < HAL_MISSING_CACHE_SIZE; i++) {
+			free(missing_cache[i].udi);
+			free(missing_cache[i].property);
+			missing_cache[i].udi = NULL;
+			missing_cache[i].property = NULL;
+		}
+	}
+	pthread_mutex_unlock(&missing_cache_lock);
+}
 
-	if (udi == NULL || property == NULL)
-		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+static unsigned int liblazy_hal_missing_slot(const char *udi, const char *property)
+{
+	unsigned int hash = 5381;
 
-	error = liblazy_dbus_system_send_method_call(DBUS_HAL_SERVICE,
-						     udi,
-						     DBUS_HAL_DEVICE_INTERFACE,
-						     "PropertyExists",
-						     &reply,
-						     DBUS_TYPE_STRING,
-						     &property,
-						     DBUS_TYPE_INVALID);
+	while (*udi != '\0')
+		hash = hash * 33 + (unsigned char)*udi++;
+	while (*property != '\0')
+		hash = hash * 33 + (unsigned char)*property++;
+	return hash & (HAL_MISSING_CACHE_SIZE - 1);
+}
 
-	if (error) {
-		ERROR("Error checking if property '%s' exists", property);
-		return error;
+int liblazy_hal_is_missing(const char *udi, const char *property)
+{
+	struct missing_property	*entry;
+	int			missing	= 0;
+
+	pthread_mutex_lock(&missing_cache_lock);
+	if (!missing_cache_timeout)
+		goto Unlock;
+
+	entry = &missing_cache[liblazy_hal_missing_slot(udi, property)];
+	if (entry->udi == NULL || strcmp(entry->udi, udi) != 0 ||
+	    strcmp(entry->property, property) != 0)
+		goto Unlock;
+
+	missing = !liblazy_deadline_passed(&entry->expires);
+Unlock:
+	pthread_mutex_unlock(&missing_cache_lock);
+	return missing;
+}
+
+static void liblazy_hal_set_missing(const char *udi, const char *property)
+{
+	struct missing_property	*entry;
+
+	pthread_mutex_lock(&missing_cache_lock);
+	if (!missing_cache_timeout)
+		goto Unlock;
+
+	entry = &missing_cache[liblazy_hal_missing_slot(udi, property)];
+	free(entry->udi);
+	free(entry->property);
+	entry->udi = strdup(udi);
+	entry->property = strdup(property);
+	if (entry->udi == NULL || entry->property == NULL) {
+		free(entry->udi);
+		free(entry->property);
+		entry->udi = NULL;
+		entry->property = NULL;
+		goto Unlock;
 	}
 
-	error = liblazy_dbus_message_get_basic_arg(reply, DBUS_TYPE_BOOLEAN,
-						   &exists, 0);
-	if (reply != NULL)
-		dbus_message_unref(reply);
-	if (exists == 1)
-		return 1;
-	return error;
+	liblazy_deadline_set(&entry->expires, missing_cache_timeout);
+Unlock:
+	pthread_mutex_unlock(&missing_cache_lock);
 }
 
-static int liblazy_hal_get_property(const char *udi, const char *property,
-				    const char *method, int type, void *value)
+DBusMessage *liblazy_hal_new_property_call(const char *udi, const char *property,
+					  const char *method)
 {
+	DBusMessage *message;
+
+	message = dbus_message_new_method_call(DBUS_HAL_SERVICE, udi,
+					       DBUS_HAL_DEVICE_INTERFACE,
+					       method);
+	if (message == NULL) {
+		ERROR("Could not create method call %s: OOM", method);
+		return NULL;
+	}
+	if (!dbus_message_append_args(message,
+				      DBUS_TYPE_STRING, &property,
+				      DBUS_TYPE_INVALID)) {
+		ERROR("Could not append property '%s': OOM", property);
+		dbus_message_unref(message);
+		return NULL;
+	}
+	return message;
+}
+
+int liblazy_hal_property_error(const char *udi, const char *property,
+			       const char *method, DBusError *dbus_error)
+{
+	if (dbus_error_has_name(dbus_error, DBUS_HAL_ERROR_NO_SUCH_PROPERTY)) {
+		liblazy_hal_set_missing(udi, property);
+		return LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+	}
+
+	if (dbus_error_has_name(dbus_error, DBUS_HAL_ERROR_TYPE_MISMATCH)) {
+		ERROR("Property '%s' of %s is not fetched by %s", property, udi,
+		      method);
+		return LIBLAZY_ERROR_HAL_TYPE_MISMATCH;
+	}
+
+	ERROR("Error sending '%s' to HAL: %s", method, dbus_error->message);
+	return liblazy_dbus_error_code(dbus_error);
+}
+
+/* sends one of the GetProperty* methods directly. A missing property is
+ * reported by HAL with an error reply, so no PropertyExists round trip is
+ * needed up front */
+static int liblazy_hal_get_property_reply(const char *udi, const char *property,
+					  const char *method, DBusMessage **reply)
+{
+	DBusError	dbus_error;
+	DBusMessage	*message;
 	int		error = 0;
-	DBusMessage	*reply;
 
-	if (udi == NULL || property == NULL )
+	if (udi == NULL || property == NULL)
 		return LIBLAZY_ERROR_INVALID_ARGUMENT;
 
-	error = liblazy_dbus_system_send_method_call(DBUS_HAL_SERVICE,
-						     udi,
-						     DBUS_HAL_DEVICE_INTERFACE,
-						     method,
-						     &reply,
-						     DBUS_TYPE_STRING,
-						     &property,
-						     DBUS_TYPE_INVALID);	
+	if (liblazy_hal_is_missing(udi, property))
+		return LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
 
-	if (error) {
+	message = liblazy_hal_new_property_call(udi, property, method);
+	if (message == NULL)
+		return LIBLAZY_ERROR_GENERAL;
+
+	dbus_error_init(&dbus_error);
+	error = liblazy_dbus_send_message(DBUS_BUS_SYSTEM, message, reply,
+					  -1, NULL, &dbus_error);
+	dbus_message_unref(message);
+
+	if (dbus_error_is_set(&dbus_error)) {
+		error = liblazy_hal_property_error(udi, property, method,
+						   &dbus_error);
+		dbus_error_free(&dbus_error);
+	} else if (error)
 		ERROR("Error sending '%s' to HAL", method);
+
+	return error;
+}
+
+static int liblazy_hal_get_property(const char *udi, const char *property,
+				    const char *method, int type, void *value)
+{
+	int			error = 0;
+	DBusMessage		*reply;
+	LiblazyHalProperties	*properties;
+
+	error = liblazy_hal_snapshot_get_property(udi, property, type, NULL, value);
+	if (error != LIBLAZY_HAL_SNAPSHOT_MISS)
+		return error;
+
+	if (liblazy_hal_cache_is_enabled()) {
+		error = liblazy_hal_cache_get_properties(udi, &properties);
+		if (error)
+			return error;
+		if (type == DBUS_TYPE_BOOLEAN)
+			error = liblazy_hal_properties_get_bool(properties,
+								property, value);
+		else
+			error = liblazy_hal_properties_get_int(properties,
+							       property, value);
+		liblazy_hal_free_properties(properties);
 		return error;
 	}
 
+	error = liblazy_hal_get_property_reply(udi, property, method, &reply);
+	if (error)
+		return error;
+
 	error = liblazy_dbus_message_get_basic_arg(reply, type, value, 0);
-	if (reply != NULL)
-		dbus_message_unref(reply);
 	if (error)
 		ERROR("Error fetching property '%s'", property);
+	dbus_message_unref(reply);
+	return error;
+}
+
+/* gets the string list of the message held by the reply. If copy is not
+ * NULL, it is decoded straight into a list of its own stored there
+ * instead of being borrowed */
+static int liblazy_hal_decode_strlist(LiblazyReply *reply,
+				      const char ***strlist, char ***copy)
+{
+	DBusMessageIter	iter;
+	int		error	= 0;
+
+	dbus_message_iter_init(reply->message, &iter);
+	if (copy == NULL)
+		return liblazy_reply_get_strlist(reply, &iter, strlist);
+
+	*copy = liblazy_dbus_get_strlist_from_array(&iter);
+	if (*copy == NULL)
+		error = LIBLAZY_ERROR_GENERAL;
+	if (TRACE_ENABLED)
+		liblazy_trace_decoded(reply->message, error);
 	return error;
 }
 
-static int liblazy_hal_get_strlist_manager(char ***strlist, const char *method,
+/* key and value describe the query for liblazy_hal_snapshot_find, copy is
+ * passed to liblazy_hal_decode_strlist */
+static int liblazy_hal_get_strlist_manager(LiblazyReply *reply,
+					   const char ***strlist, char ***copy,
+					   const char *key, const char *value,
+					   const char *method,
 					   int first_arg_type, ...)
 {
 	int		error	= 0;
-	DBusMessage	*reply;
+	DBusMessage	*message;
 	va_list		var_args;
 
+	if (reply == NULL || strlist == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	*strlist = NULL;
+	liblazy_reply_clear(reply);
+
+	/* the snapshot knows all devices, so it answers on its own */
+	error = liblazy_hal_snapshot_find(key, value, reply, strlist);
+	if (error != LIBLAZY_HAL_SNAPSHOT_MISS)
+		return error;
+
 	va_start(var_args, first_arg_type);
 
 	error = liblazy_dbus_send_method_call(DBUS_HAL_SERVICE,
@@ -113,7 +281,7 @@ static int liblazy_hal_get_strlist_manager(char ***strlist, const char *method,
 					      DBUS_HAL_MANAGER_INTERFACE,
 					      method,
 					      DBUS_BUS_SYSTEM,
-					      &reply,
+					      &message, -1, NULL,
 					      first_arg_type,
 					      var_args);
 	va_end(var_args);
@@ -123,33 +291,71 @@ static int liblazy_hal_get_strlist_manager(char ***strlist, const char *method,
 		return error;
 	}
 
-	error = liblazy_dbus_message_get_strlist_arg(reply, strlist, 0);
-	if (reply != NULL)
-		dbus_message_unref(reply);
-	return error;
+	liblazy_reply_set_message(reply, message);
+	return liblazy_hal_decode_strlist(reply, strlist, copy);
 }
 
-int liblazy_hal_get_property_string(const char *udi, const char *property,
-				    char **value)
+int liblazy_hal_get_property_string_borrowed(const char *udi, const char *property,
+					     LiblazyReply *reply, const char **value)
 {
-	char	*str;
-	int	ret;
+	int			ret;
+	DBusMessage		*message;
+	LiblazyHalProperties	*properties;
 
-	ret = liblazy_hal_property_exists(udi, property);
-	if (ret != 1) {
-		if (ret == 0)
-			ret = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
-		goto Error;
+	if (reply == NULL || value == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	*value = NULL;
+	liblazy_reply_clear(reply);
+
+	ret = liblazy_hal_snapshot_get_property(udi, property, DBUS_TYPE_STRING,
+						reply, value);
+	if (ret != LIBLAZY_HAL_SNAPSHOT_MISS)
+		return ret;
+
+	if (liblazy_hal_cache_is_enabled()) {
+		ret = liblazy_hal_cache_get_properties(udi, &properties);
+		if (ret)
+			return ret;
+		liblazy_reply_set_properties(reply, properties);
+		return liblazy_hal_properties_get_string(properties, property, value);
+	}
+
+	ret = liblazy_hal_get_property_reply(udi, property, "GetPropertyString",
+					     &message);
+	if (ret)
+		return ret;
+	liblazy_reply_set_message(reply, message);
+
+	ret = liblazy_dbus_message_get_basic_arg(message, DBUS_TYPE_STRING, value, 0);
+	if (ret) {
+		ERROR("Error fetching property '%s'", property);
+		*value = NULL;
 	}
+	return ret;
+}
+
+int liblazy_hal_get_property_string(const char *udi, const char *property,
+				    char **value)
+{
+	int		ret;
+	const char	*str;
+	LiblazyReply	reply = LIBLAZY_REPLY_INIT;
 
-	ret = liblazy_hal_get_property(udi, property, "GetPropertyString",
-				       DBUS_TYPE_STRING, &str);
+	ret = liblazy_hal_get_property_string_borrowed(udi, property, &reply, &str);
 	if (ret)
 		goto Error;
 
+	/* the string belongs to the reply, so copy it before dropping it */
 	*value = strdup(str);
+	liblazy_reply_release(&reply);
+	if (*value == NULL) {
+		ERROR("Could not copy property '%s': OOM", property);
+		return LIBLAZY_ERROR_GENERAL;
+	}
 	return ret;
 Error:
+	liblazy_reply_release(&reply);
 	*value = NULL;
 	return ret;
 }
@@ -159,16 +365,11 @@ int liblazy_hal_get_property_int(const char *udi, const char *property,
 {
 	int ret;
 
-	ret = liblazy_hal_property_exists(udi, property);
-	if (ret != 1) {
-		if (ret == 0)
-			ret = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+	ret = liblazy_hal_get_property(udi, property, "GetPropertyInteger",
+				       DBUS_TYPE_INT32, value);
+	if (ret)
 		*value = -1;
-		return ret;
-	}
-
-	return liblazy_hal_get_property(udi, property, "GetPropertyInteger",
-					DBUS_TYPE_INT32, value);
+	return ret;
 }
 
 int liblazy_hal_get_property_bool(const char *udi, const char *property,
@@ -176,158 +377,139 @@ int liblazy_hal_get_property_bool(const char *udi, const char *property,
 {
 	int ret;
 
-	ret = liblazy_hal_property_exists(udi, property);
-	if (ret != 1) {
-		if (ret == 0)
-			ret = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+	ret = liblazy_hal_get_property(udi, property, "GetPropertyBoolean",
+				       DBUS_TYPE_BOOLEAN, value);
+	if (ret)
 		*value = -1;
-		return ret;
-	}
-
-	return liblazy_hal_get_property(udi, property, "GetPropertyBoolean",
-					DBUS_TYPE_BOOLEAN, value);
+	return ret;
 }
 
-int liblazy_hal_get_property_strlist(const char *udi, const char *property,
-				     char ***strlist)
+/* copy is passed to liblazy_hal_decode_strlist */
+static int liblazy_hal_get_property_strlist_reply(const char *udi,
+						  const char *property,
+						  LiblazyReply *reply,
+						  const char ***strlist,
+						  char ***copy)
 {
-	int		error	= 0;
-	DBusMessage	*reply;
+	int			error	= 0;
+	DBusMessage		*message;
+	LiblazyHalProperties	*properties;
 
-	if (udi == NULL || property == NULL )
+	if (reply == NULL || strlist == NULL)
 		return LIBLAZY_ERROR_INVALID_ARGUMENT;
 
-	error = liblazy_hal_property_exists(udi, property);
-	if (error != 1) {
-		if (error == 0)
-			error = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
-		goto Error;
-	}
+	*strlist = NULL;
+	liblazy_reply_clear(reply);
 
-	error = liblazy_dbus_system_send_method_call(DBUS_HAL_SERVICE,
-						     udi,
-						     DBUS_HAL_DEVICE_INTERFACE,
-						     "GetPropertyStringList",
-						     &reply,
-						     DBUS_TYPE_STRING,
-						     &property,
-						     DBUS_TYPE_INVALID);	
+	error = liblazy_hal_snapshot_get_property(udi, property, DBUS_TYPE_ARRAY,
+						  reply, strlist);
+	if (error != LIBLAZY_HAL_SNAPSHOT_MISS)
+		return error;
 
-	if (error) {
-		ERROR("Error while getting strlist property %s from HAL", property);
-		goto Error;
+	if (liblazy_hal_cache_is_enabled()) {
+		error = liblazy_hal_cache_get_properties(udi, &properties);
+		if (error)
+			return error;
+		liblazy_reply_set_properties(reply, properties);
+		return liblazy_hal_properties_get_strlist(properties, property,
+							  strlist);
 	}
 
-	error = liblazy_dbus_message_get_strlist_arg(reply, strlist, 0);
-	if (reply != NULL)
-		dbus_message_unref(reply);
+	error = liblazy_hal_get_property_reply(udi, property,
+					       "GetPropertyStringList", &message);
 	if (error)
-		goto Error;
-	return error;
- 
-Error:
-	strlist[0] = NULL;
-	return error;
+		return error;
+	liblazy_reply_set_message(reply, message);
+	return liblazy_hal_decode_strlist(reply, strlist, copy);
 }
 
-int liblazy_hal_query_capability(const char *udi, const char *capability)
+int liblazy_hal_get_property_strlist_borrowed(const char *udi, const char *property,
+					      LiblazyReply *reply, const char ***strlist)
 {
-	int	i;
-	int	error	= -1;
-	char	**caps	= NULL;
-
-	if (udi == NULL || capability == NULL )
-		return LIBLAZY_ERROR_INVALID_ARGUMENT;
-
-	error = liblazy_hal_get_property_strlist(udi, "info.capabilities", &caps);
-	if (error)
-		return error;
-
-	if (caps != NULL) {
-		for (i = 0; caps[i] != NULL; i++) {
-			if (strcmp(caps[i], capability) == 0)
-				error = 1;
-		}
-		liblazy_free_strlist(caps);
-	}
-
-	return error;
+	return liblazy_hal_get_property_strlist_reply(udi, property, reply,
+						      strlist, NULL);
 }
 
-int liblazy_hal_find_device_by_capability(const char *capability, char ***strlist)
+/* lists from D-Bus were decoded into *strlist already, those borrowed
+ * from the snapshot or the cache still have to be copied before the reply
+ * living on the stack is dropped */
+static int liblazy_hal_copy_strlist(LiblazyReply *reply, int error,
+				    const char **borrowed, char ***strlist)
 {
-	int error;
-	error = liblazy_hal_get_strlist_manager(strlist, "FindDeviceByCapability",
-						DBUS_TYPE_STRING, &capability,
-						DBUS_TYPE_INVALID);
+	if (error == 0 && *strlist == NULL &&
+	    (*strlist = liblazy_strlist_copy(borrowed)) == NULL)
+		error = LIBLAZY_ERROR_GENERAL;
 	if (error) {
-		strlist[0] = NULL;
+		liblazy_free_strlist(*strlist);
 		*strlist = NULL;
 	}
+	liblazy_reply_release(reply);
 	return error;
-
 }
 
-int liblazy_hal_find_device_by_string_match(const char *key, const char *value,
-					    char ***strlist)
+int liblazy_hal_get_property_strlist(const char *udi, const char *property,
+				     char ***strlist)
 {
-	int error;
-	error = liblazy_hal_get_strlist_manager(strlist, "FindDeviceStringMatch",
-						DBUS_TYPE_STRING, &key,
-						DBUS_TYPE_STRING, &value, DBUS_TYPE_INVALID);
-	if (error) {
-		strlist[0] = NULL;
-		*strlist = NULL;
-	}
-	return error;
+	int		error;
+	const char	**borrowed	= NULL;
+	LiblazyReply	reply		= LIBLAZY_REPLY_INIT;
+
+	*strlist = NULL;
+	error = liblazy_hal_get_property_strlist_reply(udi, property, &reply,
+						       &borrowed, strlist);
+	return liblazy_hal_copy_strlist(&reply, error, borrowed, strlist);
 }
 
-int liblazy_hal_is_caller_privileged(const char *privilege)
+int liblazy_hal_find_device_by_capability_borrowed(const char *capability,
+						   LiblazyReply *reply,
+						   const char ***strlist)
 {
-	DBusMessage	*reply;
-	DBusError	dbus_error;
-	DBusConnection	*dbus_connection;
-	const char	*unique_name;
-	char		*allowed;
-	int		error = 0;
-
-	if (privilege == NULL )
-		return LIBLAZY_ERROR_INVALID_ARGUMENT;
-
-	dbus_error_init(&dbus_error);
-
-	dbus_connection = dbus_bus_get(DBUS_BUS_SYSTEM, &dbus_error);
-	if (dbus_error_is_set(&dbus_error)) {
-		ERROR("Connection to dbus not ready, skipping privilege "
-		      "lookup for privilege %s: %s\n",
-		      privilege, dbus_error.message);
-		dbus_error_free(&dbus_error);
-		return LIBLAZY_ERROR_DBUS_NOT_READY;
-	}
-
-	unique_name = dbus_bus_get_unique_name(dbus_connection);
-
-	error = liblazy_dbus_system_send_method_call(DBUS_HAL_SERVICE,
-						     DBUS_HAL_COMPUTER_PATH,
-						     DBUS_HAL_DEVICE_INTERFACE,
-						     "IsCallerPrivileged",
-						     &reply,
-						     DBUS_TYPE_STRING, &privilege, 
-						     DBUS_TYPE_STRING, &unique_name, 
-						     DBUS_TYPE_INVALID);
+	return liblazy_hal_get_strlist_manager(reply, strlist, NULL, NULL,
+					       capability,
+					       "FindDeviceByCapability",
+					       DBUS_TYPE_STRING, &capability,
+					       DBUS_TYPE_INVALID);
+}
 
-	if (error)
-		return error;
+int liblazy_hal_find_device_by_capability(const char *capability, char ***strlist)
+{
+	int		error;
+	const char	**borrowed	= NULL;
+	LiblazyReply	reply		= LIBLAZY_REPLY_INIT;
+
+	*strlist = NULL;
+	error = liblazy_hal_get_strlist_manager(&reply, &borrowed, strlist, NULL,
+						capability,
+						"FindDeviceByCapability",
+						DBUS_TYPE_STRING, &capability,
+						DBUS_TYPE_INVALID);
+	return liblazy_hal_copy_strlist(&reply, error, borrowed, strlist);
+}
 
-	error = liblazy_dbus_message_get_basic_arg(reply, DBUS_TYPE_STRING,
-						   &allowed, 0);
+int liblazy_hal_find_device_by_string_match_borrowed(const char *key,
+						     const char *value,
+						     LiblazyReply *reply,
+						     const char ***strlist)
+{
+	return liblazy_hal_get_strlist_manager(reply, strlist, NULL, key, value,
+					       "FindDeviceStringMatch",
+					       DBUS_TYPE_STRING, &key,
+					       DBUS_TYPE_STRING, &value,
+					       DBUS_TYPE_INVALID);
+}
 
-	if (reply != NULL)
-		dbus_message_unref(reply);
-	if (error)
-		return error;
+int liblazy_hal_find_device_by_string_match(const char *key, const char *value,
+					    char ***strlist)
+{
+	int		error;
+	const char	**borrowed	= NULL;
+	LiblazyReply	reply		= LIBLAZY_REPLY_INIT;
 
-	if (strcmp(allowed, "yes") == 0)
-		return 1;
-	return 0;
+	*strlist = NULL;
+	error = liblazy_hal_get_strlist_manager(&reply, &borrowed, strlist, key,
+						value, "FindDeviceStringMatch",
+						DBUS_TYPE_STRING, &key,
+						DBUS_TYPE_STRING, &value,
+						DBUS_TYPE_INVALID);
+	return liblazy_hal_copy_strlist(&reply, error, borrowed, strlist);
 }
@@ -0,0 +1,298 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct batch_entry {
+	char		*udi;
+	char		*property;
+	int		type;
+	int		error;
+	DBusMessage	*reply;
+};
+
+struct _LiblazyHalBatch {
+	struct batch_entry	*entries;
+	int			count;
+	int			size;
+};
+
+static const char *liblazy_hal_batch_method(int type)
+{
+	switch (type) {
+	case DBUS_TYPE_INT32:
+		return "GetPropertyInteger";
+	case DBUS_TYPE_BOOLEAN:
+		return "GetPropertyBoolean";
+	case DBUS_TYPE_STRING:
+		return "GetPropertyString";
+	default:
+		return "GetPropertyStringList";
+	}
+}
+
+LiblazyHalBatch *liblazy_hal_batch_new(void)
+{
+	return calloc(1, sizeof(LiblazyHalBatch));
+}
+
+static void liblazy_hal_batch_clear_results(LiblazyHalBatch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->count; i++) {
+		if (batch->entries[i].reply != NULL)
+			dbus_message_unref(batch->entries[i].reply);
+		batch->entries[i].reply = NULL;
+		batch->entries[i].error = LIBLAZY_ERROR_GENERAL;
+	}
+}
+
+void liblazy_hal_batch_free(LiblazyHalBatch *batch)
+{
+	int i;
+
+	if (batch == NULL)
+		return;
+
+	liblazy_hal_batch_clear_results(batch);
+	for (i = 0; i < batch->count; i++) {
+		free(batch->entries[i].udi);
+		free(batch->entries[i].property);
+	}
+	free(batch->entries);
+	free(batch);
+}
+
+static int liblazy_hal_batch_add(LiblazyHalBatch *batch, const char *udi,
+				 const char *property, int type)
+{
+	struct batch_entry	*entry;
+	struct batch_entry	*entries;
+	int			size;
+
+	if (batch == NULL || udi == NULL || property == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (batch->count == batch->size) {
+		size = batch->size ? batch->size * 2 : 16;
+		entries = realloc(batch->entries, size * sizeof(struct batch_entry));
+		if (entries == NULL) {
+			ERROR("Could not grow batch: OOM");
+			return LIBLAZY_ERROR_GENERAL;
+		}
+		batch->entries = entries;
+		batch->size = size;
+	}
+
+	entry = &batch->entries[batch->count];
+	entry->udi = strdup(udi);
+	entry->property = strdup(property);
+	if (entry->udi == NULL || entry->property == NULL) {
+		ERROR("Could not add '%s' to batch: OOM", property);
+		free(entry->udi);
+		free(entry->property);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	entry->type = type;
+	entry->error = LIBLAZY_ERROR_GENERAL;
+	entry->reply = NULL;
+
+	return batch->count++;
+}
+
+int liblazy_hal_batch_add_int(LiblazyHalBatch *batch, const char *udi,
+			      const char *property)
+{
+	return liblazy_hal_batch_add(batch, udi, property, DBUS_TYPE_INT32);
+}
+
+int liblazy_hal_batch_add_bool(LiblazyHalBatch *batch, const char *udi,
+			       const char *property)
+{
+	return liblazy_hal_batch_add(batch, udi, property, DBUS_TYPE_BOOLEAN);
+}
+
+int liblazy_hal_batch_add_string(LiblazyHalBatch *batch, const char *udi,
+				 const char *property)
+{
+	return liblazy_hal_batch_add(batch, udi, property, DBUS_TYPE_STRING);
+}
+
+int liblazy_hal_batch_add_strlist(LiblazyHalBatch *batch, const char *udi,
+				  const char *property)
+{
+	return liblazy_hal_batch_add(batch, udi, property, DBUS_TYPE_ARRAY);
+}
+
+int liblazy_hal_batch_execute(LiblazyHalBatch *batch)
+{
+	struct batch_entry	*entry;
+	DBusMessage		**messages;
+	DBusMessage		**replies;
+	DBusError		*errors;
+	int			*index;
+	int			count	= 0;
+	int			ret	= 0;
+	int			i;
+
+	if (batch == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	liblazy_hal_batch_clear_results(batch);
+	if (batch->count == 0)
+		return 0;
+
+	messages = malloc(batch->count * sizeof(DBusMessage *));
+	replies = malloc(batch->count * sizeof(DBusMessage *));
+	errors = malloc(batch->count * sizeof(DBusError));
+	index = malloc(batch->count * sizeof(int));
+	if (messages == NULL || replies == NULL || errors == NULL || index == NULL) {
+		ERROR("Could not allocate batch: OOM");
+		ret = LIBLAZY_ERROR_GENERAL;
+		goto Free;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		entry = &batch->entries[i];
+		if (liblazy_hal_is_missing(entry->udi, entry->property)) {
+			entry->error = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+			continue;
+		}
+		messages[count] = liblazy_hal_new_property_call(entry->udi,
+								entry->property,
+								liblazy_hal_batch_method(entry->type));
+		if (messages[count] == NULL)
+			continue;
+		dbus_error_init(&errors[count]);
+		index[count++] = i;
+	}
+
+	ret = liblazy_dbus_send_messages(DBUS_BUS_SYSTEM, messages, count,
+					 replies, errors);
+
+	for (i = 0; i < count; i++) {
+		entry = &batch->entries[index[i]];
+		if (ret == 0) {
+			if (dbus_error_is_set(&errors[i]))
+				entry->error = liblazy_hal_property_error(entry->udi,
+									  entry->property,
+									  liblazy_hal_batch_method(entry->type),
+									  &errors[i]);
+			else {
+				entry->reply = replies[i];
+				entry->error = 0;
+			}
+		} else
+			entry->error = ret;
+		dbus_error_free(&errors[i]);
+		dbus_message_unref(messages[i]);
+	}
+
+Free:
+	free(messages);
+	free(replies);
+	free(errors);
+	free(index);
+	return ret;
+}
+
+static struct batch_entry *liblazy_hal_batch_get(LiblazyHalBatch *batch,
+						 int index, int type)
+{
+	if (batch == NULL || index < 0 || index >= batch->count ||
+	    batch->entries[index].type != type)
+		return NULL;
+	return &batch->entries[index];
+}
+
+static int liblazy_hal_batch_get_basic(LiblazyHalBatch *batch, int index,
+				       int type, void *value)
+{
+	struct batch_entry *entry;
+
+	entry = liblazy_hal_batch_get(batch, index, type);
+	if (entry == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	if (entry->error)
+		return entry->error;
+
+	return liblazy_dbus_message_get_basic_arg(entry->reply, type, value, 0);
+}
+
+int liblazy_hal_batch_get_int(LiblazyHalBatch *batch, int index, int *value)
+{
+	int ret;
+
+	ret = liblazy_hal_batch_get_basic(batch, index, DBUS_TYPE_INT32, value);
+	if (ret)
+		*value = -1;
+	return ret;
+}
+
+int liblazy_hal_batch_get_bool(LiblazyHalBatch *batch, int index, int *value)
+{
+	int ret;
+
+	ret = liblazy_hal_batch_get_basic(batch, index, DBUS_TYPE_BOOLEAN, value);
+	if (ret)
+		*value = -1;
+	return ret;
+}
+
+int liblazy_hal_batch_get_string(LiblazyHalBatch *batch, int index, char **value)
+{
+	const char	*str;
+	int		ret;
+
+	ret = liblazy_hal_batch_get_basic(batch, index, DBUS_TYPE_STRING, &str);
+	if (ret) {
+		*value = NULL;
+		return ret;
+	}
+
+	*value = strdup(str);
+	return 0;
+}
+
+int liblazy_hal_batch_get_strlist(LiblazyHalBatch *batch, int index,
+				  char ***strlist)
+{
+	struct batch_entry *entry;
+
+	*strlist = NULL;
+	entry = liblazy_hal_batch_get(batch, index, DBUS_TYPE_ARRAY);
+	if (entry == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	if (entry->error)
+		return entry->error;
+
+	return liblazy_dbus_message_get_strlist_arg(entry->reply, strlist, 0);
+}
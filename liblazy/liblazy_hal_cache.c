@@ -0,0 +1,346 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* number of hash buckets for cached devices, power of two */
+#define HAL_CACHE_BUCKETS	256
+
+#define HAL_MATCH_PROPERTY_MODIFIED	"type='signal',"			\
+					"sender='" DBUS_HAL_SERVICE "',"	\
+					"interface='" DBUS_HAL_DEVICE_INTERFACE "'," \
+					"member='PropertyModified'"
+#define HAL_MATCH_DEVICE_REMOVED	"type='signal',"			\
+					"sender='" DBUS_HAL_SERVICE "',"	\
+					"interface='" DBUS_HAL_MANAGER_INTERFACE "'," \
+					"member='DeviceRemoved'"
+
+struct cached_device {
+	char			*udi;
+	LiblazyHalProperties	*properties;
+	struct cached_device	*next;
+};
+
+/* protects everything below. The signal filter only runs from
+ * liblazy_hal_cache_update(), so it is always called with the lock held.
+ * Cache misses are fetched without it */
+static pthread_mutex_t		cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cached_device	*cache[HAL_CACHE_BUCKETS];
+/* bumped by every invalidation, a fetch is only cached if nothing was
+ * invalidated while it was in flight */
+static unsigned int		cache_generation = 0;
+/* connection used to fetch the properties and to receive the signals
+ * invalidating them, so both arrive in order */
+static DBusConnection		*cache_connection = NULL;
+static int			use_property_cache = 0;
+
+static unsigned int liblazy_hal_cache_bucket(const char *udi)
+{
+	unsigned int hash = 5381;
+
+	while (*udi != '\0')
+		hash = hash * 33 + (unsigned char)*udi++;
+	return hash & (HAL_CACHE_BUCKETS - 1);
+}
+
+static void liblazy_hal_cache_remove(const char *udi)
+{
+	struct cached_device	**link;
+	struct cached_device	*device;
+
+	/* even if the device is not cached yet, it may be in flight */
+	cache_generation++;
+	for (link = &cache[liblazy_hal_cache_bucket(udi)]; *link != NULL;
+	     link = &(*link)->next) {
+		device = *link;
+		if (strcmp(device->udi, udi) == 0) {
+			*link = device->next;
+			liblazy_hal_free_properties(device->properties);
+			free(device->udi);
+			free(device);
+			return;
+		}
+	}
+}
+
+static void liblazy_hal_cache_flush(void)
+{
+	struct cached_device	*device;
+	int			i;
+
+	cache_generation++;
+	for (i = 0; i < HAL_CACHE_BUCKETS; i++) {
+		while (cache[i] != NULL) {
+			device = cache[i];
+			cache[i] = device->next;
+			liblazy_hal_free_properties(device->properties);
+			free(device->udi);
+			free(device);
+		}
+	}
+}
+
+static DBusHandlerResult liblazy_hal_cache_filter(DBusConnection *connection,
+						  DBusMessage *message,
+						  void *user_data)
+{
+	const char *udi;
+
+	if (dbus_message_is_signal(message, DBUS_HAL_DEVICE_INTERFACE,
+				   "PropertyModified")) {
+		liblazy_hal_cache_remove(dbus_message_get_path(message));
+		liblazy_hal_capability_forget(dbus_message_get_path(message));
+	} else if (dbus_message_is_signal(message, DBUS_HAL_MANAGER_INTERFACE,
+					  "DeviceRemoved")) {
+		if (dbus_message_get_args(message, NULL,
+					  DBUS_TYPE_STRING, &udi,
+					  DBUS_TYPE_INVALID)) {
+			liblazy_hal_cache_remove(udi);
+			liblazy_hal_capability_forget(udi);
+		}
+	} else if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS,
+					  "NameOwnerChanged")) {
+		/* HAL restarted, nothing we know is valid anymore */
+		liblazy_hal_cache_flush();
+		liblazy_hal_capability_flush();
+	} else
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void liblazy_hal_cache_disconnect(void)
+{
+	if (cache_connection == NULL)
+		return;
+	liblazy_dbus_close_watch(cache_connection, liblazy_hal_cache_filter);
+	cache_connection = NULL;
+	liblazy_hal_cache_flush();
+}
+
+static int liblazy_hal_cache_connect(void)
+{
+	static const char * const	rules[] = {
+		HAL_MATCH_PROPERTY_MODIFIED,
+		HAL_MATCH_DEVICE_REMOVED,
+		DBUS_HAL_MATCH_NAME_OWNER_CHANGED,
+		NULL
+	};
+	DBusError			dbus_error;
+
+	dbus_error_init(&dbus_error);
+
+	cache_connection = liblazy_dbus_open_watch(DBUS_BUS_SYSTEM, rules,
+						   liblazy_hal_cache_filter,
+						   &dbus_error);
+	if (cache_connection == NULL) {
+		ERROR("Could not subscribe to HAL signals, not caching properties: %s",
+		      dbus_error.message);
+		dbus_error_free(&dbus_error);
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+	}
+	return 0;
+}
+
+/* applies all invalidations that arrived since the last call */
+static int liblazy_hal_cache_update(void)
+{
+	if (cache_connection != NULL &&
+	    !liblazy_dbus_dispatch_watch(cache_connection))
+		liblazy_hal_cache_disconnect();
+
+	if (cache_connection == NULL)
+		return liblazy_hal_cache_connect();
+	return 0;
+}
+
+/* fetches the properties of a device, called without cache_lock. The
+ * signals arriving meanwhile stay queued for liblazy_hal_cache_update */
+static int liblazy_hal_cache_fetch(DBusConnection *dbus_connection,
+				   const char *udi,
+				   LiblazyHalProperties **properties)
+{
+	DBusError	dbus_error;
+	DBusMessage	*message;
+	DBusMessage	*reply;
+	int		ret;
+
+	message = dbus_message_new_method_call(DBUS_HAL_SERVICE, udi,
+					       DBUS_HAL_DEVICE_INTERFACE,
+					       "GetAllProperties");
+	if (message == NULL) {
+		ERROR("Could not create method call GetAllProperties: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	dbus_error_init(&dbus_error);
+	ret = liblazy_dbus_send_message_on(dbus_connection, message, &reply, -1,
+					   &dbus_error);
+	dbus_message_unref(message);
+	if (ret) {
+		ERROR("Could not fetch properties of %s: %s", udi,
+		      dbus_error_is_set(&dbus_error) ? dbus_error.message :
+		      "no reply");
+		dbus_error_free(&dbus_error);
+		return ret;
+	}
+
+	*properties = liblazy_hal_properties_new_from_reply(reply);
+	dbus_message_unref(reply);
+	if (*properties == NULL)
+		return LIBLAZY_ERROR_GENERAL;
+	return 0;
+}
+
+/* returns the cached device or NULL, called with cache_lock held */
+static struct cached_device *liblazy_hal_cache_lookup(const char *udi)
+{
+	struct cached_device *device;
+
+	for (device = cache[liblazy_hal_cache_bucket(udi)]; device != NULL;
+	     device = device->next) {
+		if (strcmp(device->udi, udi) == 0)
+			break;
+	}
+	return device;
+}
+
+/* caches a fetched property table, taking over the reference. Called with
+ * cache_lock held */
+static void liblazy_hal_cache_insert(const char *udi,
+				     LiblazyHalProperties *properties)
+{
+	struct cached_device	*device;
+	unsigned int		bucket;
+
+	device = malloc(sizeof(struct cached_device));
+	if (device == NULL || (device->udi = strdup(udi)) == NULL) {
+		/* not cached, it is fetched again next time */
+		free(device);
+		liblazy_hal_free_properties(properties);
+		return;
+	}
+	device->properties = properties;
+
+	bucket = liblazy_hal_cache_bucket(udi);
+	device->next = cache[bucket];
+	cache[bucket] = device;
+}
+
+void liblazy_hal_flush_property_cache(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	liblazy_hal_cache_flush();
+	pthread_mutex_unlock(&cache_lock);
+	liblazy_hal_capability_flush();
+}
+
+void liblazy_hal_use_property_cache(int use_cache)
+{
+	pthread_mutex_lock(&cache_lock);
+	use_property_cache = use_cache;
+	if (!use_property_cache)
+		liblazy_hal_cache_disconnect();
+	pthread_mutex_unlock(&cache_lock);
+}
+
+int liblazy_hal_cache_is_enabled(void)
+{
+	int enabled;
+
+	pthread_mutex_lock(&cache_lock);
+	enabled = use_property_cache;
+	pthread_mutex_unlock(&cache_lock);
+	return enabled;
+}
+
+void liblazy_hal_cache_peek_properties(const char *udi,
+				       LiblazyHalProperties **properties)
+{
+	struct cached_device *device = NULL;
+
+	pthread_mutex_lock(&cache_lock);
+	if (use_property_cache && liblazy_hal_cache_update() == 0)
+		device = liblazy_hal_cache_lookup(udi);
+	*properties = device != NULL ?
+		liblazy_hal_properties_ref(device->properties) : NULL;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+int liblazy_hal_cache_get_properties(const char *udi,
+				     LiblazyHalProperties **properties)
+{
+	struct cached_device	*device;
+	DBusConnection		*dbus_connection;
+	unsigned int		generation;
+	int			ret;
+
+	if (udi == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	pthread_mutex_lock(&cache_lock);
+
+	ret = liblazy_hal_cache_update();
+	if (ret)
+		goto Unlock;
+
+	device = liblazy_hal_cache_lookup(udi);
+	if (device != NULL) {
+		/* the table may be dropped from the cache while the caller
+		 * uses it */
+		*properties = liblazy_hal_properties_ref(device->properties);
+		goto Unlock;
+	}
+
+	/* a miss is a round trip, other threads keep using the cache
+	 * meanwhile */
+	dbus_connection = dbus_connection_ref(cache_connection);
+	generation = cache_generation;
+	pthread_mutex_unlock(&cache_lock);
+
+	ret = liblazy_hal_cache_fetch(dbus_connection, udi, properties);
+	dbus_connection_unref(dbus_connection);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&cache_lock);
+	/* signals queued behind the reply may already make it stale */
+	if (liblazy_hal_cache_update() == 0 && generation == cache_generation) {
+		device = liblazy_hal_cache_lookup(udi);
+		if (device == NULL)
+			liblazy_hal_cache_insert(udi,
+						 liblazy_hal_properties_ref(*properties));
+	}
+
+Unlock:
+	pthread_mutex_unlock(&cache_lock);
+	return ret;
+}
@@ -0,0 +1,320 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+/* number of hash buckets for indexed devices, power of two */
+#define HAL_CAPABILITY_BUCKETS	256
+
+#define BITS_PER_WORD		(sizeof(unsigned long) * CHAR_BIT)
+
+struct capability_device {
+	char				*udi;
+	struct timespec			expires;
+	/* bit n is set if the device has the capability interned as n */
+	int				words;
+	unsigned long			*bits;
+	struct capability_device	*next;
+};
+
+/* protects everything below */
+static pthread_mutex_t		capability_lock = PTHREAD_MUTEX_INITIALIZER;
+/* interned capability names, the index of a name is its bit. There are
+ * only a few dozen distinct capabilities, so names are never dropped */
+static char			**capability_names = NULL;
+static int			capability_count = 0;
+static int			capability_names_size = 0;
+/* open addressing table of indices into capability_names plus one, zero
+ * marks an empty slot */
+static int			*capability_hash = NULL;
+static int			capability_hash_size = 0;
+static struct capability_device	*capability_devices[HAL_CAPABILITY_BUCKETS];
+static int			capability_timeout = 1000;
+/* bumped whenever devices are forgotten, so capabilities fetched before
+ * are not indexed anymore */
+static unsigned int		capability_generation = 0;
+
+static unsigned int liblazy_hal_capability_hash(const char *string)
+{
+	unsigned int hash = 5381;
+
+	while (*string != '\0')
+		hash = hash * 33 + (unsigned char)*string++;
+	return hash;
+}
+
+/* returns the bit of an interned capability or -1 */
+static int liblazy_hal_capability_find(const char *name)
+{
+	unsigned int	slot;
+	int		id;
+
+	if (capability_hash_size == 0)
+		return -1;
+
+	slot = liblazy_hal_capability_hash(name) & (capability_hash_size - 1);
+	while ((id = capability_hash[slot]) != 0) {
+		if (strcmp(capability_names[id - 1], name) == 0)
+			return id - 1;
+		slot = (slot + 1) & (capability_hash_size - 1);
+	}
+	return -1;
+}
+
+static void liblazy_hal_capability_hash_insert(int *hash, int size, int id)
+{
+	unsigned int slot;
+
+	slot = liblazy_hal_capability_hash(capability_names[id]) & (size - 1);
+	while (hash[slot] != 0)
+		slot = (slot + 1) & (size - 1);
+	hash[slot] = id + 1;
+}
+
+/* returns the bit of a capability, interning it if needed, or -1 on OOM */
+static int liblazy_hal_capability_intern(const char *name)
+{
+	char	**names;
+	int	*hash;
+	int	size;
+	int	id;
+
+	id = liblazy_hal_capability_find(name);
+	if (id >= 0)
+		return id;
+
+	if (capability_count == capability_names_size) {
+		size = capability_names_size ? capability_names_size * 2 : 32;
+		names = realloc(capability_names, size * sizeof(char *));
+		if (names == NULL)
+			return -1;
+		capability_names = names;
+		capability_names_size = size;
+	}
+
+	/* keep the table at most half full */
+	if ((capability_count + 1) * 2 > capability_hash_size) {
+		size = capability_hash_size ? capability_hash_size * 2 : 64;
+		hash = calloc(size, sizeof(int));
+		if (hash == NULL)
+			return -1;
+		for (id = 0; id < capability_count; id++)
+			liblazy_hal_capability_hash_insert(hash, size, id);
+		free(capability_hash);
+		capability_hash = hash;
+		capability_hash_size = size;
+	}
+
+	capability_names[capability_count] = strdup(name);
+	if (capability_names[capability_count] == NULL)
+		return -1;
+	liblazy_hal_capability_hash_insert(capability_hash, capability_hash_size,
+					   capability_count);
+	return capability_count++;
+}
+
+static void liblazy_hal_capability_free_device(struct capability_device *device)
+{
+	free(device->udi);
+	free(device->bits);
+	free(device);
+}
+
+static void liblazy_hal_capability_remove(const char *udi)
+{
+	struct capability_device	**link;
+	struct capability_device	*device;
+
+	for (link = &capability_devices[liblazy_hal_capability_hash(udi) &
+					(HAL_CAPABILITY_BUCKETS - 1)];
+	     *link != NULL; link = &(*link)->next) {
+		device = *link;
+		if (strcmp(device->udi, udi) == 0) {
+			*link = device->next;
+			liblazy_hal_capability_free_device(device);
+			return;
+		}
+	}
+}
+
+static void liblazy_hal_capability_clear(void)
+{
+	struct capability_device	*device;
+	int				i;
+
+	for (i = 0; i < HAL_CAPABILITY_BUCKETS; i++) {
+		while (capability_devices[i] != NULL) {
+			device = capability_devices[i];
+			capability_devices[i] = device->next;
+			liblazy_hal_capability_free_device(device);
+		}
+	}
+}
+
+/* returns 1 or 0 if the device is indexed and -1 if it has to be fetched */
+static int liblazy_hal_capability_test(const char *udi, const char *capability)
+{
+	struct capability_device	*device;
+	int				id;
+
+	for (device = capability_devices[liblazy_hal_capability_hash(udi) &
+					 (HAL_CAPABILITY_BUCKETS - 1)];
+	     device != NULL; device = device->next) {
+		if (strcmp(device->udi, udi) == 0)
+			break;
+	}
+	if (device == NULL)
+		return -1;
+
+	if (liblazy_deadline_passed(&device->expires)) {
+		liblazy_hal_capability_remove(udi);
+		return -1;
+	}
+
+	/* a name that was never interned is not a capability of any device */
+	id = liblazy_hal_capability_find(capability);
+	if (id < 0 || id / BITS_PER_WORD >= device->words)
+		return 0;
+	return (device->bits[id / BITS_PER_WORD] >> (id % BITS_PER_WORD)) & 1;
+}
+
+static void liblazy_hal_capability_add(const char *udi, const char **caps)
+{
+	struct capability_device	*device;
+	unsigned int			bucket;
+	int				i;
+	int				id;
+
+	for (i = 0; caps[i] != NULL; i++) {
+		if (liblazy_hal_capability_intern(caps[i]) < 0)
+			goto Error;
+	}
+
+	device = calloc(1, sizeof(struct capability_device));
+	if (device == NULL)
+		goto Error;
+	device->udi = strdup(udi);
+	device->words = (capability_count + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	device->bits = calloc(device->words ? device->words : 1,
+			      sizeof(unsigned long));
+	if (device->udi == NULL || device->bits == NULL) {
+		liblazy_hal_capability_free_device(device);
+		goto Error;
+	}
+
+	for (i = 0; caps[i] != NULL; i++) {
+		id = liblazy_hal_capability_find(caps[i]);
+		device->bits[id / BITS_PER_WORD] |= 1UL << (id % BITS_PER_WORD);
+	}
+
+	liblazy_deadline_set(&device->expires, capability_timeout);
+
+	/* another thread may have indexed the device meanwhile */
+	liblazy_hal_capability_remove(udi);
+	bucket = liblazy_hal_capability_hash(udi) & (HAL_CAPABILITY_BUCKETS - 1);
+	device->next = capability_devices[bucket];
+	capability_devices[bucket] = device;
+	return;
+
+Error:
+	ERROR("Could not index capabilities of %s: OOM", udi);
+}
+
+void liblazy_hal_set_capability_timeout(int msec)
+{
+	pthread_mutex_lock(&capability_lock);
+	capability_timeout = msec > 0 ? msec : 0;
+	if (!capability_timeout) {
+		liblazy_hal_capability_clear();
+		capability_generation++;
+	}
+	pthread_mutex_unlock(&capability_lock);
+}
+
+void liblazy_hal_capability_forget(const char *udi)
+{
+	pthread_mutex_lock(&capability_lock);
+	liblazy_hal_capability_remove(udi);
+	capability_generation++;
+	pthread_mutex_unlock(&capability_lock);
+}
+
+void liblazy_hal_capability_flush(void)
+{
+	pthread_mutex_lock(&capability_lock);
+	liblazy_hal_capability_clear();
+	capability_generation++;
+	pthread_mutex_unlock(&capability_lock);
+}
+
+int liblazy_hal_query_capability(const char *udi, const char *capability)
+{
+	unsigned int	generation;
+	int		i;
+	int		ret;
+	const char	**caps	= NULL;
+	LiblazyReply	reply	= LIBLAZY_REPLY_INIT;
+
+	if (udi == NULL || capability == NULL )
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	pthread_mutex_lock(&capability_lock);
+	ret = capability_timeout ? liblazy_hal_capability_test(udi, capability) : -1;
+	generation = capability_generation;
+	pthread_mutex_unlock(&capability_lock);
+	if (ret >= 0)
+		return ret;
+
+	ret = liblazy_hal_get_property_strlist_borrowed(udi, "info.capabilities",
+							&reply, &caps);
+	if (ret)
+		goto Out;
+
+	/* HAL may have reported a change while we were fetching, the
+	 * capabilities are still answered but not indexed then */
+	pthread_mutex_lock(&capability_lock);
+	if (capability_timeout && generation == capability_generation)
+		liblazy_hal_capability_add(udi, caps);
+	pthread_mutex_unlock(&capability_lock);
+
+	for (i = 0; caps[i] != NULL; i++) {
+		if (strcmp(caps[i], capability) == 0) {
+			ret = 1;
+			break;
+		}
+	}
+
+Out:
+	liblazy_reply_release(&reply);
+	return ret;
+}
@@ -0,0 +1,410 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+/* number of hash buckets for cached decisions, power of two */
+#define HAL_PRIVILEGE_BUCKETS		64
+
+/* marks results that still have to be asked for */
+#define PRIVILEGE_UNKNOWN		2
+
+#define POLKIT_MATCH_CHANGED		"type='signal',"			\
+					"interface='org.freedesktop.PolicyKit1.Authority'," \
+					"member='Changed'"
+#define CONSOLEKIT_MATCH_SESSION_CHANGED "type='signal',"			\
+					"interface='org.freedesktop.ConsoleKit.Seat'," \
+					"member='ActiveSessionChanged'"
+
+struct privilege_decision {
+	char				*privilege;
+	/* the connection the privilege was checked for */
+	char				*unique_name;
+	int				allowed;
+	struct timespec			expires;
+	struct privilege_decision	*next;
+};
+
+/* protects everything below */
+static pthread_mutex_t			privilege_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct privilege_decision	*decisions[HAL_PRIVILEGE_BUCKETS];
+/* receives the signals telling that decisions may have changed */
+static DBusConnection			*privilege_connection = NULL;
+static int				privilege_timeout = 0;
+/* bumped whenever the decisions are dropped, so answers to calls sent
+ * before are not cached */
+static unsigned int			privilege_generation = 0;
+
+static unsigned int liblazy_hal_privilege_bucket(const char *privilege,
+						 const char *unique_name)
+{
+	unsigned int hash = 5381;
+
+	while (*privilege != '\0')
+		hash = hash * 33 + (unsigned char)*privilege++;
+	while (*unique_name != '\0')
+		hash = hash * 33 + (unsigned char)*unique_name++;
+	return hash & (HAL_PRIVILEGE_BUCKETS - 1);
+}
+
+static void liblazy_hal_privilege_free(struct privilege_decision *decision)
+{
+	free(decision->privilege);
+	free(decision->unique_name);
+	free(decision);
+}
+
+static void liblazy_hal_privilege_clear(void)
+{
+	struct privilege_decision	*decision;
+	int				i;
+
+	for (i = 0; i < HAL_PRIVILEGE_BUCKETS; i++) {
+		while (decisions[i] != NULL) {
+			decision = decisions[i];
+			decisions[i] = decision->next;
+			liblazy_hal_privilege_free(decision);
+		}
+	}
+	privilege_generation++;
+}
+
+static DBusHandlerResult liblazy_hal_privilege_filter(DBusConnection *connection,
+						      DBusMessage *message,
+						      void *user_data)
+{
+	if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS,
+				   "NameOwnerChanged") ||
+	    dbus_message_is_signal(message, "org.freedesktop.PolicyKit1.Authority",
+				   "Changed") ||
+	    dbus_message_is_signal(message, "org.freedesktop.ConsoleKit.Seat",
+				   "ActiveSessionChanged")) {
+		liblazy_hal_privilege_clear();
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void liblazy_hal_privilege_disconnect(void)
+{
+	if (privilege_connection == NULL)
+		return;
+	liblazy_dbus_close_watch(privilege_connection,
+				 liblazy_hal_privilege_filter);
+	privilege_connection = NULL;
+	liblazy_hal_privilege_clear();
+}
+
+/* applies all invalidations that arrived since the last call. Called with
+ * privilege_lock held, which is dropped while connecting the watch so other
+ * threads keep using the cache meanwhile. Decisions must not be cached if
+ * this fails, as nobody would drop them */
+static int liblazy_hal_privilege_update(void)
+{
+	static const char * const	rules[] = {
+		DBUS_HAL_MATCH_NAME_OWNER_CHANGED,
+		POLKIT_MATCH_CHANGED,
+		CONSOLEKIT_MATCH_SESSION_CHANGED,
+		NULL
+	};
+	DBusConnection			*dbus_connection;
+	DBusError			dbus_error;
+
+	if (privilege_connection != NULL &&
+	    !liblazy_dbus_dispatch_watch(privilege_connection))
+		liblazy_hal_privilege_disconnect();
+
+	if (privilege_connection != NULL)
+		return 0;
+
+	pthread_mutex_unlock(&privilege_lock);
+	dbus_error_init(&dbus_error);
+	dbus_connection = liblazy_dbus_open_watch(DBUS_BUS_SYSTEM, rules,
+						  liblazy_hal_privilege_filter,
+						  &dbus_error);
+	pthread_mutex_lock(&privilege_lock);
+
+	if (dbus_connection == NULL) {
+		ERROR("Could not subscribe to policy changes, not caching "
+		      "privileges: %s", dbus_error.message);
+		dbus_error_free(&dbus_error);
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+	}
+
+	/* another thread may have connected or disabled the cache meanwhile */
+	if (privilege_connection != NULL || !privilege_timeout) {
+		liblazy_dbus_close_watch(dbus_connection,
+					 liblazy_hal_privilege_filter);
+		return privilege_connection != NULL ? 0 :
+			LIBLAZY_ERROR_DBUS_NOT_READY;
+	}
+	privilege_connection = dbus_connection;
+	return 0;
+}
+
+/* drops all expired decisions, so those of connections that went away
+ * don't pile up */
+static void liblazy_hal_privilege_sweep(void)
+{
+	struct privilege_decision	**link;
+	struct privilege_decision	*decision;
+	int				i;
+
+	for (i = 0; i < HAL_PRIVILEGE_BUCKETS; i++) {
+		link = &decisions[i];
+		while (*link != NULL) {
+			decision = *link;
+			if (!liblazy_deadline_passed(&decision->expires)) {
+				link = &decision->next;
+				continue;
+			}
+			*link = decision->next;
+			liblazy_hal_privilege_free(decision);
+		}
+	}
+}
+
+/* returns the cached decision or PRIVILEGE_UNKNOWN */
+static int liblazy_hal_privilege_lookup(const char *privilege,
+					const char *unique_name)
+{
+	struct privilege_decision	**link;
+	struct privilege_decision	*decision;
+
+	for (link = &decisions[liblazy_hal_privilege_bucket(privilege, unique_name)];
+	     *link != NULL; link = &(*link)->next) {
+		decision = *link;
+		if (strcmp(decision->privilege, privilege) != 0 ||
+		    strcmp(decision->unique_name, unique_name) != 0)
+			continue;
+		if (!liblazy_deadline_passed(&decision->expires))
+			return decision->allowed;
+		*link = decision->next;
+		liblazy_hal_privilege_free(decision);
+		break;
+	}
+	return PRIVILEGE_UNKNOWN;
+}
+
+static void liblazy_hal_privilege_store(const char *privilege,
+					const char *unique_name, int allowed)
+{
+	struct privilege_decision	*decision;
+	unsigned int			bucket;
+
+	decision = calloc(1, sizeof(struct privilege_decision));
+	if (decision == NULL)
+		return;
+	decision->privilege = strdup(privilege);
+	decision->unique_name = strdup(unique_name);
+	if (decision->privilege == NULL || decision->unique_name == NULL) {
+		liblazy_hal_privilege_free(decision);
+		return;
+	}
+	decision->allowed = allowed;
+	liblazy_deadline_set(&decision->expires, privilege_timeout);
+
+	liblazy_hal_privilege_sweep();
+
+	bucket = liblazy_hal_privilege_bucket(privilege, unique_name);
+	decision->next = decisions[bucket];
+	decisions[bucket] = decision;
+}
+
+void liblazy_hal_set_privilege_cache_timeout(int msec)
+{
+	pthread_mutex_lock(&privilege_lock);
+	privilege_timeout = msec > 0 ? msec : 0;
+	if (!privilege_timeout)
+		liblazy_hal_privilege_disconnect();
+	pthread_mutex_unlock(&privilege_lock);
+}
+
+void liblazy_hal_flush_privilege_cache(void)
+{
+	pthread_mutex_lock(&privilege_lock);
+	liblazy_hal_privilege_clear();
+	pthread_mutex_unlock(&privilege_lock);
+}
+
+/* asks HAL for all privileges whose result is still PRIVILEGE_UNKNOWN */
+static int liblazy_hal_privilege_ask(const char **privileges, int *results,
+				     int count, const char *unique_name)
+{
+	DBusMessage	**messages;
+	DBusMessage	**replies;
+	DBusError	*errors;
+	const char	*allowed;
+	int		*index;
+	int		asked	= 0;
+	int		ret	= LIBLAZY_ERROR_GENERAL;
+	int		i;
+
+	messages = calloc(count, sizeof(DBusMessage *));
+	replies = calloc(count, sizeof(DBusMessage *));
+	errors = calloc(count, sizeof(DBusError));
+	index = calloc(count, sizeof(int));
+	if (messages == NULL || replies == NULL || errors == NULL || index == NULL) {
+		ERROR("Could not allocate calls: OOM");
+		goto Free;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (results[i] != PRIVILEGE_UNKNOWN)
+			continue;
+		messages[asked] = dbus_message_new_method_call(DBUS_HAL_SERVICE,
+							       DBUS_HAL_COMPUTER_PATH,
+							       DBUS_HAL_DEVICE_INTERFACE,
+							       "IsCallerPrivileged");
+		if (messages[asked] == NULL ||
+		    !dbus_message_append_args(messages[asked],
+					      DBUS_TYPE_STRING, &privileges[i],
+					      DBUS_TYPE_STRING, &unique_name,
+					      DBUS_TYPE_INVALID)) {
+			ERROR("Could not create method call IsCallerPrivileged: OOM");
+			if (messages[asked] != NULL)
+				dbus_message_unref(messages[asked]);
+			goto Unref;
+		}
+		dbus_error_init(&errors[asked]);
+		index[asked++] = i;
+	}
+
+	ret = liblazy_dbus_send_messages(DBUS_BUS_SYSTEM, messages, asked,
+					 replies, errors);
+	if (ret)
+		goto Unref;
+
+	for (i = 0; i < asked; i++) {
+		if (replies[i] == NULL) {
+			ERROR("Error sending 'IsCallerPrivileged' to HAL: %s",
+			      errors[i].message);
+			results[index[i]] = liblazy_dbus_error_code(&errors[i]);
+			continue;
+		}
+		/* allowed points into the reply */
+		if (liblazy_dbus_message_get_args(replies[i], "s", &allowed) == 0)
+			results[index[i]] = strcmp(allowed, "yes") == 0 ? 1 : 0;
+		else
+			results[index[i]] = LIBLAZY_ERROR_GENERAL;
+		dbus_message_unref(replies[i]);
+	}
+
+Unref:
+	for (i = 0; i < asked; i++) {
+		dbus_message_unref(messages[i]);
+		dbus_error_free(&errors[i]);
+	}
+Free:
+	free(messages);
+	free(replies);
+	free(errors);
+	free(index);
+	return ret;
+}
+
+int liblazy_hal_check_caller_privileges(const char **privileges, int *results)
+{
+	DBusConnection	*dbus_connection;
+	const char	*unique_name;
+	unsigned int	generation;
+	int		caching;
+	int		count;
+	int		missing	= 0;
+	int		ret	= 0;
+	int		i;
+
+	if (privileges == NULL || results == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	for (count = 0; privileges[count] != NULL; count++)
+		;
+
+	/* the privileges are checked for the connection the calls are sent on */
+	dbus_connection = liblazy_dbus_get_connection(DBUS_BUS_SYSTEM,
+						      "IsCallerPrivileged");
+	if (dbus_connection == NULL)
+		return LIBLAZY_ERROR_DBUS_NOT_READY;
+	/* unique_name stays valid as long as our reference to the connection */
+	unique_name = dbus_bus_get_unique_name(dbus_connection);
+
+	pthread_mutex_lock(&privilege_lock);
+	caching = privilege_timeout && liblazy_hal_privilege_update() == 0;
+	generation = privilege_generation;
+	for (i = 0; i < count; i++) {
+		results[i] = caching ?
+			liblazy_hal_privilege_lookup(privileges[i], unique_name) :
+			PRIVILEGE_UNKNOWN;
+		if (results[i] == PRIVILEGE_UNKNOWN)
+			missing++;
+	}
+	pthread_mutex_unlock(&privilege_lock);
+
+	if (missing == 0)
+		goto Out;
+
+	ret = liblazy_hal_privilege_ask(privileges, results, count, unique_name);
+	if (ret || !caching)
+		goto Out;
+
+	pthread_mutex_lock(&privilege_lock);
+	/* drop the answers if the policy changed while we were asking */
+	if (privilege_timeout && liblazy_hal_privilege_update() == 0 &&
+	    generation == privilege_generation) {
+		for (i = 0; i < count; i++) {
+			if (results[i] == 0 || results[i] == 1)
+				liblazy_hal_privilege_store(privileges[i],
+							    unique_name,
+							    results[i]);
+		}
+	}
+	pthread_mutex_unlock(&privilege_lock);
+
+Out:
+	dbus_connection_unref(dbus_connection);
+	return ret;
+}
+
+int liblazy_hal_is_caller_privileged(const char *privilege)
+{
+	const char	*privileges[2];
+	int		result;
+	int		error;
+
+	if (privilege == NULL )
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	privileges[0] = privilege;
+	privileges[1] = NULL;
+	error = liblazy_hal_check_caller_privileges(privileges, &result);
+	return error ? error : result;
+}
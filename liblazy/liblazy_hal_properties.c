@@ -0,0 +1,370 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct hal_property {
+	const char	*key;
+	int		type;
+	union {
+		dbus_int32_t	int_value;
+		dbus_uint64_t	uint64_value;
+		double		double_value;
+		dbus_bool_t	bool_value;
+		const char	*string_value;
+		const char	**strlist_value;
+		/* only used while decoding, the pool may still move */
+		size_t		strlist_offset;
+	} v;
+};
+
+/* keys and string values point into the reply, which is kept alive as
+ * long as the table */
+struct _LiblazyHalProperties {
+	/* the property cache hands out references to its tables */
+	int			refcount;
+	DBusMessage		*reply;
+	int			count;
+	struct hal_property	*properties;
+	/* NULL terminated string lists, one after another */
+	const char		**strlists;
+};
+
+static int liblazy_hal_property_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct hal_property *)a)->key,
+		      ((const struct hal_property *)b)->key);
+}
+
+/* appends the string array the iterator points to to the pool and
+ * returns its offset or -1 on failure */
+static long liblazy_hal_properties_add_strlist(DBusMessageIter *iter,
+					       const char ***pool, size_t *used,
+					       size_t *size)
+{
+	DBusMessageIter	array;
+	const char	**strlists;
+	size_t		offset	= *used;
+
+	dbus_message_iter_recurse(iter, &array);
+	for (;;) {
+		if (*used == *size) {
+			*size = *size ? *size * 2 : 32;
+			strlists = realloc(*pool, *size * sizeof(char *));
+			if (strlists == NULL)
+				return -1;
+			*pool = strlists;
+		}
+		if (dbus_message_iter_get_arg_type(&array) != DBUS_TYPE_STRING) {
+			(*pool)[(*used)++] = NULL;
+			break;
+		}
+		dbus_message_iter_get_basic(&array, &(*pool)[(*used)++]);
+		dbus_message_iter_next(&array);
+	}
+	return offset;
+}
+
+LiblazyHalProperties *liblazy_hal_properties_new_from_reply(DBusMessage *reply)
+{
+	LiblazyHalProperties	*table;
+	struct hal_property	*property;
+	struct hal_property	*properties;
+	DBusMessageIter		iter;
+	DBusMessageIter		dict;
+	DBusMessageIter		entry;
+	DBusMessageIter		variant;
+	size_t			pool_used	= 0;
+	size_t			pool_size	= 0;
+	long			offset;
+	int			size		= 0;
+	int			i;
+
+	if (!dbus_message_iter_init(reply, &iter) ||
+	    dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
+		ERROR("Reply does not contain a property dictionary");
+		return NULL;
+	}
+
+	table = calloc(1, sizeof(LiblazyHalProperties));
+	if (table == NULL)
+		goto Error;
+
+	dbus_message_iter_recurse(&iter, &dict);
+	for (; dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY;
+	     dbus_message_iter_next(&dict)) {
+		if (table->count == size) {
+			size = size ? size * 2 : 32;
+			properties = realloc(table->properties,
+					     size * sizeof(struct hal_property));
+			if (properties == NULL)
+				goto Error;
+			table->properties = properties;
+		}
+		property = &table->properties[table->count];
+
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &property->key);
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &variant);
+
+		property->type = dbus_message_iter_get_arg_type(&variant);
+		switch (property->type) {
+		case DBUS_TYPE_INT32:
+		case DBUS_TYPE_UINT64:
+		case DBUS_TYPE_DOUBLE:
+		case DBUS_TYPE_BOOLEAN:
+		case DBUS_TYPE_STRING:
+			dbus_message_iter_get_basic(&variant, &property->v);
+			break;
+		case DBUS_TYPE_ARRAY:
+			if (dbus_message_iter_get_element_type(&variant) != DBUS_TYPE_STRING)
+				continue;
+			offset = liblazy_hal_properties_add_strlist(&variant,
+								    &table->strlists,
+								    &pool_used,
+								    &pool_size);
+			if (offset < 0)
+				goto Error;
+			property->v.strlist_offset = offset;
+			break;
+		default:
+			/* not a type HAL uses for properties */
+			continue;
+		}
+		table->count++;
+	}
+
+	for (i = 0; i < table->count; i++) {
+		if (table->properties[i].type == DBUS_TYPE_ARRAY)
+			table->properties[i].v.strlist_value =
+				table->strlists + table->properties[i].v.strlist_offset;
+	}
+
+	qsort(table->properties, table->count, sizeof(struct hal_property),
+	      liblazy_hal_property_compare);
+
+	table->refcount = 1;
+	table->reply = dbus_message_ref(reply);
+	return table;
+
+Error:
+	ERROR("Could not decode properties: OOM");
+	liblazy_hal_free_properties(table);
+	return NULL;
+}
+
+int liblazy_hal_get_all_properties(const char *udi, LiblazyHalProperties **properties)
+{
+	DBusMessage	*message;
+	DBusMessage	*reply;
+	int		error;
+
+	if (udi == NULL || properties == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	*properties = NULL;
+
+	message = dbus_message_new_method_call(DBUS_HAL_SERVICE, udi,
+					       DBUS_HAL_DEVICE_INTERFACE,
+					       "GetAllProperties");
+	if (message == NULL) {
+		ERROR("Could not create method call GetAllProperties: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	error = liblazy_dbus_send_message(DBUS_BUS_SYSTEM, message, &reply, -1,
+					  NULL, NULL);
+	dbus_message_unref(message);
+	if (error) {
+		ERROR("Error fetching properties of %s", udi);
+		return error;
+	}
+
+	*properties = liblazy_hal_properties_new_from_reply(reply);
+	if (TRACE_ENABLED)
+		liblazy_trace_decoded(reply, *properties == NULL ?
+				      LIBLAZY_ERROR_GENERAL : 0);
+	dbus_message_unref(reply);
+	if (*properties == NULL)
+		return LIBLAZY_ERROR_GENERAL;
+	return 0;
+}
+
+LiblazyHalProperties *liblazy_hal_properties_ref(LiblazyHalProperties *properties)
+{
+	__sync_add_and_fetch(&properties->refcount, 1);
+	return properties;
+}
+
+void liblazy_hal_free_properties(LiblazyHalProperties *properties)
+{
+	if (properties == NULL)
+		return;
+	/* tables that failed to decode were never referenced */
+	if (properties->refcount > 0 &&
+	    __sync_sub_and_fetch(&properties->refcount, 1) > 0)
+		return;
+	if (properties->reply != NULL)
+		dbus_message_unref(properties->reply);
+	free(properties->properties);
+	free(properties->strlists);
+	free(properties);
+}
+
+int liblazy_hal_properties_count(const LiblazyHalProperties *properties)
+{
+	if (properties == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	return properties->count;
+}
+
+const char *liblazy_hal_properties_get_key(const LiblazyHalProperties *properties,
+					   int index)
+{
+	if (properties == NULL || index < 0 || index >= properties->count)
+		return NULL;
+	return properties->properties[index].key;
+}
+
+static const struct hal_property *liblazy_hal_properties_find(const LiblazyHalProperties *properties,
+							      const char *key)
+{
+	struct hal_property wanted;
+
+	if (properties == NULL || key == NULL)
+		return NULL;
+
+	wanted.key = key;
+	return bsearch(&wanted, properties->properties, properties->count,
+		       sizeof(struct hal_property), liblazy_hal_property_compare);
+}
+
+int liblazy_hal_properties_get_type(const LiblazyHalProperties *properties,
+				    const char *key)
+{
+	const struct hal_property *property;
+
+	if (properties == NULL || key == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	property = liblazy_hal_properties_find(properties, key);
+	if (property == NULL)
+		return LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+	return property->type;
+}
+
+/* returns the property with the given key if it has the given type */
+static int liblazy_hal_properties_lookup(const LiblazyHalProperties *properties,
+					 const char *key, int type,
+					 const struct hal_property **property)
+{
+	if (properties == NULL || key == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	*property = liblazy_hal_properties_find(properties, key);
+	if (*property == NULL)
+		return LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+	if ((*property)->type != type)
+		return LIBLAZY_ERROR_HAL_TYPE_MISMATCH;
+	return 0;
+}
+
+int liblazy_hal_properties_get_int(const LiblazyHalProperties *properties,
+				   const char *key, int *value)
+{
+	const struct hal_property	*property;
+	int				ret;
+
+	ret = liblazy_hal_properties_lookup(properties, key, DBUS_TYPE_INT32,
+					    &property);
+	*value = ret ? -1 : property->v.int_value;
+	return ret;
+}
+
+int liblazy_hal_properties_get_uint64(const LiblazyHalProperties *properties,
+				      const char *key, dbus_uint64_t *value)
+{
+	const struct hal_property	*property;
+	int				ret;
+
+	ret = liblazy_hal_properties_lookup(properties, key, DBUS_TYPE_UINT64,
+					    &property);
+	*value = ret ? 0 : property->v.uint64_value;
+	return ret;
+}
+
+int liblazy_hal_properties_get_double(const LiblazyHalProperties *properties,
+				      const char *key, double *value)
+{
+	const struct hal_property	*property;
+	int				ret;
+
+	ret = liblazy_hal_properties_lookup(properties, key, DBUS_TYPE_DOUBLE,
+					    &property);
+	*value = ret ? 0 : property->v.double_value;
+	return ret;
+}
+
+int liblazy_hal_properties_get_bool(const LiblazyHalProperties *properties,
+				    const char *key, int *value)
+{
+	const struct hal_property	*property;
+	int				ret;
+
+	ret = liblazy_hal_properties_lookup(properties, key, DBUS_TYPE_BOOLEAN,
+					    &property);
+	*value = ret ? -1 : property->v.bool_value;
+	return ret;
+}
+
+int liblazy_hal_properties_get_string(const LiblazyHalProperties *properties,
+				      const char *key, const char **value)
+{
+	const struct hal_property	*property;
+	int				ret;
+
+	ret = liblazy_hal_properties_lookup(properties, key, DBUS_TYPE_STRING,
+					    &property);
+	*value = ret ? NULL : property->v.string_value;
+	return ret;
+}
+
+int liblazy_hal_properties_get_strlist(const LiblazyHalProperties *properties,
+				       const char *key, const char ***strlist)
+{
+	const struct hal_property	*property;
+	int				ret;
+
+	ret = liblazy_hal_properties_lookup(properties, key, DBUS_TYPE_ARRAY,
+					    &property);
+	*strlist = ret ? NULL : property->v.strlist_value;
+	return ret;
+}
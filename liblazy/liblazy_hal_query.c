@@ -0,0 +1,729 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define QUERY_CAPABILITY	0
+#define QUERY_STRING		1
+#define QUERY_RANGE		2
+
+struct query_predicate {
+	int		type;
+	/* the capability or the property */
+	char		*key;
+	char		*value;
+	dbus_int64_t	min;
+	dbus_int64_t	max;
+};
+
+struct _LiblazyHalQuery {
+	int			match;
+	struct query_predicate	*predicates;
+	int			count;
+	int			size;
+};
+
+/* a sorted set of devices, the names are borrowed from the replies */
+struct udi_set {
+	const char	**udis;
+	int		count;
+};
+
+LiblazyHalQuery *liblazy_hal_query_new(int match)
+{
+	LiblazyHalQuery *query;
+
+	if (match != LIBLAZY_HAL_QUERY_ALL && match != LIBLAZY_HAL_QUERY_ANY)
+		return NULL;
+
+	query = calloc(1, sizeof(LiblazyHalQuery));
+	if (query == NULL) {
+		ERROR("Could not allocate query: OOM");
+		return NULL;
+	}
+	query->match = match;
+	return query;
+}
+
+void liblazy_hal_query_free(LiblazyHalQuery *query)
+{
+	int i;
+
+	if (query == NULL)
+		return;
+
+	for (i = 0; i < query->count; i++) {
+		free(query->predicates[i].key);
+		free(query->predicates[i].value);
+	}
+	free(query->predicates);
+	free(query);
+}
+
+static int liblazy_hal_query_add(LiblazyHalQuery *query, int type,
+				 const char *key, const char *value,
+				 dbus_int64_t min, dbus_int64_t max)
+{
+	struct query_predicate	*predicate;
+	struct query_predicate	*predicates;
+	int			size;
+
+	if (query == NULL || key == NULL || (type == QUERY_STRING && value == NULL))
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	if (query->count == query->size) {
+		size = query->size ? query->size * 2 : 4;
+		predicates = realloc(query->predicates,
+				     size * sizeof(struct query_predicate));
+		if (predicates == NULL) {
+			ERROR("Could not grow query: OOM");
+			return LIBLAZY_ERROR_GENERAL;
+		}
+		query->predicates = predicates;
+		query->size = size;
+	}
+
+	predicate = &query->predicates[query->count];
+	predicate->type = type;
+	predicate->key = strdup(key);
+	predicate->value = value != NULL ? strdup(value) : NULL;
+	if (predicate->key == NULL || (value != NULL && predicate->value == NULL)) {
+		ERROR("Could not add '%s' to query: OOM", key);
+		free(predicate->key);
+		free(predicate->value);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	predicate->min = min;
+	predicate->max = max;
+
+	query->count++;
+	return 0;
+}
+
+int liblazy_hal_query_add_capability(LiblazyHalQuery *query, const char *capability)
+{
+	return liblazy_hal_query_add(query, QUERY_CAPABILITY, capability, NULL, 0, 0);
+}
+
+int liblazy_hal_query_add_string(LiblazyHalQuery *query, const char *key,
+				 const char *value)
+{
+	return liblazy_hal_query_add(query, QUERY_STRING, key, value, 0, 0);
+}
+
+int liblazy_hal_query_add_range(LiblazyHalQuery *query, const char *key,
+				dbus_int64_t min, dbus_int64_t max)
+{
+	if (min > max)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	return liblazy_hal_query_add(query, QUERY_RANGE, key, NULL, min, max);
+}
+
+int liblazy_hal_query_add_bool(LiblazyHalQuery *query, const char *key, int value)
+{
+	value = value != 0;
+	return liblazy_hal_query_add(query, QUERY_RANGE, key, NULL, value, value);
+}
+
+static int liblazy_hal_query_compare(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/* fills set with the sorted, unique devices of strlist */
+static int liblazy_hal_query_set_from(struct udi_set *set, const char **strlist)
+{
+	int count;
+	int i;
+
+	for (count = 0; strlist[count] != NULL; count++)
+		;
+
+	set->udis = malloc((count + 1) * sizeof(const char *));
+	if (set->udis == NULL) {
+		ERROR("Could not allocate device set: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	memcpy(set->udis, strlist, count * sizeof(const char *));
+	qsort(set->udis, count, sizeof(const char *), liblazy_hal_query_compare);
+
+	set->count = 0;
+	for (i = 0; i < count; i++) {
+		if (set->count == 0 || strcmp(set->udis[set->count - 1], set->udis[i]))
+			set->udis[set->count++] = set->udis[i];
+	}
+	return 0;
+}
+
+/* keeps the devices of set that are in other, or with common 0 those that
+ * are not */
+static void liblazy_hal_query_intersect(struct udi_set *set,
+					const struct udi_set *other, int common)
+{
+	int	count	= 0;
+	int	cmp;
+	int	i;
+	int	j	= 0;
+
+	for (i = 0; i < set->count; i++) {
+		cmp = 1;
+		while (j < other->count) {
+			cmp = strcmp(other->udis[j], set->udis[i]);
+			if (cmp >= 0)
+				break;
+			j++;
+		}
+		if ((cmp == 0) == common)
+			set->udis[count++] = set->udis[i];
+	}
+	set->count = count;
+}
+
+/* adds the devices of other to set */
+static int liblazy_hal_query_union(struct udi_set *set, const struct udi_set *other)
+{
+	const char	**udis;
+	int		count	= 0;
+	int		cmp;
+	int		i	= 0;
+	int		j	= 0;
+
+	udis = malloc((set->count + other->count + 1) * sizeof(const char *));
+	if (udis == NULL) {
+		ERROR("Could not allocate device set: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	while (i < set->count || j < other->count) {
+		if (i == set->count)
+			cmp = 1;
+		else if (j == other->count)
+			cmp = -1;
+		else
+			cmp = strcmp(set->udis[i], other->udis[j]);
+
+		if (cmp <= 0)
+			udis[count++] = set->udis[i++];
+		else
+			udis[count++] = other->udis[j++];
+		if (cmp == 0)
+			j++;
+	}
+
+	free(set->udis);
+	set->udis = udis;
+	set->count = count;
+	return 0;
+}
+
+/* creates the call finding the devices with the string property key set
+ * to value or, if key is NULL, having the capability value */
+static DBusMessage *liblazy_hal_query_new_find(const char *key, const char *value)
+{
+	DBusMessage	*message;
+	dbus_bool_t	appended;
+
+	message = dbus_message_new_method_call(DBUS_HAL_SERVICE, DBUS_HAL_MANAGER_PATH,
+					       DBUS_HAL_MANAGER_INTERFACE,
+					       key != NULL ? "FindDeviceStringMatch" :
+					       "FindDeviceByCapability");
+	if (message == NULL) {
+		ERROR("Could not create query: OOM");
+		return NULL;
+	}
+
+	if (key != NULL)
+		appended = dbus_message_append_args(message, DBUS_TYPE_STRING, &key,
+						    DBUS_TYPE_STRING, &value,
+						    DBUS_TYPE_INVALID);
+	else
+		appended = dbus_message_append_args(message, DBUS_TYPE_STRING, &value,
+						    DBUS_TYPE_INVALID);
+	if (!appended) {
+		ERROR("Could not create query: OOM");
+		dbus_message_unref(message);
+		return NULL;
+	}
+	return message;
+}
+
+/* fills one set per capability and string predicate, and the set after
+ * them with all devices if all_devices is set. Whatever the snapshot
+ * can't answer is sent to HAL back to back */
+static int liblazy_hal_query_find(LiblazyHalQuery *query, int all_devices,
+				  LiblazyReply *replies, struct udi_set *sets,
+				  int lookups)
+{
+	struct query_predicate	*predicate;
+	DBusMessageIter		iter;
+	DBusMessage		**messages;
+	DBusMessage		**answers;
+	DBusError		*errors;
+	const char		**strlist;
+	const char		*key;
+	const char		*value;
+	int			*index;
+	int			count		= 0;
+	int			set		= 0;
+	int			ret		= 0;
+	int			error;
+	int			i;
+
+	if (lookups == 0)
+		return 0;
+
+	messages = malloc(lookups * sizeof(DBusMessage *));
+	answers = malloc(lookups * sizeof(DBusMessage *));
+	errors = malloc(lookups * sizeof(DBusError));
+	index = malloc(lookups * sizeof(int));
+	if (messages == NULL || answers == NULL || errors == NULL || index == NULL) {
+		ERROR("Could not allocate query: OOM");
+		ret = LIBLAZY_ERROR_GENERAL;
+		goto Free;
+	}
+
+	for (i = 0; i < query->count && ret == 0; i++) {
+		predicate = &query->predicates[i];
+		if (predicate->type == QUERY_RANGE)
+			continue;
+
+		if (predicate->type == QUERY_STRING) {
+			key = predicate->key;
+			value = predicate->value;
+		} else {
+			key = NULL;
+			value = predicate->key;
+		}
+
+		error = liblazy_hal_snapshot_find(key, value, &replies[set], &strlist);
+		if (error == 0)
+			ret = liblazy_hal_query_set_from(&sets[set], strlist);
+		else if (error != LIBLAZY_HAL_SNAPSHOT_MISS)
+			ret = error;
+		else {
+			messages[count] = liblazy_hal_query_new_find(key, value);
+			if (messages[count] == NULL) {
+				ret = LIBLAZY_ERROR_GENERAL;
+				break;
+			}
+			index[count++] = set;
+		}
+		set++;
+	}
+
+	if (ret == 0 && all_devices) {
+		messages[count] = dbus_message_new_method_call(DBUS_HAL_SERVICE,
+							       DBUS_HAL_MANAGER_PATH,
+							       DBUS_HAL_MANAGER_INTERFACE,
+							       "GetAllDevices");
+		if (messages[count] == NULL) {
+			ERROR("Could not create query: OOM");
+			ret = LIBLAZY_ERROR_GENERAL;
+		} else
+			index[count++] = set;
+	}
+
+	for (i = 0; i < count; i++)
+		dbus_error_init(&errors[i]);
+	if (ret == 0)
+		ret = liblazy_dbus_send_messages(DBUS_BUS_SYSTEM, messages, count,
+						 answers, errors);
+	else
+		memset(answers, 0, count * sizeof(DBusMessage *));
+
+	for (i = 0; i < count; i++) {
+		if (ret == 0 && dbus_error_is_set(&errors[i])) {
+			ERROR("Error while querying HAL: %s", errors[i].message);
+			ret = liblazy_dbus_error_code(&errors[i]);
+		} else if (ret == 0) {
+			liblazy_reply_set_message(&replies[index[i]], answers[i]);
+			dbus_message_iter_init(answers[i], &iter);
+			ret = liblazy_reply_get_strlist(&replies[index[i]], &iter, &strlist);
+			if (ret == 0)
+				ret = liblazy_hal_query_set_from(&sets[index[i]], strlist);
+		} else if (answers[i] != NULL)
+			dbus_message_unref(answers[i]);
+		dbus_error_free(&errors[i]);
+		dbus_message_unref(messages[i]);
+	}
+
+Free:
+	free(messages);
+	free(answers);
+	free(errors);
+	free(index);
+	return ret;
+}
+
+/* returns 1 if a property value of the given DBUS_TYPE_* is within the
+ * range of the predicate */
+static int liblazy_hal_query_in_range(int type, const union hal_number *value,
+				      const struct query_predicate *predicate)
+{
+	dbus_int64_t number;
+
+	switch (type) {
+	case DBUS_TYPE_INT32:
+		number = value->int32;
+		break;
+	case DBUS_TYPE_UINT32:
+		number = value->uint32;
+		break;
+	case DBUS_TYPE_INT64:
+		number = value->int64;
+		break;
+	case DBUS_TYPE_UINT64:
+		/* larger than any bound but the open one */
+		if (value->uint64 > (dbus_uint64_t)LIBLAZY_HAL_QUERY_NO_MAX)
+			return predicate->max == LIBLAZY_HAL_QUERY_NO_MAX;
+		number = value->uint64;
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		number = value->boolean != FALSE;
+		break;
+	case DBUS_TYPE_DOUBLE:
+		return value->number >= predicate->min &&
+			value->number <= predicate->max;
+	default:
+		return 0;
+	}
+	return number >= predicate->min && number <= predicate->max;
+}
+
+/* returns 1 if the value of a GetProperty reply is within the range of
+ * the predicate */
+static int liblazy_hal_query_reply_in_range(DBusMessage *reply,
+					    const struct query_predicate *predicate)
+{
+	DBusMessageIter		iter;
+	DBusMessageIter		variant;
+	union hal_number	value;
+	int			type;
+
+	if (!dbus_message_iter_init(reply, &iter))
+		return 0;
+	if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_VARIANT) {
+		dbus_message_iter_recurse(&iter, &variant);
+		iter = variant;
+	}
+
+	type = dbus_message_iter_get_arg_type(&iter);
+	switch (type) {
+	case DBUS_TYPE_INT32:
+	case DBUS_TYPE_UINT32:
+	case DBUS_TYPE_INT64:
+	case DBUS_TYPE_UINT64:
+	case DBUS_TYPE_BOOLEAN:
+	case DBUS_TYPE_DOUBLE:
+		dbus_message_iter_get_basic(&iter, &value);
+		return liblazy_hal_query_in_range(type, &value, predicate);
+	default:
+		return 0;
+	}
+}
+
+/* looks a property up in a cached property table, returning 1 and
+ * whether it is within the range of the predicate in matched, or 0 if
+ * the table can't tell */
+static int liblazy_hal_query_cached_in_range(const LiblazyHalProperties *properties,
+					     const struct query_predicate *predicate,
+					     char *matched)
+{
+	union hal_number	value;
+	int			type;
+	int			int_value;
+
+	type = liblazy_hal_properties_get_type(properties, predicate->key);
+	switch (type) {
+	case LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY:
+		/* the table holds all properties of the device */
+		*matched = 0;
+		return 1;
+	case DBUS_TYPE_INT32:
+		liblazy_hal_properties_get_int(properties, predicate->key, &int_value);
+		value.int32 = int_value;
+		break;
+	case DBUS_TYPE_UINT64:
+		liblazy_hal_properties_get_uint64(properties, predicate->key,
+						  &value.uint64);
+		break;
+	case DBUS_TYPE_DOUBLE:
+		liblazy_hal_properties_get_double(properties, predicate->key,
+						  &value.number);
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		liblazy_hal_properties_get_bool(properties, predicate->key, &int_value);
+		value.boolean = int_value;
+		break;
+	default:
+		if (type < 0)
+			return 0;
+		/* strings and string lists are never in range */
+		*matched = 0;
+		return 1;
+	}
+	*matched = liblazy_hal_query_in_range(type, &value, predicate);
+	return 1;
+}
+
+/* keeps the devices of set matching all range predicates or, for
+ * LIBLAZY_HAL_QUERY_ANY, one of them. The properties neither the snapshot
+ * nor the property cache hold are read with one batch of GetProperty
+ * calls */
+static int liblazy_hal_query_filter(LiblazyHalQuery *query, struct udi_set *set)
+{
+	struct query_predicate	**ranges;
+	LiblazyHalProperties	*properties;
+	union hal_number	value;
+	DBusMessage		**messages	= NULL;
+	DBusMessage		**answers	= NULL;
+	DBusError		*errors		= NULL;
+	int			*index		= NULL;
+	char			*matched	= NULL;
+	int			range_count	= 0;
+	int			count		= 0;
+	int			kept		= 0;
+	int			ret		= 0;
+	int			total;
+	int			error;
+	int			type;
+	int			hits;
+	int			i;
+	int			j;
+
+	ranges = malloc(query->count * sizeof(struct query_predicate *));
+	if (ranges == NULL) {
+		ERROR("Could not allocate query: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	for (i = 0; i < query->count; i++) {
+		if (query->predicates[i].type == QUERY_RANGE)
+			ranges[range_count++] = &query->predicates[i];
+	}
+
+	total = set->count * range_count;
+	messages = malloc(total * sizeof(DBusMessage *));
+	answers = malloc(total * sizeof(DBusMessage *));
+	errors = malloc(total * sizeof(DBusError));
+	index = malloc(total * sizeof(int));
+	matched = calloc(total, 1);
+	if (messages == NULL || answers == NULL || errors == NULL ||
+	    index == NULL || matched == NULL) {
+		ERROR("Could not allocate query: OOM");
+		ret = LIBLAZY_ERROR_GENERAL;
+		goto Free;
+	}
+
+	/* like the single property getters, the snapshot and the property
+	 * cache are asked first and only what they miss goes to HAL */
+	for (i = 0; i < set->count; i++) {
+		liblazy_hal_cache_peek_properties(set->udis[i], &properties);
+		for (j = 0; j < range_count; j++) {
+			if (liblazy_hal_is_missing(set->udis[i], ranges[j]->key))
+				continue;
+
+			error = liblazy_hal_snapshot_get_number(set->udis[i],
+								ranges[j]->key,
+								&type, &value);
+			if (error == 0) {
+				matched[i * range_count + j] =
+					liblazy_hal_query_in_range(type, &value,
+								   ranges[j]);
+				continue;
+			}
+			if (error != LIBLAZY_HAL_SNAPSHOT_MISS)
+				continue;
+
+			if (properties != NULL &&
+			    liblazy_hal_query_cached_in_range(properties, ranges[j],
+							      &matched[i * range_count + j]))
+				continue;
+
+			messages[count] = liblazy_hal_new_property_call(set->udis[i],
+									ranges[j]->key,
+									"GetProperty");
+			if (messages[count] == NULL) {
+				liblazy_hal_free_properties(properties);
+				ret = LIBLAZY_ERROR_GENERAL;
+				goto Unref;
+			}
+			dbus_error_init(&errors[count]);
+			index[count++] = i * range_count + j;
+		}
+		liblazy_hal_free_properties(properties);
+	}
+
+	ret = liblazy_dbus_send_messages(DBUS_BUS_SYSTEM, messages, count,
+					 answers, errors);
+
+	for (i = 0; i < count; i++) {
+		if (ret == 0 && dbus_error_is_set(&errors[i])) {
+			/* a missing property or a vanished device just doesn't
+			 * match, any other error leaves the result open */
+			if (!dbus_error_has_name(&errors[i], DBUS_HAL_ERROR_NO_SUCH_DEVICE)) {
+				ret = liblazy_hal_property_error(set->udis[index[i] / range_count],
+								 ranges[index[i] % range_count]->key,
+								 "GetProperty", &errors[i]);
+				if (ret == LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY)
+					ret = 0;
+			}
+		} else if (ret == 0)
+			matched[index[i]] = liblazy_hal_query_reply_in_range(answers[i],
+									     ranges[index[i] % range_count]);
+		if (answers[i] != NULL)
+			dbus_message_unref(answers[i]);
+		dbus_error_free(&errors[i]);
+	}
+
+	for (i = 0; ret == 0 && i < set->count; i++) {
+		for (hits = 0, j = 0; j < range_count; j++)
+			hits += matched[i * range_count + j];
+		if (query->match == LIBLAZY_HAL_QUERY_ALL ? hits == range_count : hits > 0)
+			set->udis[kept++] = set->udis[i];
+	}
+	if (ret == 0)
+		set->count = kept;
+
+Unref:
+	for (i = 0; i < count; i++)
+		dbus_message_unref(messages[i]);
+Free:
+	free(ranges);
+	free(messages);
+	free(answers);
+	free(errors);
+	free(index);
+	free(matched);
+	return ret;
+}
+
+int liblazy_hal_query_execute(LiblazyHalQuery *query, char ***udis)
+{
+	LiblazyReply	*replies	= NULL;
+	struct udi_set	*sets		= NULL;
+	struct udi_set	result		= { NULL, 0 };
+	struct udi_set	candidates	= { NULL, 0 };
+	size_t		size		= 0;
+	char		*pos;
+	int		finds		= 0;
+	int		ranges;
+	int		all_devices;
+	int		smallest	= 0;
+	int		ret;
+	int		i;
+
+	if (query == NULL || udis == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+	*udis = NULL;
+
+	for (i = 0; i < query->count; i++) {
+		if (query->predicates[i].type != QUERY_RANGE)
+			finds++;
+	}
+	ranges = query->count - finds;
+
+	/* the range predicates need devices to check, but HAL can't tell
+	 * which devices are left for them on its own */
+	if (query->match == LIBLAZY_HAL_QUERY_ALL)
+		all_devices = finds == 0;
+	else
+		all_devices = ranges > 0;
+
+	replies = calloc(finds + 1, sizeof(LiblazyReply));
+	sets = calloc(finds + 1, sizeof(struct udi_set));
+	if (replies == NULL || sets == NULL) {
+		ERROR("Could not allocate query: OOM");
+		ret = LIBLAZY_ERROR_GENERAL;
+		goto Out;
+	}
+
+	ret = liblazy_hal_query_find(query, all_devices, replies, sets,
+				     finds + all_devices);
+	if (ret)
+		goto Out;
+
+	if (query->match == LIBLAZY_HAL_QUERY_ALL) {
+		/* the set to intersect in place should be the smallest */
+		for (i = 1; i < finds + all_devices; i++) {
+			if (sets[i].count < sets[smallest].count)
+				smallest = i;
+		}
+		candidates = sets[smallest];
+		sets[smallest].udis = NULL;
+		for (i = 0; i < finds + all_devices; i++) {
+			if (i != smallest)
+				liblazy_hal_query_intersect(&candidates, &sets[i], 1);
+		}
+		if (ranges > 0 && candidates.count > 0)
+			ret = liblazy_hal_query_filter(query, &candidates);
+		result = candidates;
+		candidates.udis = NULL;
+	} else {
+		for (i = 0; i < finds && ret == 0; i++)
+			ret = liblazy_hal_query_union(&result, &sets[i]);
+		if (ret == 0 && ranges > 0) {
+			/* devices already found need no further checks */
+			candidates = sets[finds];
+			sets[finds].udis = NULL;
+			liblazy_hal_query_intersect(&candidates, &result, 0);
+			if (candidates.count > 0)
+				ret = liblazy_hal_query_filter(query, &candidates);
+			if (ret == 0)
+				ret = liblazy_hal_query_union(&result, &candidates);
+		}
+	}
+	if (ret)
+		goto Out;
+
+	for (i = 0; i < result.count; i++)
+		size += strlen(result.udis[i]) + 1;
+	*udis = liblazy_strlist_alloc(result.count, size, &pos);
+	if (*udis == NULL) {
+		ret = LIBLAZY_ERROR_GENERAL;
+		goto Out;
+	}
+	for (i = 0; i < result.count; i++) {
+		size = strlen(result.udis[i]) + 1;
+		memcpy(pos, result.udis[i], size);
+		(*udis)[i] = pos;
+		pos += size;
+	}
+
+Out:
+	for (i = 0; sets != NULL && i <= finds; i++)
+		free(sets[i].udis);
+	for (i = 0; replies != NULL && i <= finds; i++)
+		liblazy_reply_release(&replies[i]);
+	free(sets);
+	free(replies);
+	free(result.udis);
+	free(candidates.udis);
+	return ret;
+}
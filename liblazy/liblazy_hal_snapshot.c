@@ -0,0 +1,918 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* A snapshot file starts with a header, followed by the device records
+ * sorted by udi, the property records of all devices, those of each
+ * device sorted by key, the string lists and the strings. Everything is
+ * in host byte order and referenced by offsets, so the file is used just
+ * as it is mapped */
+#define SNAPSHOT_MAGIC		"LZYHALSN"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_BYTE_ORDER	0x01020304
+/* alignment of the regions, enough for the 64 bit values */
+#define SNAPSHOT_ALIGN		8
+
+struct snapshot_header {
+	char		magic[8];
+	dbus_uint32_t	version;
+	dbus_uint32_t	byte_order;
+	/* seconds since the epoch */
+	dbus_uint64_t	created;
+	dbus_uint32_t	device_count;
+	dbus_uint32_t	devices;
+	dbus_uint32_t	property_count;
+	dbus_uint32_t	properties;
+	/* in words, each list is its length followed by string offsets */
+	dbus_uint32_t	lists_size;
+	dbus_uint32_t	lists;
+	dbus_uint32_t	strings_size;
+	dbus_uint32_t	strings;
+};
+
+struct snapshot_device {
+	dbus_uint32_t	udi;
+	dbus_uint32_t	first_property;
+	dbus_uint32_t	property_count;
+	dbus_uint32_t	reserved;
+};
+
+struct snapshot_property {
+	dbus_uint32_t	key;
+	dbus_uint32_t	type;
+	union {
+		dbus_int32_t	int_value;
+		dbus_uint64_t	uint64_value;
+		double		double_value;
+		dbus_bool_t	bool_value;
+		/* offset of a string or of a string list */
+		dbus_uint32_t	offset;
+	} v;
+};
+
+/* a mapped snapshot file */
+struct hal_snapshot {
+	int				refcount;
+	void				*data;
+	size_t				size;
+	const struct snapshot_device	*devices;
+	dbus_uint32_t			device_count;
+	const struct snapshot_property	*properties;
+	const dbus_uint32_t		*lists;
+	const char			*strings;
+};
+
+/* a region of a snapshot while it is built */
+struct snapshot_buffer {
+	char	*data;
+	size_t	used;
+	size_t	size;
+};
+
+/* a device while its snapshot is built */
+struct snapshot_source {
+	const char		*udi;
+	LiblazyHalProperties	*properties;
+};
+
+/* protects the pointer to the snapshot in use, the snapshot itself is
+ * read-only and reference counted */
+static pthread_mutex_t		snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hal_snapshot	*current_snapshot = NULL;
+
+static struct hal_snapshot *liblazy_hal_snapshot_get(void)
+{
+	struct hal_snapshot *snapshot;
+
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot = current_snapshot;
+	if (snapshot != NULL)
+		__sync_add_and_fetch(&snapshot->refcount, 1);
+	pthread_mutex_unlock(&snapshot_lock);
+	return snapshot;
+}
+
+void liblazy_hal_snapshot_unref(struct hal_snapshot *snapshot)
+{
+	if (__sync_sub_and_fetch(&snapshot->refcount, 1) > 0)
+		return;
+	munmap(snapshot->data, snapshot->size);
+	free(snapshot);
+}
+
+static const struct snapshot_device *liblazy_hal_snapshot_find_device(const struct hal_snapshot *snapshot,
+								      const char *udi)
+{
+	dbus_uint32_t	low	= 0;
+	dbus_uint32_t	high	= snapshot->device_count;
+	dbus_uint32_t	middle;
+	int		cmp;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		cmp = strcmp(udi, snapshot->strings +
+			     snapshot->devices[middle].udi);
+		if (cmp == 0)
+			return &snapshot->devices[middle];
+		if (cmp < 0)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+	return NULL;
+}
+
+static const struct snapshot_property *liblazy_hal_snapshot_find_property(const struct hal_snapshot *snapshot,
+									  const struct snapshot_device *device,
+									  const char *key)
+{
+	const struct snapshot_property	*properties;
+	dbus_uint32_t			low	= 0;
+	dbus_uint32_t			high	= device->property_count;
+	dbus_uint32_t			middle;
+	int				cmp;
+
+	properties = snapshot->properties + device->first_property;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		cmp = strcmp(key, snapshot->strings + properties[middle].key);
+		if (cmp == 0)
+			return &properties[middle];
+		if (cmp < 0)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+	return NULL;
+}
+
+/* points the string list buffer of the reply to the strings of a list */
+static int liblazy_hal_snapshot_get_strlist(const struct hal_snapshot *snapshot,
+					    dbus_uint32_t offset, LiblazyReply *reply,
+					    const char ***strlist)
+{
+	const dbus_uint32_t	*list	= snapshot->lists + offset;
+	dbus_uint32_t		i;
+
+	if (liblazy_reply_reserve_strlist(reply, list[0] + 1))
+		return LIBLAZY_ERROR_GENERAL;
+
+	for (i = 0; i < list[0]; i++)
+		reply->strlist[i] = snapshot->strings + list[i + 1];
+	reply->strlist[i] = NULL;
+	*strlist = reply->strlist;
+	return 0;
+}
+
+int liblazy_hal_snapshot_get_property(const char *udi, const char *property,
+				      int type, LiblazyReply *reply, void *value)
+{
+	struct hal_snapshot		*snapshot;
+	const struct snapshot_device	*device;
+	const struct snapshot_property	*entry;
+	int				ret	= 0;
+
+	/* invalid arguments are reported by the regular path */
+	if (udi == NULL || property == NULL)
+		return LIBLAZY_HAL_SNAPSHOT_MISS;
+
+	snapshot = liblazy_hal_snapshot_get();
+	if (snapshot == NULL)
+		return LIBLAZY_HAL_SNAPSHOT_MISS;
+
+	/* devices added after the snapshot was taken are asked for */
+	device = liblazy_hal_snapshot_find_device(snapshot, udi);
+	if (device == NULL) {
+		ret = LIBLAZY_HAL_SNAPSHOT_MISS;
+		goto Out;
+	}
+
+	entry = liblazy_hal_snapshot_find_property(snapshot, device, property);
+	if (entry == NULL) {
+		ret = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+		goto Out;
+	}
+	if (entry->type != type) {
+		ret = LIBLAZY_ERROR_HAL_TYPE_MISMATCH;
+		goto Out;
+	}
+
+	switch (type) {
+	case DBUS_TYPE_INT32:
+		*(int *)value = entry->v.int_value;
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		*(int *)value = entry->v.bool_value;
+		break;
+	case DBUS_TYPE_STRING:
+		*(const char **)value = snapshot->strings + entry->v.offset;
+		goto Keep;
+	case DBUS_TYPE_ARRAY:
+		ret = liblazy_hal_snapshot_get_strlist(snapshot, entry->v.offset,
+						       reply, value);
+		if (ret)
+			goto Out;
+		goto Keep;
+	default:
+		ret = LIBLAZY_ERROR_INVALID_ARGUMENT;
+	}
+
+Out:
+	liblazy_hal_snapshot_unref(snapshot);
+	return ret;
+Keep:
+	/* the value is borrowed, keep the snapshot mapped for the reply */
+	reply->snapshot = snapshot;
+	return 0;
+}
+
+int liblazy_hal_snapshot_get_number(const char *udi, const char *property,
+				    int *type, union hal_number *value)
+{
+	struct hal_snapshot		*snapshot;
+	const struct snapshot_device	*device;
+	const struct snapshot_property	*entry;
+	int				ret	= 0;
+
+	snapshot = liblazy_hal_snapshot_get();
+	if (snapshot == NULL)
+		return LIBLAZY_HAL_SNAPSHOT_MISS;
+
+	device = liblazy_hal_snapshot_find_device(snapshot, udi);
+	if (device == NULL) {
+		ret = LIBLAZY_HAL_SNAPSHOT_MISS;
+		goto Out;
+	}
+
+	entry = liblazy_hal_snapshot_find_property(snapshot, device, property);
+	if (entry == NULL) {
+		ret = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+		goto Out;
+	}
+
+	*type = entry->type;
+	switch (entry->type) {
+	case DBUS_TYPE_INT32:
+		value->int32 = entry->v.int_value;
+		break;
+	case DBUS_TYPE_UINT64:
+		value->uint64 = entry->v.uint64_value;
+		break;
+	case DBUS_TYPE_DOUBLE:
+		value->number = entry->v.double_value;
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		value->boolean = entry->v.bool_value;
+		break;
+	}
+
+Out:
+	liblazy_hal_snapshot_unref(snapshot);
+	return ret;
+}
+
+/* returns 1 if the device has the capability or the string property */
+static int liblazy_hal_snapshot_match(const struct hal_snapshot *snapshot,
+				      const struct snapshot_device *device,
+				      const char *key, const char *value)
+{
+	const struct snapshot_property	*entry;
+	const dbus_uint32_t		*list;
+	dbus_uint32_t			i;
+
+	if (key != NULL) {
+		entry = liblazy_hal_snapshot_find_property(snapshot, device, key);
+		return entry != NULL && entry->type == DBUS_TYPE_STRING &&
+			strcmp(snapshot->strings + entry->v.offset, value) == 0;
+	}
+
+	entry = liblazy_hal_snapshot_find_property(snapshot, device,
+						   "info.capabilities");
+	if (entry == NULL || entry->type != DBUS_TYPE_ARRAY)
+		return 0;
+
+	list = snapshot->lists + entry->v.offset;
+	for (i = 0; i < list[0]; i++) {
+		if (strcmp(snapshot->strings + list[i + 1], value) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+int liblazy_hal_snapshot_find(const char *key, const char *value,
+			      LiblazyReply *reply, const char ***strlist)
+{
+	struct hal_snapshot	*snapshot;
+	dbus_uint32_t		i;
+	int			count	= 0;
+
+	if (value == NULL)
+		return LIBLAZY_HAL_SNAPSHOT_MISS;
+
+	snapshot = liblazy_hal_snapshot_get();
+	if (snapshot == NULL)
+		return LIBLAZY_HAL_SNAPSHOT_MISS;
+
+	for (i = 0; i < snapshot->device_count; i++) {
+		if (!liblazy_hal_snapshot_match(snapshot, &snapshot->devices[i],
+						key, value))
+			continue;
+		if (liblazy_reply_reserve_strlist(reply, count + 2)) {
+			liblazy_hal_snapshot_unref(snapshot);
+			return LIBLAZY_ERROR_GENERAL;
+		}
+		reply->strlist[count++] = snapshot->strings +
+			snapshot->devices[i].udi;
+	}
+
+	if (liblazy_reply_reserve_strlist(reply, count + 1)) {
+		liblazy_hal_snapshot_unref(snapshot);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	reply->strlist[count] = NULL;
+	*strlist = reply->strlist;
+	reply->snapshot = snapshot;
+	return 0;
+}
+
+/* returns 1 if count elements of the given size fit at offset */
+static int liblazy_hal_snapshot_fits(const struct hal_snapshot *snapshot,
+				     dbus_uint32_t offset, dbus_uint32_t count,
+				     size_t size)
+{
+	return offset % SNAPSHOT_ALIGN == 0 && offset <= snapshot->size &&
+		count <= (snapshot->size - offset) / size;
+}
+
+/* checks all offsets once, so lookups can trust them */
+static int liblazy_hal_snapshot_check(struct hal_snapshot *snapshot)
+{
+	const struct snapshot_header	*header = snapshot->data;
+	const struct snapshot_device	*device;
+	const struct snapshot_property	*property;
+	const dbus_uint32_t		*list;
+	dbus_uint32_t			i;
+	dbus_uint32_t			j;
+
+	if (!liblazy_hal_snapshot_fits(snapshot, header->devices,
+				       header->device_count,
+				       sizeof(struct snapshot_device)) ||
+	    !liblazy_hal_snapshot_fits(snapshot, header->properties,
+				       header->property_count,
+				       sizeof(struct snapshot_property)) ||
+	    !liblazy_hal_snapshot_fits(snapshot, header->lists,
+				       header->lists_size, sizeof(dbus_uint32_t)) ||
+	    !liblazy_hal_snapshot_fits(snapshot, header->strings,
+				       header->strings_size, 1) ||
+	    header->strings_size == 0)
+		return 0;
+
+	snapshot->devices = (const void *)((const char *)snapshot->data +
+					   header->devices);
+	snapshot->device_count = header->device_count;
+	snapshot->properties = (const void *)((const char *)snapshot->data +
+					      header->properties);
+	snapshot->lists = (const void *)((const char *)snapshot->data +
+					 header->lists);
+	snapshot->strings = (const char *)snapshot->data + header->strings;
+
+	/* every string ends before the end of the region */
+	if (snapshot->strings[header->strings_size - 1] != '\0')
+		return 0;
+
+	for (i = 0; i < header->device_count; i++) {
+		device = &snapshot->devices[i];
+		if (device->udi >= header->strings_size ||
+		    device->property_count > header->property_count ||
+		    device->first_property > header->property_count -
+		    device->property_count)
+			return 0;
+	}
+
+	for (i = 0; i < header->property_count; i++) {
+		property = &snapshot->properties[i];
+		if (property->key >= header->strings_size)
+			return 0;
+
+		switch (property->type) {
+		case DBUS_TYPE_INT32:
+		case DBUS_TYPE_UINT64:
+		case DBUS_TYPE_DOUBLE:
+		case DBUS_TYPE_BOOLEAN:
+			break;
+		case DBUS_TYPE_STRING:
+			if (property->v.offset >= header->strings_size)
+				return 0;
+			break;
+		case DBUS_TYPE_ARRAY:
+			if (property->v.offset >= header->lists_size)
+				return 0;
+			list = snapshot->lists + property->v.offset;
+			if (list[0] > header->lists_size - property->v.offset - 1)
+				return 0;
+			for (j = 0; j < list[0]; j++) {
+				if (list[j + 1] >= header->strings_size)
+					return 0;
+			}
+			break;
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int liblazy_hal_use_snapshot(const char *path, int max_age)
+{
+	const struct snapshot_header	*header;
+	struct hal_snapshot		*snapshot;
+	struct hal_snapshot		*old;
+	struct stat			stat_buf;
+	time_t				now;
+	int				fd;
+	int				ret	= LIBLAZY_ERROR_HAL_SNAPSHOT_INVALID;
+
+	if (path == NULL) {
+		snapshot = NULL;
+		goto Swap;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		/* not having a snapshot yet is nothing to complain about */
+		if (errno != ENOENT)
+			ERROR("Could not open snapshot %s: %s", path,
+			      strerror(errno));
+		return LIBLAZY_ERROR_HAL_SNAPSHOT_INVALID;
+	}
+
+	snapshot = calloc(1, sizeof(struct hal_snapshot));
+	if (snapshot == NULL) {
+		ERROR("Could not allocate snapshot: OOM");
+		close(fd);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	if (fstat(fd, &stat_buf) < 0 ||
+	    (size_t)stat_buf.st_size < sizeof(struct snapshot_header)) {
+		ERROR("Snapshot %s is truncated", path);
+		close(fd);
+		free(snapshot);
+		return ret;
+	}
+
+	snapshot->size = stat_buf.st_size;
+	snapshot->data = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snapshot->data == MAP_FAILED) {
+		ERROR("Could not map snapshot %s: %s", path, strerror(errno));
+		free(snapshot);
+		return ret;
+	}
+	snapshot->refcount = 1;
+
+	header = snapshot->data;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != SNAPSHOT_VERSION ||
+	    header->byte_order != SNAPSHOT_BYTE_ORDER) {
+		ERROR("%s is not a snapshot of this version", path);
+		goto Error;
+	}
+
+	now = time(NULL);
+	if (max_age > 0 && (header->created > (dbus_uint64_t)now ||
+			    now - header->created > (dbus_uint64_t)max_age)) {
+		ret = LIBLAZY_ERROR_HAL_SNAPSHOT_STALE;
+		goto Error;
+	}
+
+	if (!liblazy_hal_snapshot_check(snapshot)) {
+		ERROR("Snapshot %s is corrupt", path);
+		goto Error;
+	}
+
+Swap:
+	pthread_mutex_lock(&snapshot_lock);
+	old = current_snapshot;
+	current_snapshot = snapshot;
+	pthread_mutex_unlock(&snapshot_lock);
+	if (old != NULL)
+		liblazy_hal_snapshot_unref(old);
+	return 0;
+
+Error:
+	liblazy_hal_snapshot_unref(snapshot);
+	return ret;
+}
+
+/* appends data to the buffer and returns its offset or -1 on OOM */
+static long liblazy_hal_snapshot_append(struct snapshot_buffer *buffer,
+					const void *data, size_t size)
+{
+	char	*grown;
+	size_t	new_size;
+	size_t	offset	= buffer->used;
+
+	if (buffer->used + size > buffer->size) {
+		new_size = buffer->size ? buffer->size : 4096;
+		while (new_size < buffer->used + size)
+			new_size *= 2;
+		grown = realloc(buffer->data, new_size);
+		if (grown == NULL)
+			return -1;
+		buffer->data = grown;
+		buffer->size = new_size;
+	}
+	memcpy(buffer->data + buffer->used, data, size);
+	buffer->used += size;
+	return offset;
+}
+
+static long liblazy_hal_snapshot_append_string(struct snapshot_buffer *strings,
+					       const char *string)
+{
+	return liblazy_hal_snapshot_append(strings, string, strlen(string) + 1);
+}
+
+static int liblazy_hal_snapshot_add_property(struct snapshot_buffer *properties,
+					     struct snapshot_buffer *lists,
+					     struct snapshot_buffer *strings,
+					     const LiblazyHalProperties *table,
+					     const char *key)
+{
+	struct snapshot_property	property;
+	const char			*string;
+	const char			**strlist;
+	dbus_uint32_t			word;
+	long				offset;
+	int				value;
+	int				i;
+
+	memset(&property, 0, sizeof(property));
+	property.type = liblazy_hal_properties_get_type(table, key);
+	if ((offset = liblazy_hal_snapshot_append_string(strings, key)) < 0)
+		return -1;
+	property.key = offset;
+
+	switch (property.type) {
+	case DBUS_TYPE_INT32:
+		liblazy_hal_properties_get_int(table, key, &value);
+		property.v.int_value = value;
+		break;
+	case DBUS_TYPE_UINT64:
+		liblazy_hal_properties_get_uint64(table, key,
+						  &property.v.uint64_value);
+		break;
+	case DBUS_TYPE_DOUBLE:
+		liblazy_hal_properties_get_double(table, key,
+						  &property.v.double_value);
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		liblazy_hal_properties_get_bool(table, key, &value);
+		property.v.bool_value = value;
+		break;
+	case DBUS_TYPE_STRING:
+		liblazy_hal_properties_get_string(table, key, &string);
+		if ((offset = liblazy_hal_snapshot_append_string(strings, string)) < 0)
+			return -1;
+		property.v.offset = offset;
+		break;
+	case DBUS_TYPE_ARRAY:
+		liblazy_hal_properties_get_strlist(table, key, &strlist);
+		for (word = 0; strlist[word] != NULL; word++)
+			;
+		offset = liblazy_hal_snapshot_append(lists, &word, sizeof(word));
+		if (offset < 0)
+			return -1;
+		property.v.offset = offset / sizeof(dbus_uint32_t);
+		for (i = 0; strlist[i] != NULL; i++) {
+			if ((offset = liblazy_hal_snapshot_append_string(strings,
+									 strlist[i])) < 0)
+				return -1;
+			word = offset;
+			if (liblazy_hal_snapshot_append(lists, &word, sizeof(word)) < 0)
+				return -1;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	return liblazy_hal_snapshot_append(properties, &property,
+					   sizeof(property)) < 0 ? -1 : 0;
+}
+
+static int liblazy_hal_snapshot_source_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct snapshot_source *)a)->udi,
+		      ((const struct snapshot_source *)b)->udi);
+}
+
+static size_t liblazy_hal_snapshot_align(size_t offset)
+{
+	return (offset + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+static int liblazy_hal_snapshot_write_all(int fd, const void *data, size_t size)
+{
+	const char	*pos	= data;
+	ssize_t		written;
+
+	while (size > 0) {
+		written = write(fd, pos, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		pos += written;
+		size -= written;
+	}
+	return 0;
+}
+
+/* writes the header and the regions, each aligned */
+static int liblazy_hal_snapshot_write_file(int fd, struct snapshot_header *header,
+					   struct snapshot_buffer *regions[4])
+{
+	static const char	padding[SNAPSHOT_ALIGN];
+	size_t			offset;
+	dbus_uint32_t		*offsets[4];
+	int			i;
+
+	offsets[0] = &header->devices;
+	offsets[1] = &header->properties;
+	offsets[2] = &header->lists;
+	offsets[3] = &header->strings;
+
+	offset = sizeof(struct snapshot_header);
+	for (i = 0; i < 4; i++) {
+		offset = liblazy_hal_snapshot_align(offset);
+		*offsets[i] = offset;
+		offset += regions[i]->used;
+	}
+	if (offset > 0xffffffffUL) {
+		ERROR("Snapshot is too large");
+		return -1;
+	}
+
+	if (liblazy_hal_snapshot_write_all(fd, header, sizeof(*header)) < 0)
+		return -1;
+	offset = sizeof(struct snapshot_header);
+	for (i = 0; i < 4; i++) {
+		if (liblazy_hal_snapshot_write_all(fd, padding, *offsets[i] - offset) < 0 ||
+		    liblazy_hal_snapshot_write_all(fd, regions[i]->data,
+						   regions[i]->used) < 0)
+			return -1;
+		offset = *offsets[i] + regions[i]->used;
+	}
+	return 0;
+}
+
+/* fetches the properties of all devices with one pipelined round trip */
+static int liblazy_hal_snapshot_fetch(const char **udis, int count,
+				      struct snapshot_source *sources, int *fetched)
+{
+	DBusMessage	**messages;
+	DBusMessage	**replies;
+	DBusError	*errors;
+	int		ret	= LIBLAZY_ERROR_GENERAL;
+	int		i;
+
+	*fetched = 0;
+	messages = calloc(count + 1, sizeof(DBusMessage *));
+	replies = calloc(count + 1, sizeof(DBusMessage *));
+	errors = calloc(count + 1, sizeof(DBusError));
+	if (messages == NULL || replies == NULL || errors == NULL) {
+		ERROR("Could not allocate calls: OOM");
+		goto Free;
+	}
+
+	for (i = 0; i < count; i++) {
+		dbus_error_init(&errors[i]);
+		messages[i] = dbus_message_new_method_call(DBUS_HAL_SERVICE, udis[i],
+							   DBUS_HAL_DEVICE_INTERFACE,
+							   "GetAllProperties");
+		if (messages[i] == NULL) {
+			ERROR("Could not create method call GetAllProperties: OOM");
+			goto Unref;
+		}
+	}
+
+	ret = liblazy_dbus_send_messages(DBUS_BUS_SYSTEM, messages, count,
+					 replies, errors);
+
+	for (i = 0; i < count; i++) {
+		if (replies[i] == NULL) {
+			/* the device went away meanwhile */
+			if (dbus_error_is_set(&errors[i]))
+				ERROR("Could not fetch properties of %s: %s",
+				      udis[i], errors[i].message);
+			continue;
+		}
+		sources[*fetched].udi = udis[i];
+		sources[*fetched].properties =
+			liblazy_hal_properties_new_from_reply(replies[i]);
+		dbus_message_unref(replies[i]);
+		if (sources[*fetched].properties == NULL) {
+			ret = LIBLAZY_ERROR_GENERAL;
+			continue;
+		}
+		(*fetched)++;
+	}
+
+Unref:
+	for (i = 0; i < count; i++) {
+		if (messages[i] != NULL)
+			dbus_message_unref(messages[i]);
+		dbus_error_free(&errors[i]);
+	}
+Free:
+	free(messages);
+	free(replies);
+	free(errors);
+	return ret;
+}
+
+int liblazy_hal_write_snapshot(const char *path)
+{
+	struct snapshot_header	header;
+	struct snapshot_buffer	devices		= { NULL, 0, 0 };
+	struct snapshot_buffer	properties	= { NULL, 0, 0 };
+	struct snapshot_buffer	lists		= { NULL, 0, 0 };
+	struct snapshot_buffer	strings		= { NULL, 0, 0 };
+	struct snapshot_buffer	*regions[4]	= { &devices, &properties,
+						    &lists, &strings };
+	struct snapshot_device	device;
+	struct snapshot_source	*sources	= NULL;
+	LiblazyReply		reply		= LIBLAZY_REPLY_INIT;
+	DBusMessage		*message;
+	DBusMessage		*all_devices;
+	DBusMessageIter		iter;
+	const char		**udis;
+	char			*tmp_path	= NULL;
+	long			offset;
+	int			count;
+	int			fetched		= 0;
+	int			fd		= -1;
+	int			ret;
+	int			i;
+	int			j;
+
+	if (path == NULL)
+		return LIBLAZY_ERROR_INVALID_ARGUMENT;
+
+	message = dbus_message_new_method_call(DBUS_HAL_SERVICE,
+					       DBUS_HAL_MANAGER_PATH,
+					       DBUS_HAL_MANAGER_INTERFACE,
+					       "GetAllDevices");
+	if (message == NULL) {
+		ERROR("Could not create method call GetAllDevices: OOM");
+		return LIBLAZY_ERROR_GENERAL;
+	}
+	ret = liblazy_dbus_send_message(DBUS_BUS_SYSTEM, message, &all_devices,
+					-1, NULL, NULL);
+	dbus_message_unref(message);
+	if (ret) {
+		ERROR("Error fetching the devices from HAL");
+		return ret;
+	}
+
+	liblazy_reply_set_message(&reply, all_devices);
+	dbus_message_iter_init(all_devices, &iter);
+	ret = liblazy_reply_get_strlist(&reply, &iter, &udis);
+	if (ret)
+		goto Out;
+
+	for (count = 0; udis[count] != NULL; count++)
+		;
+	sources = calloc(count + 1, sizeof(struct snapshot_source));
+	if (sources == NULL) {
+		ERROR("Could not allocate devices: OOM");
+		ret = LIBLAZY_ERROR_GENERAL;
+		goto Out;
+	}
+
+	ret = liblazy_hal_snapshot_fetch(udis, count, sources, &fetched);
+	if (ret)
+		goto Out;
+
+	qsort(sources, fetched, sizeof(struct snapshot_source),
+	      liblazy_hal_snapshot_source_compare);
+
+	ret = LIBLAZY_ERROR_GENERAL;
+	memset(&device, 0, sizeof(device));
+	for (i = 0; i < fetched; i++) {
+		if ((offset = liblazy_hal_snapshot_append_string(&strings,
+								 sources[i].udi)) < 0)
+			goto Oom;
+		device.udi = offset;
+		device.first_property = properties.used /
+			sizeof(struct snapshot_property);
+
+		/* the keys of a property table are sorted already */
+		for (j = 0; j < liblazy_hal_properties_count(sources[i].properties); j++) {
+			if (liblazy_hal_snapshot_add_property(&properties, &lists,
+							      &strings,
+							      sources[i].properties,
+							      liblazy_hal_properties_get_key(sources[i].properties, j)) < 0)
+				goto Oom;
+		}
+		device.property_count = properties.used /
+			sizeof(struct snapshot_property) - device.first_property;
+		if (liblazy_hal_snapshot_append(&devices, &device, sizeof(device)) < 0)
+			goto Oom;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.created = time(NULL);
+	header.device_count = fetched;
+	header.property_count = properties.used / sizeof(struct snapshot_property);
+	header.lists_size = lists.used / sizeof(dbus_uint32_t);
+	header.strings_size = strings.used;
+
+	/* write a new file and move it over the old one, so readers never
+	 * see a partial snapshot */
+	tmp_path = malloc(strlen(path) + sizeof(".XXXXXX"));
+	if (tmp_path == NULL)
+		goto Oom;
+	sprintf(tmp_path, "%s.XXXXXX", path);
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		ERROR("Could not create %s: %s", tmp_path, strerror(errno));
+		goto Out;
+	}
+	if (fchmod(fd, 0644) < 0 ||
+	    liblazy_hal_snapshot_write_file(fd, &header, regions) < 0) {
+		ERROR("Could not write snapshot %s: %s", path, strerror(errno));
+		goto Out;
+	}
+	if (close(fd) < 0) {
+		ERROR("Could not write snapshot %s: %s", path, strerror(errno));
+		fd = -1;
+		unlink(tmp_path);
+		goto Out;
+	}
+	fd = -1;
+	if (rename(tmp_path, path) < 0) {
+		ERROR("Could not rename snapshot to %s: %s", path, strerror(errno));
+		unlink(tmp_path);
+		goto Out;
+	}
+	ret = 0;
+	goto Out;
+
+Oom:
+	ERROR("Could not build snapshot: OOM");
+Out:
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	for (i = 0; i < fetched; i++)
+		liblazy_hal_free_properties(sources[i].properties);
+	free(sources);
+	for (i = 0; i < 4; i++)
+		free(regions[i]->data);
+	liblazy_reply_release(&reply);
+	return ret;
+}
@@ -26,15 +26,298 @@
 #ifndef LIBLAZY_LOCAL_H
 #define LIBLAZY_LOCAL_H
 
-#define ERROR(string, args...) \
+#include "config.h"
+
+#include <time.h>
+
+#define DBUS_HAL_SERVICE		"org.freedesktop.Hal"
+#define DBUS_HAL_DEVICE_INTERFACE	"org.freedesktop.Hal.Device"
+#define DBUS_HAL_MANAGER_PATH		"/org/freedesktop/Hal/Manager"
+#define DBUS_HAL_MANAGER_INTERFACE	"org.freedesktop.Hal.Manager"
+#define DBUS_HAL_COMPUTER_PATH		"/org/freedesktop/Hal/devices/computer"
+
+#define DBUS_HAL_ERROR_NO_SUCH_DEVICE	"org.freedesktop.Hal.NoSuchDevice"
+#define DBUS_HAL_ERROR_NO_SUCH_PROPERTY	"org.freedesktop.Hal.NoSuchProperty"
+#define DBUS_HAL_ERROR_TYPE_MISMATCH	"org.freedesktop.Hal.TypeMismatch"
+
+/* matches HAL (re)starting or going away */
+#define DBUS_HAL_MATCH_NAME_OWNER_CHANGED	"type='signal',"			\
+						"sender='" DBUS_SERVICE_DBUS "',"	\
+						"interface='" DBUS_INTERFACE_DBUS "',"	\
+						"member='NameOwnerChanged',"		\
+						"arg0='" DBUS_HAL_SERVICE "'"
+
+/* rate limit state of one place logging messages */
+struct liblazy_log_site {
+	struct timespec	window;
+	int		count;
+	unsigned long	suppressed;
+};
+
+/* the highest level passed to the sink, 0 if there is no sink */
+extern volatile int liblazy_log_threshold;
+
+/* passes a message to the sink unless the site logged too much lately */
+void liblazy_log(struct liblazy_log_site *site, int level,
+		 const char *function, int line, const char *format, ...)
+	__attribute__((format(printf, 5, 6)));
+
+/* arguments are only evaluated if the message is going to be logged */
+#define LOG(level, string, args...) \
 do{\
-	fprintf(stderr, "liblazy (%s:%d): "string"\n", __FUNCTION__, __LINE__, ## args); \
-}while(0);
+	static struct liblazy_log_site __log_site; \
+	if (level <= liblazy_log_threshold) \
+		liblazy_log(&__log_site, level, __FUNCTION__, __LINE__, string, ## args); \
+}while(0)
 
+#define ERROR(string, args...) LOG(LIBLAZY_LOG_ERROR, string, ## args);
+
+/* calls a connection may have in flight. The bus daemon answers calls
+ * beyond its max_replies_per_connection with LimitsExceeded, which is 128
+ * for the system bus of most distributions */
+#define LIBLAZY_DBUS_MAX_PENDING	128
+
+/* the timeout libdbus uses for calls without one, in milliseconds. Calls
+ * libdbus doesn't wait for itself need it spelled out */
+#define LIBLAZY_DBUS_DEFAULT_TIMEOUT	25000
+
+/* name of the error set when a cancellable call was cancelled */
+#define LIBLAZY_DBUS_ERROR_CANCELLED	"org.freedesktop.liblazy.Cancelled"
+
+/* timeout -1 means the default set with liblazy_dbus_set_default_timeout */
 int liblazy_dbus_send_method_call(const char *destination, const char *path,
 				  const char *interface, const char *method,
 				  int bus_type,
-				  DBusMessage **reply,
+				  DBusMessage **reply, int timeout,
+				  LiblazyCancellable *cancellable,
 				  int first_arg_type, va_list var_args);
 
+/* returns the timeout in milliseconds to use for a call, resolving -1 to
+ * the library default */
+int liblazy_dbus_get_timeout(int timeout);
+
+/* maps an error reply to a LIBLAZY_ERROR_* */
+int liblazy_dbus_error_code(DBusError *dbus_error);
+
+/* makes libdbus thread-safe, called before the library touches libdbus */
+void liblazy_dbus_threads_init(void);
+
+/* returns a new reference to the connection used for the given bus or NULL
+ * if the bus is not available. Has to be unreffed by the caller */
+DBusConnection *liblazy_dbus_get_connection(int bus_type, const char *what);
+
+/* opens and registers a new private connection to the given bus, which
+ * has to be closed and unreffed by the caller */
+DBusConnection *liblazy_dbus_open_private(int bus_type, DBusError *dbus_error);
+
+/* opens a private connection that receives the signals matching the NULL
+ * terminated rules and passes them to filter */
+DBusConnection *liblazy_dbus_open_watch(int bus_type, const char * const *rules,
+					DBusHandleMessageFunction filter,
+					DBusError *dbus_error);
+
+/* closes a connection opened with liblazy_dbus_open_watch */
+void liblazy_dbus_close_watch(DBusConnection *dbus_connection,
+			      DBusHandleMessageFunction filter);
+
+/* passes all signals received since the last call to the filter. Returns
+ * 0 if the connection was lost, so signals may be missing */
+int liblazy_dbus_dispatch_watch(DBusConnection *dbus_connection);
+
+/* sends an already built message. If error is not NULL, an error reply is
+ * moved there instead of being reported, so the caller can inspect it */
+int liblazy_dbus_send_message(int bus_type, DBusMessage *message,
+			      DBusMessage **reply, int timeout,
+			      LiblazyCancellable *cancellable, DBusError *error);
+
+/* like liblazy_dbus_send_message, but over a connection of the caller,
+ * which is not dispatched while waiting for the reply. Traced and counted
+ * like any other call */
+int liblazy_dbus_send_message_on(DBusConnection *dbus_connection,
+				 DBusMessage *message, DBusMessage **reply,
+				 int timeout, DBusError *error);
+
+/* like liblazy_dbus_send_message, but to the peer at the given address,
+ * connecting to it if needed */
+int liblazy_dbus_send_message_to_address(const char *address,
+					 DBusMessage *message,
+					 DBusMessage **reply, int timeout,
+					 LiblazyCancellable *cancellable);
+
+/* sends all messages back to back on one connection and waits for the
+ * replies afterwards, keeping at most LIBLAZY_DBUS_MAX_PENDING of them in
+ * flight. Each replies[i] is either a method return or NULL with
+ * errors[i] set, errors have to be initialized by the caller */
+int liblazy_dbus_send_messages(int bus_type, DBusMessage **messages, int count,
+			       DBusMessage **replies, DBusError *errors);
+
+/* set while a trace callback is installed */
+extern volatile int liblazy_trace_enabled;
+
+#ifdef HAVE_SYS_SDT_H
+/* semaphores of the USDT probes, a tracer attached to a probe counts
+ * itself in its semaphore */
+extern volatile unsigned short liblazy_call__start_semaphore;
+extern volatile unsigned short liblazy_reply__received_semaphore;
+extern volatile unsigned short liblazy_error_semaphore;
+extern volatile unsigned short liblazy_decode__done_semaphore;
+
+/* true while liblazy_trace_call and liblazy_trace_decoded should be called */
+#define TRACE_ENABLED	(liblazy_trace_enabled ||			\
+			 liblazy_call__start_semaphore ||		\
+			 liblazy_reply__received_semaphore ||		\
+			 liblazy_error_semaphore ||			\
+			 liblazy_decode__done_semaphore)
+#else
+#define TRACE_ENABLED	liblazy_trace_enabled
+#endif
+
+/* fires the probe and the callback for event of a call or signal */
+void liblazy_trace_call(int event, DBusMessage *message, int error);
+
+/* fires the probe and the callback once a reply was decoded */
+void liblazy_trace_decoded(DBusMessage *reply, int error);
+
+/* set while liblazy_stats_record should be called */
+extern volatile int liblazy_stats_enabled;
+
+/* remembers when a call started, for liblazy_stats_record */
+void liblazy_stats_start(struct timespec *started);
+
+/* counts a finished call or signal for the calling thread. round_trip is 1
+ * if the caller waited for the reply, error_name the name of an error
+ * reply if there was one */
+void liblazy_stats_record(DBusMessage *message, DBusMessage *reply,
+			  int round_trip, const struct timespec *started,
+			  int ret, const char *error_name);
+
+/* sets deadline to msec milliseconds from now on the monotonic clock */
+void liblazy_deadline_set(struct timespec *deadline, int msec);
+
+/* returns 1 if the deadline is reached */
+int liblazy_deadline_passed(const struct timespec *deadline);
+
+/* returns the milliseconds left until the deadline, <= 0 once reached */
+long liblazy_deadline_remaining(const struct timespec *deadline);
+
+/* allocates a string list for count strings of size bytes in total,
+ * including their terminators, with the NULL terminator already set.
+ * strings is set to where the strings go, in the same block, which
+ * liblazy_free_strlist recognizes by a tag and frees with a single free */
+char **liblazy_strlist_alloc(int count, size_t size, char **strings);
+
+/* copies a NULL terminated string array into a string list */
+char **liblazy_strlist_copy(const char **strlist);
+
+/* copies the string array the iterator points to into a string list */
+char **liblazy_dbus_get_strlist_from_array(DBusMessageIter *reply_iter);
+
+struct hal_snapshot;
+
+/* borrowed values point into the message, the property table or the
+ * device snapshot */
+struct _LiblazyReply {
+	DBusMessage		*message;
+	LiblazyHalProperties	*properties;
+	struct hal_snapshot	*snapshot;
+	/* pointers handed out as borrowed string lists, reused between calls */
+	const char		**strlist;
+	int			strlist_size;
+};
+
+#define LIBLAZY_REPLY_INIT	{ NULL, NULL, NULL, NULL, 0 }
+
+/* drops the message or table held by the reply, keeping its buffers */
+void liblazy_reply_clear(LiblazyReply *reply);
+
+/* like liblazy_reply_clear, but frees the buffers as well. For replies
+ * that live on the stack */
+void liblazy_reply_release(LiblazyReply *reply);
+
+/* lets the reply hold the given reference to a message */
+void liblazy_reply_set_message(LiblazyReply *reply, DBusMessage *message);
+
+/* lets the reply hold the given reference to a property table */
+void liblazy_reply_set_properties(LiblazyReply *reply,
+				  LiblazyHalProperties *properties);
+
+/* makes room for at least size pointers in the string list buffer */
+int liblazy_reply_reserve_strlist(LiblazyReply *reply, int size);
+
+/* points strlist to the strings of the array the iterator points to. The
+ * iterator has to belong to the message held by the reply */
+int liblazy_reply_get_strlist(LiblazyReply *reply, DBusMessageIter *iter,
+			      const char ***strlist);
+
+/* creates a call of one of HAL's GetProperty* methods */
+DBusMessage *liblazy_hal_new_property_call(const char *udi, const char *property,
+					  const char *method);
+
+/* maps an error reply of a GetProperty* call to a LIBLAZY_ERROR_* */
+int liblazy_hal_property_error(const char *udi, const char *property,
+			       const char *method, DBusError *dbus_error);
+
+/* returns 1 if HAL recently told us that the property does not exist */
+int liblazy_hal_is_missing(const char *udi, const char *property);
+
+/* decodes the a{sv} reply of GetAllProperties into a property table */
+LiblazyHalProperties *liblazy_hal_properties_new_from_reply(DBusMessage *reply);
+
+/* takes another reference to a property table, dropped again by
+ * liblazy_hal_free_properties */
+LiblazyHalProperties *liblazy_hal_properties_ref(LiblazyHalProperties *properties);
+
+/* returned by the snapshot lookups if the snapshot can't answer and HAL
+ * has to be asked */
+#define LIBLAZY_HAL_SNAPSHOT_MISS	1
+
+/* gets a property of the given DBUS_TYPE_* from the device snapshot. int
+ * and boolean values are stored in an int, strings (const char **) and
+ * string lists (DBUS_TYPE_ARRAY, const char ***) are borrowed from the
+ * snapshot, which the reply keeps mapped */
+int liblazy_hal_snapshot_get_property(const char *udi, const char *property,
+				      int type, LiblazyReply *reply, void *value);
+
+/* a numeric property, in whichever of the D-Bus types HAL gave it */
+union hal_number {
+	dbus_int32_t	int32;
+	dbus_uint32_t	uint32;
+	dbus_int64_t	int64;
+	dbus_uint64_t	uint64;
+	dbus_bool_t	boolean;
+	double		number;
+};
+
+/* gets a property of any type from the device snapshot. *type is set to
+ * its DBUS_TYPE_*, value is only filled in for numbers and booleans */
+int liblazy_hal_snapshot_get_number(const char *udi, const char *property,
+				    int *type, union hal_number *value);
+
+/* finds the devices in the snapshot having the string property key set to
+ * value or, if key is NULL, having the capability value */
+int liblazy_hal_snapshot_find(const char *key, const char *value,
+			      LiblazyReply *reply, const char ***strlist);
+
+/* drops a reference to a snapshot */
+void liblazy_hal_snapshot_unref(struct hal_snapshot *snapshot);
+
+/* drops the indexed capabilities of a device */
+void liblazy_hal_capability_forget(const char *udi);
+
+/* drops the indexed capabilities of all devices */
+void liblazy_hal_capability_flush(void);
+
+/* returns 1 if HAL properties should be served from the property cache */
+int liblazy_hal_cache_is_enabled(void);
+
+/* gets a reference to the cached property table of a device, fetching it
+ * if needed. Has to be dropped with liblazy_hal_free_properties */
+int liblazy_hal_cache_get_properties(const char *udi,
+				     LiblazyHalProperties **properties);
+
+/* like liblazy_hal_cache_get_properties, but never fetches. *properties is
+ * NULL if the device is not cached or caching is disabled */
+void liblazy_hal_cache_peek_properties(const char *udi,
+				       LiblazyHalProperties **properties);
+
 #endif /* LIBLAZY_LOCAL_H */
@@ -0,0 +1,148 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+/* longest message passed to a sink, longer ones are cut */
+#define LOG_MESSAGE_SIZE		512
+
+#ifdef LIBLAZY_LOG_DEFAULT_STDERR
+static LiblazyLogSink		log_sink = liblazy_log_stderr;
+volatile int			liblazy_log_threshold = LIBLAZY_LOG_ERROR;
+#else
+static LiblazyLogSink		log_sink = NULL;
+volatile int			liblazy_log_threshold = 0;
+#endif
+static void			*log_userdata = NULL;
+static int			log_level = LIBLAZY_LOG_ERROR;
+
+/* protects the sink, its userdata and the level, which are read together,
+ * and the rate limits of all call sites */
+static pthread_mutex_t		log_lock = PTHREAD_MUTEX_INITIALIZER;
+static int			log_burst = 10;
+static int			log_interval = 1000;
+
+/* called with log_lock held */
+static void liblazy_log_update_threshold(void)
+{
+	liblazy_log_threshold = log_sink != NULL ? log_level : 0;
+}
+
+void liblazy_log_set_sink(LiblazyLogSink sink, void *userdata)
+{
+	pthread_mutex_lock(&log_lock);
+	log_sink = sink;
+	log_userdata = userdata;
+	liblazy_log_update_threshold();
+	pthread_mutex_unlock(&log_lock);
+}
+
+void liblazy_log_set_level(int level)
+{
+	pthread_mutex_lock(&log_lock);
+	log_level = level;
+	liblazy_log_update_threshold();
+	pthread_mutex_unlock(&log_lock);
+}
+
+void liblazy_log_set_rate_limit(int burst, int interval)
+{
+	pthread_mutex_lock(&log_lock);
+	log_burst = burst;
+	log_interval = interval;
+	pthread_mutex_unlock(&log_lock);
+}
+
+void liblazy_log_stderr(int level, const char *function, int line,
+			const char *message, unsigned long suppressed,
+			void *userdata)
+{
+	if (suppressed > 0)
+		fprintf(stderr, "liblazy (%s:%d): %s (%lu similar messages "
+			"suppressed)\n", function, line, message, suppressed);
+	else
+		fprintf(stderr, "liblazy (%s:%d): %s\n", function, line, message);
+}
+
+/* returns the number of suppressed messages to report with this one, or
+ * -1 if this one is suppressed as well. Called with log_lock held */
+static long liblazy_log_limit(struct liblazy_log_site *site)
+{
+	struct timespec	now;
+	long		suppressed	= 0;
+
+	if (log_burst <= 0 || log_interval <= 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (site->count == 0 ||
+	    (now.tv_sec - site->window.tv_sec) * 1000 +
+	    (now.tv_nsec - site->window.tv_nsec) / 1000000 >= log_interval) {
+		site->window = now;
+		site->count = 0;
+	}
+
+	if (site->count++ < log_burst) {
+		suppressed = site->suppressed;
+		site->suppressed = 0;
+	} else {
+		site->suppressed++;
+		suppressed = -1;
+	}
+	return suppressed;
+}
+
+void liblazy_log(struct liblazy_log_site *site, int level,
+		 const char *function, int line, const char *format, ...)
+{
+	LiblazyLogSink	sink;
+	void		*userdata;
+	char		message[LOG_MESSAGE_SIZE];
+	va_list		var_args;
+	long		suppressed	= -1;
+
+	pthread_mutex_lock(&log_lock);
+	sink = log_sink;
+	userdata = log_userdata;
+	/* checked before formatting, which is what costs */
+	if (sink != NULL && level <= log_level)
+		suppressed = liblazy_log_limit(site);
+	pthread_mutex_unlock(&log_lock);
+	if (suppressed < 0)
+		return;
+
+	va_start(var_args, format);
+	vsnprintf(message, sizeof(message), format, var_args);
+	va_end(var_args);
+
+	sink(level, function, line, message, suppressed, userdata);
+}
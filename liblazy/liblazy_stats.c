@@ -0,0 +1,331 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* counters of one thread, only written by that thread */
+struct thread_stats {
+	/* taken by the thread while counting and by snapshots and resets */
+	pthread_mutex_t		lock;
+	LiblazyStats		totals;
+	LiblazyStatsMethod	*methods;
+	int			method_size;
+	struct thread_stats	*next;
+};
+
+volatile int			liblazy_stats_enabled = 0;
+
+/* protects the list of threads and the counters of finished ones */
+static pthread_mutex_t		stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_stats	*stats_threads = NULL;
+static struct thread_stats	stats_retired = {
+	PTHREAD_MUTEX_INITIALIZER, { 0 }, NULL, 0, NULL
+};
+
+static pthread_once_t		stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t		stats_key;
+
+/* finds or adds the counters for method, NULL on OOM */
+static LiblazyStatsMethod *liblazy_stats_method(LiblazyStats *stats,
+						int *size, const char *method)
+{
+	LiblazyStatsMethod	*methods;
+	LiblazyStatsMethod	*entry;
+	int			i;
+
+	for (i = 0; i < stats->method_count; i++) {
+		if (strcmp(stats->methods[i].name, method) == 0)
+			return &stats->methods[i];
+	}
+
+	if (stats->method_count == *size) {
+		methods = realloc(stats->methods, (*size + 8) *
+				  sizeof(LiblazyStatsMethod));
+		if (methods == NULL)
+			return NULL;
+		stats->methods = methods;
+		*size += 8;
+	}
+
+	entry = &stats->methods[stats->method_count];
+	memset(entry, 0, sizeof(LiblazyStatsMethod));
+	entry->name = strdup(method);
+	if (entry->name == NULL)
+		return NULL;
+	stats->method_count++;
+	return entry;
+}
+
+static void liblazy_stats_clear(LiblazyStats *stats)
+{
+	int i;
+
+	for (i = 0; i < stats->method_count; i++)
+		free(stats->methods[i].name);
+	free(stats->methods);
+	memset(stats, 0, sizeof(LiblazyStats));
+}
+
+/* adds the counters of from to stats */
+static int liblazy_stats_merge(LiblazyStats *stats, int *size,
+			       const LiblazyStats *from)
+{
+	const LiblazyStatsMethod	*method;
+	LiblazyStatsMethod		*entry;
+	int				i;
+	int				j;
+
+	stats->calls += from->calls;
+	stats->signals += from->signals;
+	stats->round_trips += from->round_trips;
+	stats->bytes_sent += from->bytes_sent;
+	stats->bytes_received += from->bytes_received;
+	for (i = 0; i < LIBLAZY_STATS_ERROR_CODES; i++)
+		stats->errors[i] += from->errors[i];
+
+	for (i = 0; i < from->method_count; i++) {
+		method = &from->methods[i];
+		entry = liblazy_stats_method(stats, size, method->name);
+		if (entry == NULL)
+			return LIBLAZY_ERROR_GENERAL;
+		entry->calls += method->calls;
+		entry->errors += method->errors;
+		entry->bytes_sent += method->bytes_sent;
+		entry->bytes_received += method->bytes_received;
+		for (j = 0; j < LIBLAZY_STATS_BUCKETS; j++)
+			entry->latency[j] += method->latency[j];
+	}
+	return 0;
+}
+
+/* keeps the counters of a finished thread */
+static void liblazy_stats_free_thread(void *data)
+{
+	struct thread_stats	*thread		= data;
+	struct thread_stats	**link;
+
+	pthread_mutex_lock(&stats_lock);
+	for (link = &stats_threads; *link != NULL; link = &(*link)->next) {
+		if (*link == thread) {
+			*link = thread->next;
+			break;
+		}
+	}
+	liblazy_stats_merge(&stats_retired.totals, &stats_retired.method_size,
+			    &thread->totals);
+	pthread_mutex_unlock(&stats_lock);
+
+	liblazy_stats_clear(&thread->totals);
+	pthread_mutex_destroy(&thread->lock);
+	free(thread);
+}
+
+static void liblazy_stats_init_once(void)
+{
+	pthread_key_create(&stats_key, liblazy_stats_free_thread);
+}
+
+static struct thread_stats *liblazy_stats_get_thread(void)
+{
+	struct thread_stats *thread;
+
+	pthread_once(&stats_once, liblazy_stats_init_once);
+	thread = pthread_getspecific(stats_key);
+	if (thread != NULL)
+		return thread;
+
+	thread = calloc(1, sizeof(struct thread_stats));
+	if (thread == NULL)
+		return NULL;
+	pthread_mutex_init(&thread->lock, NULL);
+	if (pthread_setspecific(stats_key, thread) != 0) {
+		pthread_mutex_destroy(&thread->lock);
+		free(thread);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	thread->next = stats_threads;
+	stats_threads = thread;
+	pthread_mutex_unlock(&stats_lock);
+	return thread;
+}
+
+/* the size of the message on the wire. libdbus has no cheaper way to
+ * tell, which is why bytes are only counted with LIBLAZY_STATS_BYTES */
+static unsigned long liblazy_stats_message_size(DBusMessage *message)
+{
+	char	*data;
+	int	length;
+
+	if (message == NULL || !dbus_message_marshal(message, &data, &length))
+		return 0;
+	dbus_free(data);
+	return length;
+}
+
+static int liblazy_stats_bucket(long usec)
+{
+	int bucket = 0;
+
+	while (usec > 0 && bucket < LIBLAZY_STATS_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+void liblazy_stats_start(struct timespec *started)
+{
+	clock_gettime(CLOCK_MONOTONIC, started);
+}
+
+void liblazy_stats_record(DBusMessage *message, DBusMessage *reply,
+			  int round_trip, const struct timespec *started,
+			  int ret, const char *error_name)
+{
+	struct thread_stats	*thread;
+	struct timespec		now;
+	LiblazyStatsMethod	*entry;
+	const char		*method;
+	unsigned long		sent		= 0;
+	unsigned long		received	= 0;
+	long			usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (now.tv_sec - started->tv_sec) * 1000000L +
+		(now.tv_nsec - started->tv_nsec) / 1000;
+
+	/* HAL errors are only told apart by the HAL functions, which don't
+	 * see the call anymore */
+	if (error_name != NULL &&
+	    strcmp(error_name, DBUS_HAL_ERROR_NO_SUCH_PROPERTY) == 0)
+		ret = LIBLAZY_ERROR_HAL_NO_SUCH_PROPERTY;
+	else if (error_name != NULL &&
+		 strcmp(error_name, DBUS_HAL_ERROR_TYPE_MISMATCH) == 0)
+		ret = LIBLAZY_ERROR_HAL_TYPE_MISMATCH;
+
+	thread = liblazy_stats_get_thread();
+	if (thread == NULL)
+		return;
+
+	if (liblazy_stats_enabled & LIBLAZY_STATS_BYTES) {
+		sent = liblazy_stats_message_size(message);
+		received = liblazy_stats_message_size(reply);
+	}
+	method = dbus_message_get_member(message);
+
+	pthread_mutex_lock(&thread->lock);
+	if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_SIGNAL)
+		thread->totals.signals++;
+	else
+		thread->totals.calls++;
+	thread->totals.round_trips += round_trip;
+	thread->totals.bytes_sent += sent;
+	thread->totals.bytes_received += received;
+	if (ret < 0 && -ret < LIBLAZY_STATS_ERROR_CODES)
+		thread->totals.errors[-ret]++;
+
+	entry = liblazy_stats_method(&thread->totals, &thread->method_size,
+				     method != NULL ? method : "");
+	if (entry != NULL) {
+		entry->calls++;
+		entry->errors += ret < 0;
+		entry->bytes_sent += sent;
+		entry->bytes_received += received;
+		entry->latency[liblazy_stats_bucket(usec)]++;
+	}
+	pthread_mutex_unlock(&thread->lock);
+}
+
+void liblazy_stats_enable(int enable)
+{
+	/* bytes are counted on top of the calls */
+	if (enable & LIBLAZY_STATS_BYTES)
+		enable |= LIBLAZY_STATS_COUNT;
+	liblazy_stats_enabled = enable;
+}
+
+LiblazyStats *liblazy_stats_snapshot(void)
+{
+	struct thread_stats	*thread;
+	LiblazyStats		*stats;
+	int			size		= 0;
+	int			ret;
+
+	stats = calloc(1, sizeof(LiblazyStats));
+	if (stats == NULL) {
+		ERROR("Could not allocate statistics: OOM");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	ret = liblazy_stats_merge(stats, &size, &stats_retired.totals);
+	for (thread = stats_threads; thread != NULL && ret == 0;
+	     thread = thread->next) {
+		pthread_mutex_lock(&thread->lock);
+		ret = liblazy_stats_merge(stats, &size, &thread->totals);
+		pthread_mutex_unlock(&thread->lock);
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	if (ret != 0) {
+		ERROR("Could not allocate statistics: OOM");
+		liblazy_stats_free(stats);
+		return NULL;
+	}
+	return stats;
+}
+
+void liblazy_stats_free(LiblazyStats *stats)
+{
+	if (stats == NULL)
+		return;
+	liblazy_stats_clear(stats);
+	free(stats);
+}
+
+void liblazy_stats_reset(void)
+{
+	struct thread_stats *thread;
+
+	pthread_mutex_lock(&stats_lock);
+	liblazy_stats_clear(&stats_retired.totals);
+	stats_retired.method_size = 0;
+	for (thread = stats_threads; thread != NULL; thread = thread->next) {
+		pthread_mutex_lock(&thread->lock);
+		liblazy_stats_clear(&thread->totals);
+		thread->method_size = 0;
+		pthread_mutex_unlock(&thread->lock);
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,133 @@
+/***************************************************************************
+ *                                                                         *
+ *                              liblazy                                    *
+ *                                                                         *
+ *         Copyright (C) 2006,2007 Holger Macht <holger@homac.de>          *
+ *                                                                         *
+ *              Author(s): Holger Macht <holger@homac.de>                  *
+ *                                                                         *
+ * This library is free software; you can redistribute it and/or modify it *
+ * under the terms of the GNU Lesser General Public License as published   *
+ * by the Free Software Foundation; either version 2.1 of the License, or  *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This library is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * Lesser General Public License for more details.                         *
+ *                                                                         *
+ * You should have received a copy of the GNU Lesser General Public        *
+ * License along with this library; if not, write to the Free Software     *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA           *
+ * 02110-1301  USA                                                         *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "liblazy.h"
+#include "liblazy_local.h"
+#include "config.h"
+
+#ifdef HAVE_SYS_SDT_H
+/* lets tracers tell that they are attached, see TRACE_ENABLED */
+#define _SDT_HAS_SEMAPHORES	1
+#include <sys/sdt.h>
+#else
+#define DTRACE_PROBE4(provider, name, a1, a2, a3, a4)
+#define DTRACE_PROBE5(provider, name, a1, a2, a3, a4, a5)
+#define DTRACE_PROBE2(provider, name, a1, a2)
+#endif
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef HAVE_SYS_SDT_H
+#define PROBE_SEMAPHORE(name)						\
+	volatile unsigned short liblazy_##name##_semaphore		\
+	__attribute__((section(".probes"), visibility("hidden"))) = 0
+
+PROBE_SEMAPHORE(call__start);
+PROBE_SEMAPHORE(reply__received);
+PROBE_SEMAPHORE(error);
+PROBE_SEMAPHORE(decode__done);
+#endif
+
+volatile int			liblazy_trace_enabled = 0;
+
+/* protects the callback and its userdata, which are changed together */
+static pthread_mutex_t		trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static LiblazyTraceCallback	trace_callback = NULL;
+static void			*trace_userdata = NULL;
+
+void liblazy_trace_set_callback(LiblazyTraceCallback callback, void *userdata)
+{
+	pthread_mutex_lock(&trace_lock);
+	trace_callback = callback;
+	trace_userdata = userdata;
+	liblazy_trace_enabled = callback != NULL;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/* returns the callback and the userdata that belongs to it */
+static LiblazyTraceCallback liblazy_trace_get_callback(void **userdata)
+{
+	LiblazyTraceCallback callback;
+
+	if (!liblazy_trace_enabled)
+		return NULL;
+
+	pthread_mutex_lock(&trace_lock);
+	callback = trace_callback;
+	*userdata = trace_userdata;
+	pthread_mutex_unlock(&trace_lock);
+	return callback;
+}
+
+void liblazy_trace_call(int event, DBusMessage *message, int error)
+{
+	LiblazyTraceCallback	callback;
+	void			*userdata	= NULL;
+	const char		*destination	= dbus_message_get_destination(message);
+	const char		*path		= dbus_message_get_path(message);
+	const char		*method		= dbus_message_get_member(message);
+	dbus_uint32_t		serial		= dbus_message_get_serial(message);
+
+	switch (event) {
+	case LIBLAZY_TRACE_CALL_START:
+		DTRACE_PROBE4(liblazy, call__start, destination, path, method,
+			      serial);
+		break;
+	case LIBLAZY_TRACE_REPLY:
+		DTRACE_PROBE4(liblazy, reply__received, destination, path, method,
+			      serial);
+		break;
+	case LIBLAZY_TRACE_ERROR:
+		DTRACE_PROBE5(liblazy, error, destination, path, method, serial,
+			      error);
+		break;
+	}
+
+	callback = liblazy_trace_get_callback(&userdata);
+	if (callback != NULL)
+		callback(event, destination, path, method, serial, error,
+			 userdata);
+}
+
+void liblazy_trace_decoded(DBusMessage *reply, int error)
+{
+	LiblazyTraceCallback	callback;
+	void			*userdata	= NULL;
+	dbus_uint32_t		serial		= 0;
+
+	if (reply == NULL)
+		return;
+	/* the serial of the call the reply answers */
+	if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_SIGNAL)
+		serial = dbus_message_get_reply_serial(reply);
+
+	DTRACE_PROBE2(liblazy, decode__done, serial, error);
+
+	callback = liblazy_trace_get_callback(&userdata);
+	if (callback != NULL)
+		callback(LIBLAZY_TRACE_DECODED, NULL, NULL, NULL, serial, error,
+			 userdata);
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# runs the benchmark against a private dbus-daemon and the HAL stand-in,
+# arguments are passed on to the benchmark. HALSTUB_OPTS are passed to the
+# stand-in, e.g. HALSTUB_OPTS="-l 5 -e 1" for a slow and flaky HAL. A
+# second stand-in listens on BENCH_PEER_ADDRESS for direct connections
+
+srcdir=${srcdir:-`dirname $0`}
+DBUS_DAEMON=${DBUS_DAEMON:-dbus-daemon}
+DEVICES=${DEVICES:-100}
+
+set -- `$DBUS_DAEMON --config-file=$srcdir/bench-bus.conf --fork \
+	--print-address --print-pid` "$@"
+if test -z "$2"; then
+	echo "Could not start $DBUS_DAEMON" >&2
+	exit 1
+fi
+bus_pid=$2
+DBUS_SYSTEM_BUS_ADDRESS=$1
+export DBUS_SYSTEM_BUS_ADDRESS
+shift 2
+
+peer_socket=${TMPDIR:-/tmp}/liblazy-bench-peer.$$
+BENCH_PEER_ADDRESS=unix:path=$peer_socket
+export BENCH_PEER_ADDRESS
+
+./halstub -d $DEVICES $HALSTUB_OPTS &
+hal_pid=$!
+./halstub -d $DEVICES $HALSTUB_OPTS -p $BENCH_PEER_ADDRESS &
+peer_pid=$!
+trap 'kill $hal_pid $peer_pid $bus_pid 2>/dev/null; rm -f $peer_socket' 0 1 2 15
+
+./benchmark "$@"
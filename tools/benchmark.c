@@ -0,0 +1,567 @@
+/* measures latency and throughput of the public API against the HAL
+ * stand-in, see bench.sh which sets up a private bus for it */
+
+#include "liblazy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define DBUS_HAL_SERVICE		"org.freedesktop.Hal"
+#define DBUS_HAL_DEVICE_INTERFACE	"org.freedesktop.Hal.Device"
+#define DBUS_HAL_UDI_COMPUTER		"/org/freedesktop/Hal/devices/computer"
+#define DBUS_HAL_UDI_DEVICE		"/org/freedesktop/Hal/devices/device_1"
+
+#define BENCH_PATH			"/org/freedesktop/liblazy/bench"
+#define BENCH_INTERFACE			"org.freedesktop.liblazy.Bench"
+
+struct bench_case {
+	const char	*name;
+	int		(*run)(void);
+};
+
+/* every allocation of the process is counted, including those done by
+ * libdbus and the threads of liblazy */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static unsigned long allocations = 0;
+
+void *malloc(size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(pointer, size);
+}
+
+static LiblazyReply	*reply = NULL;
+static const char	*peer_address = NULL;
+static LiblazyCall	*prepared = NULL;
+
+static pthread_mutex_t	signal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	signal_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long	signals_received = 0;
+
+static long now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static int bench_call_reply(void)
+{
+	DBusMessage	*message;
+	const char	*property	= "system.kernel.name";
+	int		ret;
+
+	ret = liblazy_dbus_system_send_method_call(DBUS_HAL_SERVICE,
+						   DBUS_HAL_UDI_COMPUTER,
+						   DBUS_HAL_DEVICE_INTERFACE,
+						   "GetPropertyString", &message,
+						   DBUS_TYPE_STRING, &property,
+						   DBUS_TYPE_INVALID);
+	if (ret == 0)
+		dbus_message_unref(message);
+	return ret;
+}
+
+static int bench_call_no_reply(void)
+{
+	const char *property = "system.kernel.name";
+
+	return liblazy_dbus_system_send_method_call(DBUS_HAL_SERVICE,
+						    DBUS_HAL_UDI_COMPUTER,
+						    DBUS_HAL_DEVICE_INTERFACE,
+						    "PropertyExists", NULL,
+						    DBUS_TYPE_STRING, &property,
+						    DBUS_TYPE_INVALID);
+}
+
+/* the call of bench_call_reply, with the names checked only once */
+static int bench_call_prepared(void)
+{
+	DBusMessage	*message;
+	const char	*property	= "system.kernel.name";
+	int		ret;
+
+	ret = liblazy_call_invoke(prepared, &message, -1,
+				  DBUS_TYPE_STRING, &property, DBUS_TYPE_INVALID);
+	if (ret == 0)
+		dbus_message_unref(message);
+	return ret;
+}
+
+/* the call of bench_call_reply, straight to the peer */
+static int bench_address_call_reply(void)
+{
+	DBusMessage	*message;
+	const char	*property	= "system.kernel.name";
+	int		ret;
+
+	ret = liblazy_dbus_address_send_method_call(peer_address,
+						    DBUS_HAL_UDI_COMPUTER,
+						    DBUS_HAL_DEVICE_INTERFACE,
+						    "GetPropertyString", &message,
+						    DBUS_TYPE_STRING, &property,
+						    DBUS_TYPE_INVALID);
+	if (ret == 0)
+		dbus_message_unref(message);
+	return ret;
+}
+
+static int bench_address_signal(void)
+{
+	return liblazy_dbus_address_send_signal(peer_address, BENCH_PATH,
+						BENCH_INTERFACE, "Emit",
+						DBUS_TYPE_INVALID);
+}
+
+struct async_wait {
+	int	done;
+	int	error;
+};
+
+static void async_replied(DBusMessage *message, int error, void *userdata)
+{
+	struct async_wait *pending = userdata;
+
+	pthread_mutex_lock(&signal_lock);
+	pending->error = error;
+	pending->done = 1;
+	pthread_cond_broadcast(&signal_cond);
+	pthread_mutex_unlock(&signal_lock);
+}
+
+/* from sending a call until its callback ran on the dispatch thread */
+static int bench_call_async(void)
+{
+	DBusMessage		*message;
+	struct async_wait	pending		= { 0, 0 };
+	const char		*property	= "system.kernel.name";
+	int			ret;
+
+	message = dbus_message_new_method_call(DBUS_HAL_SERVICE,
+					       DBUS_HAL_UDI_COMPUTER,
+					       DBUS_HAL_DEVICE_INTERFACE,
+					       "GetPropertyString");
+	if (message == NULL)
+		return LIBLAZY_ERROR_GENERAL;
+	if (!dbus_message_append_args(message, DBUS_TYPE_STRING, &property,
+				      DBUS_TYPE_INVALID)) {
+		dbus_message_unref(message);
+		return LIBLAZY_ERROR_GENERAL;
+	}
+
+	ret = liblazy_dbus_system_send_message_async(message, -1, async_replied,
+						     &pending);
+	dbus_message_unref(message);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&signal_lock);
+	while (!pending.done)
+		pthread_cond_wait(&signal_cond, &signal_lock);
+	pthread_mutex_unlock(&signal_lock);
+	return pending.error;
+}
+
+static int bench_signal(void)
+{
+	return liblazy_dbus_system_send_signal(BENCH_PATH, BENCH_INTERFACE,
+					       "Emit", DBUS_TYPE_INVALID);
+}
+
+static void signal_received(DBusMessage *message, void *userdata)
+{
+	pthread_mutex_lock(&signal_lock);
+	signals_received++;
+	pthread_cond_signal(&signal_cond);
+	pthread_mutex_unlock(&signal_lock);
+}
+
+/* from sending a signal until the subscription callback ran */
+static int bench_signal_roundtrip(void)
+{
+	unsigned long	expected;
+	int		ret;
+
+	pthread_mutex_lock(&signal_lock);
+	expected = signals_received + 1;
+	pthread_mutex_unlock(&signal_lock);
+
+	ret = liblazy_dbus_system_send_signal(BENCH_PATH, BENCH_INTERFACE,
+					      "Roundtrip", DBUS_TYPE_INVALID);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&signal_lock);
+	while (signals_received < expected)
+		pthread_cond_wait(&signal_cond, &signal_lock);
+	pthread_mutex_unlock(&signal_lock);
+	return 0;
+}
+
+static int bench_get_int(void)
+{
+	int value;
+
+	return liblazy_hal_get_property_int(DBUS_HAL_UDI_DEVICE, "block.minor",
+					    &value);
+}
+
+static int bench_get_bool(void)
+{
+	int value;
+
+	return liblazy_hal_get_property_bool(DBUS_HAL_UDI_DEVICE, "block.is_volume",
+					     &value);
+}
+
+static int bench_get_string(void)
+{
+	char	*value;
+	int	ret;
+
+	ret = liblazy_hal_get_property_string(DBUS_HAL_UDI_DEVICE, "info.product",
+					      &value);
+	if (ret == 0)
+		liblazy_free_string(value);
+	return ret;
+}
+
+static int bench_get_string_borrowed(void)
+{
+	const char *value;
+
+	return liblazy_hal_get_property_string_borrowed(DBUS_HAL_UDI_DEVICE,
+							"info.product", reply,
+							&value);
+}
+
+static int bench_get_strlist(void)
+{
+	char	**value;
+	int	ret;
+
+	ret = liblazy_hal_get_property_strlist(DBUS_HAL_UDI_DEVICE,
+					       "info.capabilities", &value);
+	if (ret == 0)
+		liblazy_free_strlist(value);
+	return ret;
+}
+
+static int bench_get_all_properties(void)
+{
+	LiblazyHalProperties	*properties;
+	int			ret;
+
+	ret = liblazy_hal_get_all_properties(DBUS_HAL_UDI_DEVICE, &properties);
+	if (ret == 0)
+		liblazy_hal_free_properties(properties);
+	return ret;
+}
+
+static int bench_query_capability(void)
+{
+	int ret;
+
+	ret = liblazy_hal_query_capability(DBUS_HAL_UDI_DEVICE, "block");
+	return ret < 0 ? ret : 0;
+}
+
+static int bench_find_capability(void)
+{
+	char	**devices;
+	int	ret;
+
+	ret = liblazy_hal_find_device_by_capability("storage", &devices);
+	if (ret == 0)
+		liblazy_free_strlist(devices);
+	return ret;
+}
+
+static int bench_find_capability_borrowed(void)
+{
+	const char **devices;
+
+	return liblazy_hal_find_device_by_capability_borrowed("storage", reply,
+							      &devices);
+}
+
+static int bench_find_string_match(void)
+{
+	char	**devices;
+	int	ret;
+
+	ret = liblazy_hal_find_device_by_string_match("info.category", "volume",
+						      &devices);
+	if (ret == 0)
+		liblazy_free_strlist(devices);
+	return ret;
+}
+
+/* the example of liblazy.h: mounted volumes larger than 4 GiB */
+static int bench_query_execute(void)
+{
+	LiblazyHalQuery	*query;
+	char		**devices;
+	int		ret;
+
+	query = liblazy_hal_query_new(LIBLAZY_HAL_QUERY_ALL);
+	if (query == NULL)
+		return LIBLAZY_ERROR_GENERAL;
+	ret = liblazy_hal_query_add_capability(query, "volume");
+	if (ret == 0)
+		ret = liblazy_hal_query_add_bool(query, "volume.is_mounted", 1);
+	if (ret == 0)
+		ret = liblazy_hal_query_add_range(query, "volume.size",
+						  (4LL << 30) + 1,
+						  LIBLAZY_HAL_QUERY_NO_MAX);
+	if (ret == 0)
+		ret = liblazy_hal_query_execute(query, &devices);
+	if (ret == 0)
+		liblazy_free_strlist(devices);
+	liblazy_hal_query_free(query);
+	return ret;
+}
+
+static int bench_privilege(void)
+{
+	int ret;
+
+	ret = liblazy_hal_is_caller_privileged("hal-power-suspend");
+	return ret < 0 ? ret : 0;
+}
+
+static int bench_privileges(void)
+{
+	const char	*privileges[] = { "hal-power-suspend", "hal-power-hibernate",
+					  "hal-power-shutdown", "hal-power-reboot",
+					  NULL };
+	int		results[4];
+
+	return liblazy_hal_check_caller_privileges(privileges, results);
+}
+
+static const struct bench_case bench_cases[] = {
+	{ "method call with reply",	bench_call_reply },
+	{ "prepared method call",	bench_call_prepared },
+	{ "method call without reply",	bench_call_no_reply },
+	{ "async method call",		bench_call_async },
+	{ "signal",			bench_signal },
+	{ "signal to subscription",	bench_signal_roundtrip },
+	{ "get_property_int",		bench_get_int },
+	{ "get_property_bool",		bench_get_bool },
+	{ "get_property_string",	bench_get_string },
+	{ "get_property_string_borrowed", bench_get_string_borrowed },
+	{ "get_property_strlist",	bench_get_strlist },
+	{ "get_all_properties",		bench_get_all_properties },
+	{ "query_capability",		bench_query_capability },
+	{ "find_device_by_capability",	bench_find_capability },
+	{ "find_device_by_capability_borrowed", bench_find_capability_borrowed },
+	{ "find_device_by_string_match", bench_find_string_match },
+	{ "query_execute",		bench_query_execute },
+	{ "is_caller_privileged",	bench_privilege },
+	{ "check_caller_privileges",	bench_privileges },
+	{ NULL, NULL }
+};
+
+/* need the stand-in listening on BENCH_PEER_ADDRESS */
+static const struct bench_case peer_bench_cases[] = {
+	{ "address method call with reply", bench_address_call_reply },
+	{ "address signal",		bench_address_signal },
+	{ NULL, NULL }
+};
+
+static int compare_samples(const void *a, const void *b)
+{
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(long *samples, int count, int percent)
+{
+	return samples[(count - 1) * percent / 100] / 1000.0;
+}
+
+static int run_case(const char *mode, const struct bench_case *bench,
+		    long *samples, int iterations)
+{
+	unsigned long	allocated;
+	long		start;
+	long		total;
+	int		errors		= 0;
+	int		i;
+
+	/* connections, caches and the subscription thread are set up here,
+	 * errors injected by the stand-in are only counted later */
+	for (i = 0; i < iterations / 10 + 1; i++)
+		bench->run();
+
+	allocated = __sync_fetch_and_add(&allocations, 0);
+	total = now_ns();
+	for (i = 0; i < iterations; i++) {
+		start = now_ns();
+		if (bench->run() != 0)
+			errors++;
+		samples[i] = now_ns() - start;
+	}
+	/* calls without reply are only done once they are on the bus */
+	liblazy_dbus_flush();
+	total = now_ns() - total;
+	allocated = __sync_fetch_and_add(&allocations, 0) - allocated;
+
+	qsort(samples, iterations, sizeof(long), compare_samples);
+	printf("%-8s %-36s %8.1f %8.1f %8.1f %9.1f %10.0f %7.1f %6d\n", mode,
+	       bench->name, percentile(samples, iterations, 50),
+	       percentile(samples, iterations, 90),
+	       percentile(samples, iterations, 99),
+	       samples[iterations - 1] / 1000.0,
+	       iterations / (total / 1000000000.0),
+	       (double)allocated / iterations, errors);
+	return errors == iterations;
+}
+
+/* the stand-in may still be starting up */
+static int wait_for_hal(void)
+{
+	DBusMessage	*message;
+	const char	*service	= DBUS_HAL_SERVICE;
+	dbus_bool_t	has_owner	= FALSE;
+	int		i;
+
+	for (i = 0; i < 50 && !has_owner; i++) {
+		if (liblazy_dbus_system_send_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+							 DBUS_INTERFACE_DBUS,
+							 "NameHasOwner", &message,
+							 DBUS_TYPE_STRING, &service,
+							 DBUS_TYPE_INVALID) == 0) {
+			liblazy_dbus_message_get_basic_arg(message, DBUS_TYPE_BOOLEAN,
+							   &has_owner, 0);
+			dbus_message_unref(message);
+		}
+		if (!has_owner)
+			usleep(100000);
+	}
+	return has_owner ? 0 : 1;
+}
+
+/* the peer is started alongside the stand-in on the bus */
+static int wait_for_peer(void)
+{
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		if (liblazy_dbus_connect_address(peer_address) == 0)
+			return 0;
+		usleep(100000);
+	}
+	return 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [name filter]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct bench_case	*bench;
+	const char		*filter		= NULL;
+	const char		*mode;
+	long			*samples;
+	int			iterations	= 2000;
+	int			failed		= 0;
+	int			option;
+	int			private;
+
+	while ((option = getopt(argc, argv, "n:h")) != -1) {
+		switch (option) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return option == 'h' ? 0 : 1;
+		}
+	}
+	if (optind < argc)
+		filter = argv[optind];
+	if (iterations < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (wait_for_hal() != 0) {
+		fprintf(stderr, "HAL is not running on the system bus\n");
+		return 1;
+	}
+
+	peer_address = getenv("BENCH_PEER_ADDRESS");
+	if (peer_address != NULL && wait_for_peer() != 0) {
+		fprintf(stderr, "Nothing listens on %s\n", peer_address);
+		return 1;
+	}
+
+	samples = malloc(iterations * sizeof(long));
+	reply = liblazy_reply_new();
+	prepared = liblazy_call_prepare(DBUS_BUS_SYSTEM, DBUS_HAL_SERVICE,
+					DBUS_HAL_UDI_COMPUTER,
+					DBUS_HAL_DEVICE_INTERFACE,
+					"GetPropertyString", "s");
+	if (samples == NULL || reply == NULL || prepared == NULL)
+		return 1;
+
+	if (liblazy_dbus_subscribe(DBUS_BUS_SYSTEM,
+				   "type='signal',interface='" BENCH_INTERFACE "',"
+				   "member='Roundtrip'", signal_received, NULL) < 0) {
+		fprintf(stderr, "Could not subscribe to signals\n");
+		return 1;
+	}
+
+	printf("%d calls each, latency in microseconds\n", iterations);
+	printf("%-8s %-36s %8s %8s %8s %9s %10s %7s %6s\n", "mode", "call", "p50",
+	       "p90", "p99", "max", "calls/s", "allocs", "errors");
+
+	for (private = 0; private <= 1; private++) {
+		mode = private ? "private" : "shared";
+		liblazy_dbus_system_use_private_connection(private);
+		for (bench = bench_cases; bench->name != NULL; bench++) {
+			if (filter != NULL && strstr(bench->name, filter) == NULL)
+				continue;
+			failed |= run_case(mode, bench, samples, iterations);
+		}
+	}
+
+	/* the connection to the peer is the same in either mode */
+	for (bench = peer_bench_cases; peer_address != NULL && bench->name != NULL;
+	     bench++) {
+		if (filter != NULL && strstr(bench->name, filter) == NULL)
+			continue;
+		failed |= run_case("peer", bench, samples, iterations);
+	}
+
+	liblazy_call_free(prepared);
+	liblazy_reply_free(reply);
+	free(samples);
+	return failed;
+}
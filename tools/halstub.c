@@ -0,0 +1,653 @@
+/* stand-in for the HAL daemon serving a synthetic device tree, so liblazy
+ * can be exercised without HAL. It connects to the bus in
+ * DBUS_SYSTEM_BUS_ADDRESS, usually a private dbus-daemon, or the one given
+ * with -a. With -p it listens for direct connections on an address
+ * instead, for the liblazy_dbus_address_* functions.
+ *
+ * Odd devices are storage devices below the computer, even ones volumes
+ * on the following storage device. Volume n holds n / 2 + 1 GiB and
+ * every other volume is mounted. Every call can be delayed and a share
+ * of them answered with an error or not answered at all, to reproduce a
+ * slow or misbehaving HAL */
+
+#define DBUS_API_SUBJECT_TO_CHANGE 1
+#include <dbus/dbus.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define DBUS_HAL_SERVICE		"org.freedesktop.Hal"
+#define DBUS_HAL_MANAGER_PATH		"/org/freedesktop/Hal/Manager"
+#define DBUS_HAL_DEVICE_PATH		"/org/freedesktop/Hal/devices/"
+#define DBUS_HAL_COMPUTER_PATH		DBUS_HAL_DEVICE_PATH "computer"
+
+#define HAL_ERROR_NO_SUCH_DEVICE	"org.freedesktop.Hal.NoSuchDevice"
+#define HAL_ERROR_NO_SUCH_PROPERTY	"org.freedesktop.Hal.NoSuchProperty"
+#define HAL_ERROR_TYPE_MISMATCH		"org.freedesktop.Hal.TypeMismatch"
+#define HAL_ERROR_INJECTED		"org.freedesktop.Hal.Error"
+
+/* device index of the computer, the others count from 0 */
+#define COMPUTER			-1
+#define NO_DEVICE			-2
+
+#define MAX_STRLIST			4
+
+struct value {
+	int		type;
+	char		string[128];
+	dbus_int32_t	integer;
+	dbus_uint64_t	uint64;
+	dbus_bool_t	boolean;
+	const char	*strlist[MAX_STRLIST + 1];
+};
+
+static const char *device_properties[] = {
+	"info.udi", "info.parent", "info.product", "info.category",
+	"info.capabilities", "block.minor", "block.is_volume", NULL
+};
+
+static const char *volume_properties[] = {
+	"info.udi", "info.parent", "info.product", "info.category",
+	"info.capabilities", "block.minor", "block.is_volume", "volume.size",
+	"volume.is_mounted", NULL
+};
+
+static const char *computer_properties[] = {
+	"info.udi", "info.product", "info.capabilities", "system.kernel.name",
+	"power_management.can_hibernate", NULL
+};
+
+static int		device_count	= 100;
+/* delay of every call and random extra delay, in milliseconds */
+static int		latency		= 0;
+static int		jitter		= 0;
+/* percentage of calls answered with an error or not at all */
+static double		error_rate	= 0;
+static double		drop_rate	= 0;
+static int		verbose		= 0;
+static unsigned long	calls		= 0;
+
+/* the listening socket when serving direct connections */
+static DBusWatch	*server_watch	= NULL;
+
+static int device_index(const char *path)
+{
+	char	*end;
+	long	index;
+
+	if (path == NULL)
+		return NO_DEVICE;
+	if (strcmp(path, DBUS_HAL_COMPUTER_PATH) == 0)
+		return COMPUTER;
+	if (strncmp(path, DBUS_HAL_DEVICE_PATH "device_",
+		    strlen(DBUS_HAL_DEVICE_PATH "device_")) != 0)
+		return NO_DEVICE;
+
+	index = strtol(path + strlen(DBUS_HAL_DEVICE_PATH "device_"), &end, 10);
+	if (*end != '\0' || index < 0 || index >= device_count)
+		return NO_DEVICE;
+	return index;
+}
+
+static void device_path(int device, char *path, size_t size)
+{
+	if (device == COMPUTER)
+		snprintf(path, size, "%s", DBUS_HAL_COMPUTER_PATH);
+	else
+		snprintf(path, size, DBUS_HAL_DEVICE_PATH "device_%d", device);
+}
+
+static const char **device_keys(int device)
+{
+	if (device == COMPUTER)
+		return computer_properties;
+	return device % 2 ? device_properties : volume_properties;
+}
+
+/* returns 0 if the device has the property */
+static int device_property(int device, const char *key, struct value *value)
+{
+	const char *category = device % 2 ? "storage" : "volume";
+
+	memset(value, 0, sizeof(struct value));
+
+	if (strcmp(key, "info.udi") == 0) {
+		value->type = DBUS_TYPE_STRING;
+		device_path(device, value->string, sizeof(value->string));
+	} else if (strcmp(key, "info.product") == 0) {
+		value->type = DBUS_TYPE_STRING;
+		if (device == COMPUTER)
+			snprintf(value->string, sizeof(value->string), "Computer");
+		else
+			snprintf(value->string, sizeof(value->string), "Device %d", device);
+	} else if (device == COMPUTER) {
+		if (strcmp(key, "info.capabilities") == 0) {
+			value->type = DBUS_TYPE_ARRAY;
+			value->strlist[0] = "system";
+		} else if (strcmp(key, "system.kernel.name") == 0) {
+			value->type = DBUS_TYPE_STRING;
+			snprintf(value->string, sizeof(value->string), "Linux");
+		} else if (strcmp(key, "power_management.can_hibernate") == 0) {
+			value->type = DBUS_TYPE_BOOLEAN;
+			value->boolean = TRUE;
+		} else
+			return -1;
+	} else if (strcmp(key, "info.parent") == 0) {
+		value->type = DBUS_TYPE_STRING;
+		/* volumes live on the next storage device, if there is one */
+		device_path(device % 2 == 0 && device + 1 < device_count ?
+			    device + 1 : COMPUTER, value->string,
+			    sizeof(value->string));
+	} else if (strcmp(key, "info.category") == 0) {
+		value->type = DBUS_TYPE_STRING;
+		snprintf(value->string, sizeof(value->string), "%s", category);
+	} else if (strcmp(key, "info.capabilities") == 0) {
+		value->type = DBUS_TYPE_ARRAY;
+		value->strlist[0] = category;
+		value->strlist[1] = "block";
+	} else if (strcmp(key, "block.minor") == 0) {
+		value->type = DBUS_TYPE_INT32;
+		value->integer = device;
+	} else if (strcmp(key, "block.is_volume") == 0) {
+		value->type = DBUS_TYPE_BOOLEAN;
+		value->boolean = device % 2 == 0;
+	} else if (device % 2) {
+		return -1;
+	} else if (strcmp(key, "volume.size") == 0) {
+		value->type = DBUS_TYPE_UINT64;
+		value->uint64 = (dbus_uint64_t)(device / 2 + 1) << 30;
+	} else if (strcmp(key, "volume.is_mounted") == 0) {
+		value->type = DBUS_TYPE_BOOLEAN;
+		value->boolean = device % 4 == 0;
+	} else
+		return -1;
+	return 0;
+}
+
+static int device_has_capability(int device, const char *capability)
+{
+	struct value	value;
+	int		i;
+
+	device_property(device, "info.capabilities", &value);
+	for (i = 0; value.strlist[i] != NULL; i++) {
+		if (strcmp(value.strlist[i], capability) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void append_value(DBusMessageIter *iter, struct value *value, int variant)
+{
+	DBusMessageIter	variant_iter;
+	DBusMessageIter	array_iter;
+	DBusMessageIter	*target		= iter;
+	const char	*signature	= "s";
+	const char	*string		= value->string;
+	int		i;
+
+	switch (value->type) {
+	case DBUS_TYPE_INT32:
+		signature = "i";
+		break;
+	case DBUS_TYPE_UINT64:
+		signature = "t";
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		signature = "b";
+		break;
+	case DBUS_TYPE_ARRAY:
+		signature = "as";
+		break;
+	}
+
+	if (variant) {
+		dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, signature,
+						 &variant_iter);
+		target = &variant_iter;
+	}
+
+	switch (value->type) {
+	case DBUS_TYPE_STRING:
+		dbus_message_iter_append_basic(target, DBUS_TYPE_STRING, &string);
+		break;
+	case DBUS_TYPE_INT32:
+		dbus_message_iter_append_basic(target, DBUS_TYPE_INT32, &value->integer);
+		break;
+	case DBUS_TYPE_UINT64:
+		dbus_message_iter_append_basic(target, DBUS_TYPE_UINT64, &value->uint64);
+		break;
+	case DBUS_TYPE_BOOLEAN:
+		dbus_message_iter_append_basic(target, DBUS_TYPE_BOOLEAN, &value->boolean);
+		break;
+	case DBUS_TYPE_ARRAY:
+		dbus_message_iter_open_container(target, DBUS_TYPE_ARRAY, "s",
+						 &array_iter);
+		for (i = 0; value->strlist[i] != NULL; i++)
+			dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_STRING,
+						       &value->strlist[i]);
+		dbus_message_iter_close_container(target, &array_iter);
+		break;
+	}
+
+	if (variant)
+		dbus_message_iter_close_container(iter, &variant_iter);
+}
+
+/* answers with the devices for which match returns 1 */
+static DBusMessage *find_devices(DBusMessage *message,
+				 int (*match)(int device, const char *key,
+					      const char *value),
+				 const char *key, const char *value)
+{
+	DBusMessage	*reply;
+	DBusMessageIter	iter;
+	DBusMessageIter	array_iter;
+	char		path[128];
+	const char	*udi		= path;
+	int		i;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &array_iter);
+	for (i = COMPUTER; i < device_count; i++) {
+		if (match != NULL && !match(i, key, value))
+			continue;
+		device_path(i, path, sizeof(path));
+		dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_STRING, &udi);
+	}
+	dbus_message_iter_close_container(&iter, &array_iter);
+	return reply;
+}
+
+static int match_capability(int device, const char *key, const char *value)
+{
+	return device_has_capability(device, value);
+}
+
+static int match_string(int device, const char *key, const char *value)
+{
+	struct value property;
+
+	return device_property(device, key, &property) == 0 &&
+		property.type == DBUS_TYPE_STRING &&
+		strcmp(property.string, value) == 0;
+}
+
+static DBusMessage *handle_manager(DBusMessage *message, const char *method)
+{
+	const char	*key		= NULL;
+	const char	*value		= NULL;
+	dbus_bool_t	exists;
+
+	if (strcmp(method, "GetAllDevices") == 0)
+		return find_devices(message, NULL, NULL, NULL);
+
+	if (strcmp(method, "FindDeviceByCapability") == 0) {
+		if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &value,
+					   DBUS_TYPE_INVALID))
+			return NULL;
+		return find_devices(message, match_capability, NULL, value);
+	}
+
+	if (strcmp(method, "FindDeviceStringMatch") == 0) {
+		if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &key,
+					   DBUS_TYPE_STRING, &value, DBUS_TYPE_INVALID))
+			return NULL;
+		return find_devices(message, match_string, key, value);
+	}
+
+	if (strcmp(method, "DeviceExists") == 0) {
+		if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &value,
+					   DBUS_TYPE_INVALID))
+			return NULL;
+		exists = device_index(value) != NO_DEVICE;
+		message = dbus_message_new_method_return(message);
+		dbus_message_append_args(message, DBUS_TYPE_BOOLEAN, &exists,
+					 DBUS_TYPE_INVALID);
+		return message;
+	}
+	return NULL;
+}
+
+static DBusMessage *get_all_properties(DBusMessage *message, int device)
+{
+	DBusMessage	*reply;
+	DBusMessageIter	iter;
+	DBusMessageIter	array_iter;
+	DBusMessageIter	entry_iter;
+	struct value	value;
+	const char	**keys		= device_keys(device);
+	int		i;
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &array_iter);
+	for (i = 0; keys[i] != NULL; i++) {
+		device_property(device, keys[i], &value);
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_DICT_ENTRY,
+						 NULL, &entry_iter);
+		dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &keys[i]);
+		append_value(&entry_iter, &value, 1);
+		dbus_message_iter_close_container(&array_iter, &entry_iter);
+	}
+	dbus_message_iter_close_container(&iter, &array_iter);
+	return reply;
+}
+
+static DBusMessage *handle_device(DBusMessage *message, const char *method,
+				  int device)
+{
+	DBusMessage	*reply;
+	DBusMessageIter	iter;
+	struct value	value;
+	const char	*key		= NULL;
+	const char	*answer;
+	dbus_bool_t	exists;
+	int		type		= 0;
+
+	if (strcmp(method, "GetAllProperties") == 0)
+		return get_all_properties(message, device);
+
+	if (strcmp(method, "IsCallerPrivileged") == 0) {
+		if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &key,
+					   DBUS_TYPE_INVALID))
+			return NULL;
+		/* everything is allowed unless the name asks otherwise */
+		answer = strstr(key, "deny") != NULL ? "no" : "yes";
+		reply = dbus_message_new_method_return(message);
+		dbus_message_append_args(reply, DBUS_TYPE_STRING, &answer,
+					 DBUS_TYPE_INVALID);
+		return reply;
+	}
+
+	if (strcmp(method, "GetPropertyString") == 0)
+		type = DBUS_TYPE_STRING;
+	else if (strcmp(method, "GetPropertyInteger") == 0)
+		type = DBUS_TYPE_INT32;
+	else if (strcmp(method, "GetPropertyBoolean") == 0)
+		type = DBUS_TYPE_BOOLEAN;
+	else if (strcmp(method, "GetPropertyStringList") == 0)
+		type = DBUS_TYPE_ARRAY;
+	else if (strcmp(method, "GetProperty") != 0 &&
+		 strcmp(method, "PropertyExists") != 0 &&
+		 strcmp(method, "QueryCapability") != 0)
+		return NULL;
+
+	if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &key,
+				   DBUS_TYPE_INVALID))
+		return NULL;
+
+	if (strcmp(method, "PropertyExists") == 0 ||
+	    strcmp(method, "QueryCapability") == 0) {
+		if (method[0] == 'P')
+			exists = device_property(device, key, &value) == 0;
+		else
+			exists = device_has_capability(device, key);
+		reply = dbus_message_new_method_return(message);
+		dbus_message_append_args(reply, DBUS_TYPE_BOOLEAN, &exists,
+					 DBUS_TYPE_INVALID);
+		return reply;
+	}
+
+	if (device_property(device, key, &value) != 0)
+		return dbus_message_new_error(message, HAL_ERROR_NO_SUCH_PROPERTY,
+					      "No such property");
+	if (type != 0 && type != value.type)
+		return dbus_message_new_error(message, HAL_ERROR_TYPE_MISMATCH,
+					      "Type mismatch");
+
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	append_value(&iter, &value, type == 0);
+	return reply;
+}
+
+/* returns 1 with the given probability in percent */
+static int chance(double percent)
+{
+	return percent > 0 && random() < percent / 100 * RAND_MAX;
+}
+
+static DBusHandlerResult handle_message(DBusConnection *dbus_connection,
+					DBusMessage *message, void *data)
+{
+	DBusMessage	*reply;
+	const char	*path		= dbus_message_get_path(message);
+	const char	*method		= dbus_message_get_member(message);
+	unsigned long	call;
+	int		delay		= latency;
+	int		device;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	/* direct connections are served by several threads */
+	call = __sync_add_and_fetch(&calls, 1);
+	if (verbose)
+		fprintf(stderr, "halstub: %lu %s %s\n", call, path, method);
+
+	if (jitter > 0)
+		delay += random() % (jitter + 1);
+	if (delay > 0)
+		usleep(delay * 1000);
+
+	if (chance(drop_rate))
+		return DBUS_HANDLER_RESULT_HANDLED;
+
+	if (chance(error_rate)) {
+		reply = dbus_message_new_error(message, HAL_ERROR_INJECTED,
+					       "Injected error");
+	} else if (path != NULL && strcmp(path, DBUS_HAL_MANAGER_PATH) == 0) {
+		reply = handle_manager(message, method);
+	} else {
+		device = device_index(path);
+		if (device == NO_DEVICE)
+			reply = dbus_message_new_error(message, HAL_ERROR_NO_SUCH_DEVICE,
+						       "No such device");
+		else
+			reply = handle_device(message, method, device);
+	}
+
+	if (reply == NULL)
+		reply = dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_METHOD,
+					       "Unknown method or arguments");
+
+	if (!dbus_message_get_no_reply(message))
+		dbus_connection_send(dbus_connection, reply, NULL);
+	dbus_message_unref(reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -a address  bus to connect to instead of DBUS_SYSTEM_BUS_ADDRESS\n"
+		"  -p address  listen for direct connections instead of using a bus\n"
+		"  -d count    number of devices besides the computer (100)\n"
+		"  -l msec     delay of every call (0)\n"
+		"  -j msec     random extra delay of up to msec (0)\n"
+		"  -e percent  calls answered with an error (0)\n"
+		"  -t percent  calls not answered at all, so they time out (0)\n"
+		"  -s seed     seed for the random delays and errors\n"
+		"  -v          log every call to stderr\n", name);
+}
+
+static DBusConnection *connect_bus(const char *address, DBusError *dbus_error)
+{
+	DBusConnection *dbus_connection;
+
+	if (address == NULL)
+		return dbus_bus_get(DBUS_BUS_SYSTEM, dbus_error);
+
+	dbus_connection = dbus_connection_open(address, dbus_error);
+	if (dbus_connection == NULL)
+		return NULL;
+	if (!dbus_bus_register(dbus_connection, dbus_error)) {
+		dbus_connection_unref(dbus_connection);
+		return NULL;
+	}
+	return dbus_connection;
+}
+
+static void *serve_peer(void *data)
+{
+	DBusConnection *dbus_connection = data;
+
+	while (dbus_connection_read_write_dispatch(dbus_connection, -1))
+		;
+	dbus_connection_unref(dbus_connection);
+	return NULL;
+}
+
+/* every direct connection gets a thread of its own */
+static void new_peer(DBusServer *server, DBusConnection *dbus_connection,
+		     void *data)
+{
+	pthread_t thread;
+
+	dbus_connection_ref(dbus_connection);
+	if (!dbus_connection_add_filter(dbus_connection, handle_message, NULL, NULL) ||
+	    pthread_create(&thread, NULL, serve_peer, dbus_connection) != 0) {
+		fprintf(stderr, "Could not serve a new connection\n");
+		dbus_connection_close(dbus_connection);
+		dbus_connection_unref(dbus_connection);
+		return;
+	}
+	pthread_detach(thread);
+}
+
+static dbus_bool_t add_server_watch(DBusWatch *watch, void *data)
+{
+	server_watch = watch;
+	return TRUE;
+}
+
+static void remove_server_watch(DBusWatch *watch, void *data)
+{
+	if (server_watch == watch)
+		server_watch = NULL;
+}
+
+static int listen_peers(const char *address)
+{
+	DBusServer	*server;
+	DBusError	dbus_error;
+	struct pollfd	pollfd;
+
+	dbus_threads_init_default();
+	dbus_error_init(&dbus_error);
+	server = dbus_server_listen(address, &dbus_error);
+	if (server == NULL) {
+		fprintf(stderr, "Could not listen on %s: %s\n", address,
+			dbus_error.message);
+		dbus_error_free(&dbus_error);
+		return 1;
+	}
+
+	dbus_server_set_new_connection_function(server, new_peer, NULL, NULL);
+	if (!dbus_server_set_watch_functions(server, add_server_watch,
+					     remove_server_watch, NULL, NULL, NULL)) {
+		fprintf(stderr, "Could not watch %s: OOM\n", address);
+		dbus_server_unref(server);
+		return 1;
+	}
+
+	while (server_watch != NULL) {
+		pollfd.fd = dbus_watch_get_unix_fd(server_watch);
+		pollfd.events = POLLIN;
+		if (poll(&pollfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Could not wait for connections: %s\n",
+				strerror(errno));
+			break;
+		}
+		if (pollfd.revents != 0)
+			dbus_watch_handle(server_watch, DBUS_WATCH_READABLE);
+	}
+
+	dbus_server_disconnect(server);
+	dbus_server_unref(server);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	DBusConnection	*dbus_connection;
+	DBusError	dbus_error;
+	const char	*address	= NULL;
+	const char	*listen_address	= NULL;
+	int		option;
+
+	while ((option = getopt(argc, argv, "a:p:d:l:j:e:t:s:vh")) != -1) {
+		switch (option) {
+		case 'a':
+			address = optarg;
+			break;
+		case 'p':
+			listen_address = optarg;
+			break;
+		case 'd':
+			device_count = atoi(optarg);
+			break;
+		case 'l':
+			latency = atoi(optarg);
+			break;
+		case 'j':
+			jitter = atoi(optarg);
+			break;
+		case 'e':
+			error_rate = atof(optarg);
+			break;
+		case 't':
+			drop_rate = atof(optarg);
+			break;
+		case 's':
+			srandom(strtoul(optarg, NULL, 10));
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return option == 'h' ? 0 : 1;
+		}
+	}
+
+	if (device_count < 0 || latency < 0 || jitter < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (listen_address != NULL)
+		return listen_peers(listen_address);
+
+	dbus_error_init(&dbus_error);
+	dbus_connection = connect_bus(address, &dbus_error);
+	if (dbus_connection == NULL) {
+		fprintf(stderr, "Could not connect to the bus: %s\n",
+			dbus_error.message);
+		return 1;
+	}
+
+	if (dbus_bus_request_name(dbus_connection, DBUS_HAL_SERVICE,
+				  DBUS_NAME_FLAG_DO_NOT_QUEUE, &dbus_error) !=
+	    DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+		fprintf(stderr, "Could not own %s: %s\n", DBUS_HAL_SERVICE,
+			dbus_error_is_set(&dbus_error) ? dbus_error.message :
+			"already owned");
+		return 1;
+	}
+
+	dbus_connection_add_filter(dbus_connection, handle_message, NULL, NULL);
+	while (dbus_connection_read_write_dispatch(dbus_connection, -1))
+		;
+	return 0;
+}
@@ -21,6 +21,7 @@ int main(int argc, char *argv[])
 
 	int ret = 0;
 	DBusMessage *reply = NULL;
+	DBusMessage *message = NULL;
 
 	printf("Try to set the ondemand governor\n");
 /*	liblazy_dbus_system_use_private_connection(1);*/
@@ -122,6 +123,21 @@ int main(int argc, char *argv[])
 					      DBUS_TYPE_INVALID);
 	printf("return value: %d\n", ret);
 	
+	printf("--------------------\n");
+	printf("Trying to read arguments with a bogus format\n");
+	message = dbus_message_new_signal("/macht/holger/super",
+					  "org.holger.super", "heyho");
+	if (message != NULL) {
+		dbus_message_append_args(message, DBUS_TYPE_STRING, &governor,
+					 DBUS_TYPE_INVALID);
+		ret = liblazy_dbus_message_get_args(message, "z", &rpstring);
+		printf("return value: %d (expected %d)\n", ret,
+		       LIBLAZY_ERROR_INVALID_ARGUMENT);
+		ret = liblazy_dbus_message_get_args(message, "s", &rpstring);
+		printf("return value: %d\n", ret);
+		printf("returned string: %s\n", rpstring);
+		dbus_message_unref(message);
+	}
 
 	return 0;
 }